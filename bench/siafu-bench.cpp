@@ -0,0 +1,861 @@
+// SPDX-FileCopyrightText: 2023 C. J. Howard
+// SPDX-License-Identifier: MIT
+
+#include "siafu.hpp"
+#include "config.hpp"
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <numbers>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace
+{
+	/// Benchmark help string.
+	inline constexpr std::string_view bench_help_string =
+		"usage: siafu-bench [--help] [--threads <count>] [--repeat <count>]\n"
+		"                   [--size <n>|<width>x<height>x<depth>]\n"
+		"                   [--volumes <name>[,<name>...]] [--formats <format>[,<format>...]]\n"
+		"                   [--dir <path>] [--json <path>|-]\n"
+		"\n"
+		"volumes: sphere, gyroid, phantom, speckle\n"
+		"formats: u8, u16, i16, u32, f32";
+	
+	/// Synthetic volume generators.
+	inline constexpr std::string_view volume_names[] = {"sphere", "gyroid", "phantom", "speckle"};
+	
+	/// Voxel formats.
+	inline constexpr std::string_view format_names[] = {"u8", "u16", "i16", "u32", "f32"};
+	
+	/// Timing and throughput of a benchmarked stage.
+	struct result
+	{
+		std::string volume;
+		std::string format;
+		std::string stage;
+		
+		/// Duration of each repetition, in seconds.
+		std::vector<f64> seconds;
+		
+		/// Number of voxels processed, or zero if not applicable.
+		u64 voxel_count{0};
+		
+		/// Number of triangles processed, or zero if not applicable.
+		u64 triangle_count{0};
+		
+		/// Number of bytes read or written, or zero if not applicable.
+		u64 byte_count{0};
+		
+		/// Returns the duration of the fastest repetition, in seconds, bounded below by the resolution of the timer.
+		[[nodiscard]] f64 best() const noexcept
+		{
+			return std::max(std::ranges::min(seconds), 1e-9);
+		}
+	};
+	
+	/// Mixes a 64-bit value into a well-distributed hash.
+	[[nodiscard]] inline constexpr u64 hash(u64 x) noexcept
+	{
+		x += 0x9e3779b97f4a7c15;
+		x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+		x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+		return x ^ (x >> 31);
+	}
+	
+	/// Returns a deterministic pseudorandom value in [0, 1) for a voxel index and seed.
+	[[nodiscard]] inline constexpr f32 noise(u64 index, u64 seed) noexcept
+	{
+		return static_cast<f32>(hash(index ^ hash(seed)) >> 40) * 0x1p-24f;
+	}
+	
+	/**
+	 * Evaluates a synthetic scalar field at a point, normalized such that the isosurface of interest lies at 0.5.
+	 *
+	 * @param[in] name Name of the volume.
+	 * @param[in] p Point in the [-1, 1] cube.
+	 * @param[in] index Voxel index, which seeds noise.
+	 *
+	 * @return Value in [0, 1].
+	 */
+	[[nodiscard]] f32 evaluate(std::string_view name, const f32vec3& p, u64 index)
+	{
+		if (name == "sphere")
+		{
+			// Sphere of radius 0.8
+			return std::clamp(1.3f - std::sqrt(p.x * p.x + p.y * p.y + p.z * p.z), 0.0f, 1.0f);
+		}
+		else if (name == "gyroid")
+		{
+			// Gyroid with four periods across the volume
+			constexpr f32 k = 4.0f * std::numbers::pi_v<f32>;
+			const f32 g = std::sin(k * p.x) * std::cos(k * p.y) + std::sin(k * p.y) * std::cos(k * p.z) + std::sin(k * p.z) * std::cos(k * p.x);
+			return std::clamp(0.5f + g / 3.0f, 0.0f, 1.0f);
+		}
+		else if (name == "phantom")
+		{
+			// Nested ellipsoids of differing densities, after the Shepp-Logan phantom, with acquisition noise
+			struct ellipsoid
+			{
+				f32vec3 center;
+				f32vec3 radii;
+				f32 density;
+			};
+			static constexpr ellipsoid ellipsoids[] =
+			{
+				{{0.0f, 0.0f, 0.0f}, {0.69f, 0.92f, 0.81f}, 0.8f},
+				{{0.0f, -0.0184f, 0.0f}, {0.6624f, 0.874f, 0.78f}, -0.5f},
+				{{0.22f, 0.0f, 0.0f}, {0.11f, 0.31f, 0.22f}, 0.45f},
+				{{-0.22f, 0.0f, 0.0f}, {0.16f, 0.41f, 0.28f}, 0.45f},
+				{{0.0f, 0.35f, -0.15f}, {0.21f, 0.25f, 0.41f}, 0.3f},
+				{{0.0f, 0.1f, 0.25f}, {0.046f, 0.046f, 0.05f}, 0.5f},
+				{{-0.08f, -0.605f, 0.0f}, {0.046f, 0.023f, 0.05f}, 0.5f},
+				{{0.06f, -0.605f, 0.0f}, {0.023f, 0.046f, 0.02f}, 0.5f}
+			};
+			
+			f32 density = 0.0f;
+			for (const auto& e: ellipsoids)
+			{
+				const f32vec3 d = {(p.x - e.center.x) / e.radii.x, (p.y - e.center.y) / e.radii.y, (p.z - e.center.z) / e.radii.z};
+				if (d.x * d.x + d.y * d.y + d.z * d.z <= 1.0f)
+				{
+					density += e.density;
+				}
+			}
+			return std::clamp(density + (noise(index, 1) - 0.5f) * 0.16f, 0.0f, 1.0f);
+		}
+		else
+		{
+			// Isolated bright voxels on a dark background, one in a thousand
+			return hash(index ^ hash(2)) % 1000 == 0 ? 1.0f : 0.0f;
+		}
+	}
+	
+	/// Converts a normalized value to a voxel of type `T`.
+	template <class T>
+	[[nodiscard]] inline T to_voxel(f32 value) noexcept
+	{
+		if constexpr (std::is_floating_point_v<T>)
+		{
+			return static_cast<T>(value);
+		}
+		else if constexpr (std::is_signed_v<T>)
+		{
+			return static_cast<T>(std::lround((value * 2.0f - 1.0f) * static_cast<f32>(std::numeric_limits<T>::max())));
+		}
+		else
+		{
+			return static_cast<T>(std::llround(static_cast<f64>(value) * static_cast<f64>(std::numeric_limits<T>::max())));
+		}
+	}
+	
+	/// Returns the isolevel of the isosurface of interest in a volume of voxels of type `T`.
+	template <class T>
+	[[nodiscard]] inline f32 to_isolevel() noexcept
+	{
+		return static_cast<f32>(to_voxel<T>(0.5f));
+	}
+	
+	/**
+	 * Writes a Z-slice to an uncompressed, single-strip TIFF file in native byte order.
+	 *
+	 * @param[in] path Path to the TIFF file.
+	 * @param[in] source Volume whose format to write.
+	 * @param[in] slice Z-slice voxels.
+	 *
+	 * @exception std::runtime_error Failed to write the file.
+	 */
+	void write_tiff(const fs::path& path, const volume& source, std::span<const std::byte> slice)
+	{
+		// Appends a value in native byte order
+		std::vector<std::byte> header;
+		auto append = [&]<class U>(U value)
+		{
+			const auto* bytes = reinterpret_cast<const std::byte*>(&value);
+			header.insert(header.end(), bytes, bytes + sizeof(U));
+		};
+		
+		// Appends an IFD entry with a single SHORT or LONG value
+		auto append_entry = [&]<class U>(u16 tag, U value)
+		{
+			append(tag);
+			append(u16{sizeof(U) == 2 ? u16{3} : u16{4}});
+			append(u32{1});
+			append(value);
+			if constexpr (sizeof(U) == 2)
+			{
+				append(u16{0});
+			}
+		};
+		
+		// Header, followed by the pixel data and then the IFD
+		const u32 ifd_offset = static_cast<u32>((8 + slice.size() + 1) & ~std::size_t{1});
+		append(std::endian::native == std::endian::little ? u16{0x4949} : u16{0x4d4d});
+		append(u16{42});
+		append(ifd_offset);
+		const std::size_t header_size = header.size();
+		
+		append(u16{10});
+		append_entry(u16{0x0100}, source.width);
+		append_entry(u16{0x0101}, source.height);
+		append_entry(u16{0x0102}, static_cast<u16>(source.bits_per_voxel));
+		append_entry(u16{0x0103}, u16{1});
+		append_entry(u16{0x0106}, u16{1});
+		append_entry(u16{0x0111}, u32{8});
+		append_entry(u16{0x0115}, u16{1});
+		append_entry(u16{0x0116}, source.height);
+		append_entry(u16{0x0117}, static_cast<u32>(slice.size()));
+		append_entry(u16{0x0153}, static_cast<u16>(source.format));
+		append(u32{0});
+		
+		std::ofstream file(path, std::ios::binary);
+		file.write(reinterpret_cast<const char*>(header.data()), static_cast<std::streamsize>(header_size));
+		file.write(reinterpret_cast<const char*>(slice.data()), static_cast<std::streamsize>(slice.size()));
+		if (ifd_offset != 8 + slice.size())
+		{
+			file.put('\0');
+		}
+		file.write(reinterpret_cast<const char*>(header.data() + header_size), static_cast<std::streamsize>(header.size() - header_size));
+		file.close();
+		if (!file)
+		{
+			throw std::runtime_error("failed to write TIFF file");
+		}
+	}
+	
+	/**
+	 * Reads a binary PLY file in native byte order with 32-bit vertex indices, as written by write_ply(). Vertex and face records are read and decoded one page at a time, concurrently, as read_sqm() reads an SQM file.
+	 *
+	 * @param[in] path Path to the PLY file.
+	 * @param[in] thread_count Maximum number of threads.
+	 *
+	 * @return Mesh read from the file.
+	 *
+	 * @exception std::runtime_error Failed to read the file, or the file is not laid out as written by write_ply().
+	 */
+	[[nodiscard]] mesh read_ply(const fs::path& path, u32 thread_count)
+	{
+		input_file file(path);
+		const u64 file_size = file.size();
+		
+		// Read the header, which ends at the first end_header line
+		constexpr std::string_view end_header = "end_header\n";
+		std::string header(static_cast<std::size_t>(std::min<u64>(file_size, 4096)), '\0');
+		file.read(0, std::as_writable_bytes(std::span{header}));
+		const std::size_t header_end = header.find(end_header);
+		if (header_end == std::string::npos)
+		{
+			throw std::runtime_error("invalid PLY header");
+		}
+		header.resize(header_end + end_header.size());
+		
+		// Parse element counts and check the record layout
+		auto element_count = [&](std::string_view element) -> u64
+		{
+			const std::string key = std::format("\nelement {} ", element);
+			const std::size_t i = header.find(key);
+			u64 count = 0;
+			if (i == std::string::npos || std::from_chars(header.data() + i + key.size(), header.data() + header.size(), count).ec != std::errc{})
+			{
+				throw std::runtime_error("invalid PLY header");
+			}
+			return count;
+		};
+		const u64 vertex_count = element_count("vertex");
+		const u64 triangle_count = element_count("face");
+		const std::string format = std::format("\nformat binary_{}_endian 1.0\n", std::endian::native == std::endian::little ? "little" : "big");
+		if (header.find(format) == std::string::npos || header.find("\nproperty list uchar uint32 vertex_indices\n") == std::string::npos)
+		{
+			throw std::runtime_error("unsupported PLY file");
+		}
+		
+		constexpr std::size_t vertex_record_size = sizeof(f32) * 6;
+		constexpr std::size_t face_record_size = 1 + sizeof(u32) * 3;
+		const u64 vertices_offset = header.size();
+		if (vertex_count > file_size / vertex_record_size || triangle_count > file_size / face_record_size)
+		{
+			throw std::runtime_error("invalid PLY header");
+		}
+		const u64 faces_offset = vertices_offset + vertex_count * vertex_record_size;
+		if (faces_offset + triangle_count * face_record_size != file_size)
+		{
+			throw std::runtime_error("invalid PLY header");
+		}
+		
+		mesh model;
+		auto& [vertices, triangles, chunks] = model;
+		vertices.resize(static_cast<std::size_t>(vertex_count));
+		triangles.resize(static_cast<std::size_t>(triangle_count));
+		
+		// Reads and decodes the records of a paged vector one page at a time
+		auto read_records = [&]<class T>(paged_vector<T>& elements, u64 offset, std::size_t record_size, auto decode)
+		{
+			const std::size_t page_count = (elements.size() + paged_vector<T>::page_size - 1) / paged_vector<T>::page_size;
+			parallel_for
+			(
+				page_count,
+				thread_count,
+				[&](std::size_t page)
+				{
+					const std::size_t first = page * paged_vector<T>::page_size;
+					const std::size_t count = std::min(paged_vector<T>::page_size, elements.size() - first);
+					std::vector<std::byte> records(count * record_size);
+					file.read(offset + u64{first} * record_size, records);
+					for (std::size_t i = 0; i < count; ++i)
+					{
+						decode(records.data() + i * record_size, elements[first + i]);
+					}
+				}
+			);
+		};
+		read_records
+		(
+			vertices,
+			vertices_offset,
+			vertex_record_size,
+			[](const std::byte* record, vertex& v)
+			{
+				f32 values[6];
+				std::memcpy(values, record, sizeof(values));
+				v = {{values[0], values[1], values[2]}, {values[3], values[4], values[5]}};
+			}
+		);
+		read_records
+		(
+			triangles,
+			faces_offset,
+			face_record_size,
+			[vertex_count](const std::byte* record, triangle& t)
+			{
+				u32 indices[3];
+				std::memcpy(indices, record + 1, sizeof(indices));
+				if (record[0] != std::byte{3} || indices[0] >= vertex_count || indices[1] >= vertex_count || indices[2] >= vertex_count)
+				{
+					throw std::runtime_error("invalid PLY face");
+				}
+				t = {indices[0], indices[1], indices[2]};
+			}
+		);
+		
+		if (!triangles.empty())
+		{
+			chunks.emplace_back(triangles.size(), 0);
+		}
+		
+		return model;
+	}
+	
+	/**
+	 * Compares the triangles of two meshes, whose triangle chunks may differ.
+	 *
+	 * @return `true` if both meshes have the same number of triangles, and each triangle references the same vertices of both meshes, `false` otherwise.
+	 */
+	[[nodiscard]] bool same_triangles(const mesh& a, const mesh& b)
+	{
+		if (a.triangles.size() != b.triangles.size())
+		{
+			return false;
+		}
+		
+		// Position in the triangle chunks of a mesh
+		struct chunk_cursor
+		{
+			const mesh& model;
+			std::size_t chunk{0};
+			std::size_t chunk_end{0};
+			u64 vertex_base{0};
+			
+			/// Advances to the triangle chunk which contains a triangle. Returns `false` if the triangle chunks end before the triangle.
+			[[nodiscard]] bool seek(std::size_t i)
+			{
+				while (i >= chunk_end)
+				{
+					if (chunk == model.chunks.size())
+					{
+						return false;
+					}
+					vertex_base = model.chunks[chunk].vertex_base;
+					chunk_end += model.chunks[chunk++].triangle_count;
+				}
+				return true;
+			}
+		};
+		
+		chunk_cursor cursor_a{a};
+		chunk_cursor cursor_b{b};
+		for (std::size_t i = 0; i < a.triangles.size(); ++i)
+		{
+			if (!cursor_a.seek(i) || !cursor_b.seek(i))
+			{
+				return false;
+			}
+			
+			const triangle& t = a.triangles[i];
+			const triangle& u = b.triangles[i];
+			if (cursor_a.vertex_base + t.a != cursor_b.vertex_base + u.a || cursor_a.vertex_base + t.b != cursor_b.vertex_base + u.b || cursor_a.vertex_base + t.c != cursor_b.vertex_base + u.c)
+			{
+				return false;
+			}
+		}
+		
+		return true;
+	}
+	
+	/// Quotes a string as a JSON string.
+	[[nodiscard]] std::string json_string(std::string_view s)
+	{
+		std::string out = "\"";
+		for (const char c: s)
+		{
+			if (c == '"' || c == '\\')
+			{
+				out += '\\';
+			}
+			out += c;
+		}
+		return out + "\"";
+	}
+	
+	/// Parses an unsigned integer argument, returning `false` if it is invalid or zero.
+	[[nodiscard]] bool parse_count(std::string_view value, u32& count)
+	{
+		const auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), count);
+		return ec == std::errc{} && ptr == value.data() + value.size() && count;
+	}
+	
+	/// Splits a comma-separated list.
+	[[nodiscard]] std::vector<std::string_view> split(std::string_view list)
+	{
+		std::vector<std::string_view> items;
+		for (;;)
+		{
+			const auto comma = list.find(',');
+			items.emplace_back(list.substr(0, comma));
+			if (comma == std::string_view::npos)
+			{
+				return items;
+			}
+			list.remove_prefix(comma + 1);
+		}
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	u32 thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+	u32 repeat_count = 3;
+	u32vec3 size = {256, 256, 256};
+	std::vector<std::string_view> volumes(std::begin(volume_names), std::end(volume_names));
+	std::vector<std::string_view> formats = {"u8", "u16", "f32"};
+	fs::path dir = fs::temp_directory_path();
+	std::string json_path;
+	
+	// Parse options
+	for (int i = 1; i < argc; ++i)
+	{
+		const std::string_view argument(argv[i]);
+		const std::string_view value = i + 1 < argc ? std::string_view(argv[i + 1]) : std::string_view{};
+		bool valid = i + 1 < argc;
+		
+		if (argument == "--help")
+		{
+			std::cout << bench_help_string << std::endl;
+			return 0;
+		}
+		else if (argument == "--threads")
+		{
+			valid = valid && parse_count(value, thread_count);
+		}
+		else if (argument == "--repeat")
+		{
+			valid = valid && parse_count(value, repeat_count);
+		}
+		else if (argument == "--size")
+		{
+			if (value.find('x') == std::string_view::npos)
+			{
+				valid = valid && parse_count(value, size.x);
+				size = {size.x, size.x, size.x};
+			}
+			else
+			{
+				const auto x = value.find('x');
+				const auto y = value.find('x', x + 1);
+				valid = valid && y != std::string_view::npos && parse_count(value.substr(0, x), size.x) && parse_count(value.substr(x + 1, y - x - 1), size.y) && parse_count(value.substr(y + 1), size.z);
+			}
+		}
+		else if (argument == "--volumes")
+		{
+			volumes = split(value);
+			valid = valid && std::ranges::all_of(volumes, [](auto name) { return std::ranges::find(volume_names, name) != std::end(volume_names); });
+		}
+		else if (argument == "--formats")
+		{
+			formats = split(value);
+			valid = valid && std::ranges::all_of(formats, [](auto name) { return std::ranges::find(format_names, name) != std::end(format_names); });
+		}
+		else if (argument == "--dir")
+		{
+			dir = value;
+		}
+		else if (argument == "--json")
+		{
+			json_path = value;
+		}
+		else
+		{
+			valid = false;
+		}
+		
+		if (!valid)
+		{
+			std::cerr << bench_help_string << std::endl;
+			return 1;
+		}
+		++i;
+	}
+	
+	// Create a scratch directory for volumes and meshes
+	const fs::path scratch = dir / std::format("siafu-bench-{}", std::chrono::steady_clock::now().time_since_epoch().count());
+	std::vector<result> results;
+	
+	// Times a stage over each repetition, and records its throughput
+	auto run = [&](std::string_view volume_name, std::string_view format_name, std::string_view stage, const std::function<void()>& function, const std::function<void(result&)>& measure)
+	{
+		result r{std::string(volume_name), std::string(format_name), std::string(stage), {}};
+		for (u32 i = 0; i < repeat_count; ++i)
+		{
+			const auto start = std::chrono::steady_clock::now();
+			function();
+			r.seconds.emplace_back(std::chrono::duration<f64>(std::chrono::steady_clock::now() - start).count());
+		}
+		measure(r);
+		
+		const f64 best = r.best();
+		std::string throughput;
+		if (r.voxel_count)
+		{
+			throughput += std::format(" {:10.1f} Mvoxels/s", static_cast<f64>(r.voxel_count) / best * 1e-6);
+		}
+		if (r.triangle_count)
+		{
+			throughput += std::format(" {:10.1f} Mtriangles/s", static_cast<f64>(r.triangle_count) / best * 1e-6);
+		}
+		if (r.byte_count)
+		{
+			throughput += std::format(" {:10.1f} MB/s", static_cast<f64>(r.byte_count) / best * 1e-6);
+		}
+		std::cout << std::format("{:<8} {:<4} {:<14} {:9.4f} s{}\n", r.volume, r.format, r.stage, best, throughput);
+		
+		results.emplace_back(std::move(r));
+	};
+	
+	// Benchmarks each stage of the pipeline on a volume of voxels of type `T`
+	auto bench = [&]<class T>(std::string_view volume_name, std::string_view format_name, T)
+	{
+		volume source;
+		source.width = size.x;
+		source.height = size.y;
+		source.depth = size.z;
+		source.bits_per_voxel = sizeof(T) * 8;
+		source.format = std::is_floating_point_v<T> ? voxel_format::floating_point : std::is_signed_v<T> ? voxel_format::signed_integer : voxel_format::unsigned_integer;
+		const u64 voxel_count = u64{size.x} * size.y * size.z;
+		
+		// Generate the volume and write it as a sequence of TIFF files, one per Z-slice
+		const fs::path volume_dir = scratch / std::format("{}-{}", volume_name, format_name);
+		fs::create_directories(volume_dir);
+		const f32 scale = 2.0f / static_cast<f32>(std::max({size.x, size.y, size.z, 2u}) - 1);
+		parallel_for
+		(
+			size.z,
+			thread_count,
+			[&](std::size_t z)
+			{
+				std::vector<T> slice(std::size_t{size.x} * size.y);
+				for (u32 y = 0; y < size.y; ++y)
+				{
+					for (u32 x = 0; x < size.x; ++x)
+					{
+						const std::size_t i = std::size_t{size.x} * y + x;
+						const f32vec3 p = {static_cast<f32>(x) * scale - 1.0f, static_cast<f32>(y) * scale - 1.0f, static_cast<f32>(z) * scale - 1.0f};
+						slice[i] = to_voxel<T>(evaluate(volume_name, p, i + slice.size() * z));
+					}
+				}
+				write_tiff(volume_dir / std::format("{:06}.tif", z), source, std::as_bytes(std::span{slice}));
+			}
+		);
+		
+		// Load the volume from the TIFF files. Files which were just written are likely to be read from the page cache
+		run
+		(
+			volume_name,
+			format_name,
+			"load",
+			[&]()
+			{
+				source = open_volume(volume_dir);
+				load_volume(source, thread_count, 64);
+			},
+			[&](result& r)
+			{
+				r.voxel_count = voxel_count;
+				r.byte_count = voxel_count * sizeof(T);
+			}
+		);
+		
+		run
+		(
+			volume_name,
+			format_name,
+			"index_bricks",
+			[&]()
+			{
+				source.bricks = nullptr;
+				index_bricks<T>(source, thread_count);
+			},
+			[&](result& r)
+			{
+				r.voxel_count = voxel_count;
+			}
+		);
+		
+		// Extract the isosurface with each engine, keeping the marching cubes isosurface for output
+		const f32 isolevel = to_isolevel<T>();
+		mesh model;
+		auto extract = [&](std::string_view stage, auto polygonize_function, bool keep)
+		{
+			u64 triangle_count = 0;
+			run
+			(
+				volume_name,
+				format_name,
+				stage,
+				[&]()
+				{
+					mesh m;
+					polygonize_function(std::span{&isolevel, 1}, source, thread_count, std::span{&m, 1});
+					triangle_count = m.triangles.size();
+					if (keep)
+					{
+						model = std::move(m);
+					}
+				},
+				[&](result& r)
+				{
+					r.voxel_count = voxel_count;
+					r.triangle_count = triangle_count;
+				}
+			);
+		};
+		extract("polygonize", [](auto&&... args) { polygonize<T>(args...); }, true);
+		extract("flying_edges", [](auto&&... args) { polygonize_flying_edges<T>(args...); }, false);
+		extract("surface_nets", [](auto&&... args) { polygonize_surface_nets<T>(args...); }, false);
+		
+		// Write the isosurface in each output format
+		const u64 triangle_count = model.triangles.size();
+		auto output = [&](std::string_view stage, const fs::path& path, const std::function<void()>& function)
+		{
+			run
+			(
+				volume_name,
+				format_name,
+				stage,
+				function,
+				[&](result& r)
+				{
+					r.triangle_count = triangle_count;
+					r.byte_count = fs::file_size(path);
+				}
+			);
+		};
+		const fs::path obj_path = scratch / "mesh.obj";
+		const fs::path ply_path = scratch / "mesh.ply";
+		const fs::path stl_path = scratch / "mesh.stl";
+		const fs::path sqm_path = scratch / "mesh.sqm";
+		output
+		(
+			"write_obj",
+			obj_path,
+			[&]()
+			{
+				std::ofstream file(obj_path, std::ios::binary);
+				write_obj(file, model, thread_count);
+				file.close();
+				if (!file)
+				{
+					throw std::runtime_error("failed to write OBJ file");
+				}
+			}
+		);
+		output("write_ply", ply_path, [&]() { write_ply(ply_path, model, thread_count); });
+		if (triangle_count <= std::numeric_limits<u32>::max())
+		{
+			output("write_stl", stl_path, [&]() { write_stl(stl_path, model, thread_count); });
+		}
+		output("write_sqm", sqm_path, [&]() { write_sqm(sqm_path, model, thread_count); });
+		
+		// Reload the isosurface from the PLY and SQM files, checking that each preserves the vertex count and every triangle
+		auto input = [&](std::string_view stage, const fs::path& path, const std::function<mesh()>& function)
+		{
+			mesh reloaded;
+			run
+			(
+				volume_name,
+				format_name,
+				stage,
+				[&]()
+				{
+					reloaded = function();
+				},
+				[&](result& r)
+				{
+					r.triangle_count = triangle_count;
+					r.byte_count = fs::file_size(path);
+				}
+			);
+			if (reloaded.vertices.size() != model.vertices.size() || !same_triangles(reloaded, model))
+			{
+				throw std::runtime_error(std::format("{} changed the vertex count or the triangles of the mesh", stage));
+			}
+			return reloaded;
+		};
+		if (model.vertices.size() <= u64{1} << 32)
+		{
+			input("read_ply", ply_path, [&]() { return read_ply(ply_path, thread_count); });
+		}
+		const mesh reloaded = input("read_sqm", sqm_path, [&]() { return read_sqm(sqm_path, thread_count); });
+		
+		// Each position coordinate is quantized to 16 bits across the bounding box of the mesh, so is off by no more than half a quantization step, plus rounding of the dequantized coordinate
+		constexpr f64 infinity = std::numeric_limits<f64>::infinity();
+		f64 min[3] = {infinity, infinity, infinity};
+		f64 max[3] = {-infinity, -infinity, -infinity};
+		f64 error[3] = {0.0, 0.0, 0.0};
+		for (std::size_t i = 0; i < model.vertices.size(); ++i)
+		{
+			const f32vec3& p = model.vertices[i].p;
+			const f32vec3& q = reloaded.vertices[i].p;
+			const f64 coordinates[3][2] = {{p.x, q.x}, {p.y, q.y}, {p.z, q.z}};
+			for (std::size_t axis = 0; axis < 3; ++axis)
+			{
+				min[axis] = std::min(min[axis], coordinates[axis][0]);
+				max[axis] = std::max(max[axis], coordinates[axis][0]);
+				error[axis] = std::max(error[axis], std::abs(coordinates[axis][1] - coordinates[axis][0]));
+			}
+		}
+		for (std::size_t axis = 0; axis < 3; ++axis)
+		{
+			const f64 magnitude = std::max(std::abs(min[axis]), std::abs(max[axis]));
+			if (error[axis] > (max[axis] - min[axis]) / 65535.0 * 0.5 * 1.01 + magnitude * 4.0 * std::numeric_limits<f32>::epsilon())
+			{
+				throw std::runtime_error(std::format("read_sqm position error {} exceeds quantization bound", error[axis]));
+			}
+		}
+		
+		for (const auto& path: {obj_path, ply_path, stl_path, sqm_path})
+		{
+			fs::remove(path);
+		}
+		
+		fs::remove_all(volume_dir);
+	};
+	
+	std::cout << std::format("{} ({}x{}x{} voxels, {} threads, best of {})\n", siafu_version_string, size.x, size.y, size.z, thread_count, repeat_count);
+	try
+	{
+		fs::create_directories(scratch);
+		for (const auto volume_name: volumes)
+		{
+			for (const auto format_name: formats)
+			{
+				if (format_name == "u8")
+				{
+					bench(volume_name, format_name, u8{});
+				}
+				else if (format_name == "u16")
+				{
+					bench(volume_name, format_name, u16{});
+				}
+				else if (format_name == "i16")
+				{
+					bench(volume_name, format_name, i16{});
+				}
+				else if (format_name == "u32")
+				{
+					bench(volume_name, format_name, u32{});
+				}
+				else
+				{
+					bench(volume_name, format_name, f32{});
+				}
+			}
+		}
+		fs::remove_all(scratch);
+	}
+	catch (const std::exception& e)
+	{
+		std::error_code ec;
+		fs::remove_all(scratch, ec);
+		std::cerr << std::format("benchmark failed: {}\n", e.what());
+		return 1;
+	}
+	
+	// Write results as JSON, for regression tracking
+	if (!json_path.empty())
+	{
+		std::string json = std::format("{{\n\t\"version\": {},\n\t\"threads\": {},\n\t\"dimensions\": [{}, {}, {}],\n\t\"results\":\n\t[\n", json_string(siafu_version_string), thread_count, size.x, size.y, size.z);
+		for (std::size_t i = 0; i < results.size(); ++i)
+		{
+			const auto& r = results[i];
+			const f64 best = r.best();
+			std::string seconds;
+			for (const f64 s: r.seconds)
+			{
+				seconds += std::format("{}{}", seconds.empty() ? "" : ", ", s);
+			}
+			json += std::format("\t\t{{\"volume\": {}, \"format\": {}, \"stage\": {}, \"seconds\": [{}], \"best_seconds\": {}", json_string(r.volume), json_string(r.format), json_string(r.stage), seconds, best);
+			if (r.voxel_count)
+			{
+				json += std::format(", \"voxels\": {}, \"voxels_per_second\": {}", r.voxel_count, static_cast<f64>(r.voxel_count) / best);
+			}
+			if (r.triangle_count)
+			{
+				json += std::format(", \"triangles\": {}, \"triangles_per_second\": {}", r.triangle_count, static_cast<f64>(r.triangle_count) / best);
+			}
+			if (r.byte_count)
+			{
+				json += std::format(", \"bytes\": {}, \"megabytes_per_second\": {}", r.byte_count, static_cast<f64>(r.byte_count) / best * 1e-6);
+			}
+			json += i + 1 < results.size() ? "},\n" : "}\n";
+		}
+		json += "\t]\n}\n";
+		
+		if (json_path == "-")
+		{
+			std::cout << json;
+		}
+		else
+		{
+			std::ofstream file(json_path, std::ios::binary);
+			file << json;
+			if (!file)
+			{
+				std::cerr << "failed to write JSON results\n";
+				return 1;
+			}
+		}
+	}
+	
+	return 0;
+}
@@ -0,0 +1,111 @@
+// SPDX-FileCopyrightText: 2023 C. J. Howard
+// SPDX-License-Identifier: MIT
+
+#include "siafu.hpp"
+#include <algorithm>
+#include <limits>
+
+namespace
+{
+	/// Returns the lesser of two values, ignoring NaN.
+	template <class T>
+	[[nodiscard]] inline T min_value(T a, T b) noexcept
+	{
+		return (b < a || a != a) ? b : a;
+	}
+	
+	/// Returns the greater of two values, or NaN if the second value is NaN. Voxels which are NaN are never inside an isosurface.
+	template <class T>
+	[[nodiscard]] inline T max_value(T a, T b) noexcept
+	{
+		return (b > a || b != b) ? b : a;
+	}
+}
+
+template <class T>
+void index_bricks(volume& source, u32 thread_count)
+{
+	constexpr u32 brick_size = brick_index::brick_size;
+	
+	const u32 width = source.width;
+	const u32vec3 max{std::max(source.width, 1u) - 1, std::max(source.height, 1u) - 1, std::max(source.depth, 1u) - 1};
+	
+	auto index = std::make_shared<brick_index>();
+	index->dimensions = {(max.x + brick_size - 1) / brick_size, (max.y + brick_size - 1) / brick_size, (max.z + brick_size - 1) / brick_size};
+	const auto& dimensions = index->dimensions;
+	const std::size_t brick_count = std::size_t{dimensions.x} * dimensions.y * dimensions.z;
+	index->min_values.assign(brick_count, std::numeric_limits<f32>::infinity());
+	index->max_values.assign(brick_count, -std::numeric_limits<f32>::infinity());
+	if (!brick_count)
+	{
+		source.bricks = std::move(index);
+		return;
+	}
+	
+	// Index each Z-layer of bricks concurrently
+	parallel_for
+	(
+		dimensions.z,
+		thread_count,
+		[&](std::size_t bz)
+		{
+			std::unique_ptr<std::byte[]> staging_buffer;
+			if (!source.voxels)
+			{
+				staging_buffer = std::make_unique_for_overwrite<std::byte[]>(source.slice_size());
+			}
+			
+			const std::size_t layer_offset = std::size_t{dimensions.x} * dimensions.y * bz;
+			const u32 z_begin = static_cast<u32>(bz) * brick_size;
+			const u32 z_end = std::min(z_begin + brick_size, max.z);
+			for (u32 z = z_begin; z <= z_end; ++z)
+			{
+				const T* slice = reinterpret_cast<const T*>(source.read_slice(z, staging_buffer.get()));
+				
+				for (u32 y = 0; y <= max.y; ++y)
+				{
+					const T* row = slice + std::size_t{width} * y;
+					
+					// Rows on the boundary between two bricks belong to both
+					const u32 by = y / brick_size;
+					const u32 by_first = (y % brick_size || !by) ? by : by - 1;
+					const u32 by_last = std::min(by, dimensions.y - 1);
+					
+					for (u32 bx = 0; bx < dimensions.x; ++bx)
+					{
+						// Find the range of values in the row of the brick. Conversion to `f32` preserves order, so values are converted only once the range is known
+						const u32 x_begin = bx * brick_size;
+						const u32 x_end = std::min(x_begin + brick_size, max.x);
+						T row_min = row[x_begin];
+						T row_max = row[x_begin];
+						for (u32 x = x_begin + 1; x <= x_end; ++x)
+						{
+							row_min = min_value(row_min, row[x]);
+							row_max = max_value(row_max, row[x]);
+						}
+						
+						for (u32 brick_y = by_first; brick_y <= by_last; ++brick_y)
+						{
+							const std::size_t i = layer_offset + std::size_t{dimensions.x} * brick_y + bx;
+							index->min_values[i] = min_value(index->min_values[i], static_cast<f32>(row_min));
+							index->max_values[i] = max_value(index->max_values[i], static_cast<f32>(row_max));
+						}
+					}
+				}
+				
+				if (reinterpret_cast<const std::byte*>(slice) != staging_buffer.get() && source.release_slice)
+				{
+					source.release_slice(z);
+				}
+			}
+		}
+	);
+	
+	source.bricks = std::move(index);
+}
+
+template void index_bricks<u8>(volume&, u32);
+template void index_bricks<u16>(volume&, u32);
+template void index_bricks<i16>(volume&, u32);
+template void index_bricks<u32>(volume&, u32);
+template void index_bricks<f32>(volume&, u32);
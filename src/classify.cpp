@@ -0,0 +1,141 @@
+// SPDX-FileCopyrightText: 2023 C. J. Howard
+// SPDX-License-Identifier: MIT
+
+#include "siafu.hpp"
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(_M_X64)
+	#define SIAFU_X86_64
+	#include <immintrin.h>
+	#if defined(_MSC_VER) && !defined(__clang__)
+		#include <intrin.h>
+		#define SIAFU_TARGET(isa)
+	#else
+		#define SIAFU_TARGET(isa) __attribute__((target(isa)))
+	#endif
+#endif
+
+namespace
+{
+	/// Row classification function.
+	using classify_function = void(*)(const f32*, std::size_t, f32, u64*);
+	
+	/// Classifies a row of values one at a time.
+	void classify_scalar(const f32* values, std::size_t count, f32 isolevel, u64* mask)
+	{
+		for (std::size_t i = 0; i < count; i += 64)
+		{
+			const std::size_t n = std::min<std::size_t>(count - i, 64);
+			
+			u64 word = 0;
+			for (std::size_t j = 0; j < n; ++j)
+			{
+				word |= u64{values[i + j] < isolevel} << j;
+			}
+			mask[i >> 6] = word;
+		}
+	}
+	
+	#if defined(SIAFU_X86_64)
+	
+	/// Classifies a row of values four at a time.
+	void classify_sse2(const f32* values, std::size_t count, f32 isolevel, u64* mask)
+	{
+		const __m128 threshold = _mm_set1_ps(isolevel);
+		const std::size_t full_count = count & ~std::size_t{63};
+		
+		for (std::size_t i = 0; i < full_count; i += 64)
+		{
+			u64 word = 0;
+			for (std::size_t j = 0; j < 64; j += 4)
+			{
+				const __m128 v = _mm_loadu_ps(values + i + j);
+				word |= static_cast<u64>(_mm_movemask_ps(_mm_cmplt_ps(v, threshold))) << j;
+			}
+			mask[i >> 6] = word;
+		}
+		
+		classify_scalar(values + full_count, count - full_count, isolevel, mask + (full_count >> 6));
+	}
+	
+	/// Classifies a row of values eight at a time.
+	SIAFU_TARGET("avx2")
+	void classify_avx2(const f32* values, std::size_t count, f32 isolevel, u64* mask)
+	{
+		const __m256 threshold = _mm256_set1_ps(isolevel);
+		const std::size_t full_count = count & ~std::size_t{63};
+		
+		for (std::size_t i = 0; i < full_count; i += 64)
+		{
+			u64 word = 0;
+			for (std::size_t j = 0; j < 64; j += 8)
+			{
+				const __m256 v = _mm256_loadu_ps(values + i + j);
+				word |= static_cast<u64>(_mm256_movemask_ps(_mm256_cmp_ps(v, threshold, _CMP_LT_OQ))) << j;
+			}
+			mask[i >> 6] = word;
+		}
+		
+		classify_scalar(values + full_count, count - full_count, isolevel, mask + (full_count >> 6));
+	}
+	
+	/// Classifies a row of values sixteen at a time.
+	SIAFU_TARGET("avx512f")
+	void classify_avx512(const f32* values, std::size_t count, f32 isolevel, u64* mask)
+	{
+		const __m512 threshold = _mm512_set1_ps(isolevel);
+		const std::size_t full_count = count & ~std::size_t{63};
+		
+		for (std::size_t i = 0; i < full_count; i += 64)
+		{
+			u64 word = 0;
+			for (std::size_t j = 0; j < 64; j += 16)
+			{
+				const __m512 v = _mm512_loadu_ps(values + i + j);
+				word |= static_cast<u64>(_mm512_cmp_ps_mask(v, threshold, _CMP_LT_OQ)) << j;
+			}
+			mask[i >> 6] = word;
+		}
+		
+		classify_scalar(values + full_count, count - full_count, isolevel, mask + (full_count >> 6));
+	}
+	
+	#endif
+	
+	/// Selects the classification function for the widest instruction set supported by the CPU.
+	[[nodiscard]] classify_function select_classify_function() noexcept
+	{
+		#if defined(SIAFU_X86_64)
+			#if defined(_MSC_VER) && !defined(__clang__)
+				int info[4];
+				__cpuid(info, 1);
+				const bool osxsave = info[2] & (1 << 27);
+				const u64 xcr0 = osxsave ? _xgetbv(0) : 0;
+				__cpuidex(info, 7, 0);
+				const bool avx2 = (info[1] & (1 << 5)) && (xcr0 & 0x06) == 0x06;
+				const bool avx512 = (info[1] & (1 << 16)) && (xcr0 & 0xe6) == 0xe6;
+			#else
+				const bool avx2 = __builtin_cpu_supports("avx2");
+				const bool avx512 = __builtin_cpu_supports("avx512f");
+			#endif
+			
+			if (avx512)
+			{
+				return classify_avx512;
+			}
+			if (avx2)
+			{
+				return classify_avx2;
+			}
+			return classify_sse2;
+		#else
+			return classify_scalar;
+		#endif
+	}
+}
+
+void classify_row(std::span<const f32> values, f32 isolevel, std::span<u64> mask)
+{
+	static const classify_function classify = select_classify_function();
+	classify(values.data(), std::min(values.size(), mask.size() << 6), isolevel, mask.data());
+}
@@ -0,0 +1,765 @@
+// SPDX-FileCopyrightText: 2023 C. J. Howard
+// SPDX-License-Identifier: MIT
+
+#include "siafu.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <queue>
+
+namespace
+{
+	/// Maximum number of triangles simplified as one range. Ranges are runs of triangles along a Morton curve, which are compact spatial blocks, and are simplified concurrently.
+	inline constexpr std::size_t range_size = std::size_t{1} << 15;
+	
+	/// Maximum number of simplification rounds. Range boundaries are shifted by half a range each round, such that vertices locked on range boundaries in one round may be collapsed in the next.
+	inline constexpr u32 max_rounds = 4;
+	
+	/// Number of bits per axis of the Morton codes of triangle centroids.
+	inline constexpr u32 morton_bits = 10;
+	
+	/// Marks a vertex which is not referenced by any range.
+	inline constexpr u32 no_owner = std::numeric_limits<u32>::max();
+	
+	/// Marks a vertex which is referenced by more than one range.
+	inline constexpr u32 shared_owner = no_owner - 1;
+	
+	/// Spreads the low 10 bits of an integer such that each is followed by two zero bits.
+	[[nodiscard]] inline constexpr u32 spread_bits(u32 x) noexcept
+	{
+		x &= 0x3ff;
+		x = (x | (x << 16)) & 0x30000ff;
+		x = (x | (x << 8)) & 0x300f00f;
+		x = (x | (x << 4)) & 0x30c30c3;
+		x = (x | (x << 2)) & 0x9249249;
+		return x;
+	}
+	
+	/**
+	 * Sorts the triangles of each triangle chunk along a Morton curve through their centroids, such that runs of consecutive triangles are compact spatial blocks rather than thin slices of the isosurface.
+	 *
+	 * @param[in,out] model Mesh whose triangles are sorted.
+	 * @param[in] thread_count Maximum number of threads.
+	 */
+	void sort_triangles(mesh& model, u32 thread_count)
+	{
+		auto& [vertices, triangles, chunks] = model;
+		
+		// Find the bounds of the vertices
+		f32vec3 min_p = {std::numeric_limits<f32>::infinity(), std::numeric_limits<f32>::infinity(), std::numeric_limits<f32>::infinity()};
+		f32vec3 max_p = {-min_p.x, -min_p.y, -min_p.z};
+		vertices.for_each_span
+		(
+			0,
+			vertices.size(),
+			[&](std::span<const vertex> page)
+			{
+				for (const auto& v: page)
+				{
+					min_p = {std::min(min_p.x, v.p.x), std::min(min_p.y, v.p.y), std::min(min_p.z, v.p.z)};
+					max_p = {std::max(max_p.x, v.p.x), std::max(max_p.y, v.p.y), std::max(max_p.z, v.p.z)};
+				}
+			}
+		);
+		constexpr u32 max_coordinate = (1u << morton_bits) - 1;
+		const f32 extent = std::max({max_p.x - min_p.x, max_p.y - min_p.y, max_p.z - min_p.z});
+		const f32 scale = extent > 0.0f ? static_cast<f32>(max_coordinate) / (extent * 3.0f) : 0.0f;
+		
+		// Sort each chunk by the Morton codes of its triangle centroids, breaking ties by triangle index
+		std::vector<std::size_t> chunk_firsts(chunks.size() + 1, 0);
+		for (std::size_t i = 0; i < chunks.size(); ++i)
+		{
+			chunk_firsts[i + 1] = chunk_firsts[i] + chunks[i].triangle_count;
+		}
+		paged_vector<triangle> sorted;
+		sorted.resize(triangles.size());
+		parallel_for
+		(
+			chunks.size(),
+			thread_count,
+			[&](std::size_t chunk)
+			{
+				const u64 vertex_base = chunks[chunk].vertex_base;
+				std::vector<std::pair<u32, std::size_t>> keys(chunks[chunk].triangle_count);
+				for (std::size_t i = 0; i < keys.size(); ++i)
+				{
+					const auto& t = triangles[chunk_firsts[chunk] + i];
+					const f32vec3& a = vertices[static_cast<std::size_t>(vertex_base + t.a)].p;
+					const f32vec3& b = vertices[static_cast<std::size_t>(vertex_base + t.b)].p;
+					const f32vec3& c = vertices[static_cast<std::size_t>(vertex_base + t.c)].p;
+					const u32 x = std::min(static_cast<u32>((a.x + b.x + c.x - min_p.x * 3.0f) * scale), max_coordinate);
+					const u32 y = std::min(static_cast<u32>((a.y + b.y + c.y - min_p.y * 3.0f) * scale), max_coordinate);
+					const u32 z = std::min(static_cast<u32>((a.z + b.z + c.z - min_p.z * 3.0f) * scale), max_coordinate);
+					keys[i] = {spread_bits(x) | spread_bits(y) << 1 | spread_bits(z) << 2, i};
+				}
+				std::ranges::sort(keys);
+				for (std::size_t i = 0; i < keys.size(); ++i)
+				{
+					sorted[chunk_firsts[chunk] + i] = triangles[chunk_firsts[chunk] + keys[i].second];
+				}
+			}
+		);
+		triangles = std::move(sorted);
+	}
+	
+	/// Symmetric 4x4 matrix measuring the sum of squared distances to a set of planes.
+	struct quadric
+	{
+		/// Upper triangle of the matrix, by row.
+		f64 xx{0}, xy{0}, xz{0}, xw{0}, yy{0}, yz{0}, yw{0}, zz{0}, zw{0}, ww{0};
+		
+		/// Adds the quadric of a plane, given its unit normal and distance from the origin.
+		void add_plane(f64 a, f64 b, f64 c, f64 d) noexcept
+		{
+			xx += a * a;
+			xy += a * b;
+			xz += a * c;
+			xw += a * d;
+			yy += b * b;
+			yz += b * c;
+			yw += b * d;
+			zz += c * c;
+			zw += c * d;
+			ww += d * d;
+		}
+		
+		/// Adds the planes of another quadric.
+		quadric& operator+=(const quadric& q) noexcept
+		{
+			xx += q.xx;
+			xy += q.xy;
+			xz += q.xz;
+			xw += q.xw;
+			yy += q.yy;
+			yz += q.yz;
+			yw += q.yw;
+			zz += q.zz;
+			zw += q.zw;
+			ww += q.ww;
+			return *this;
+		}
+		
+		/// Returns the sum of squared distances from a point to the planes.
+		[[nodiscard]] f64 error(const f32vec3& p) const noexcept
+		{
+			const f64 x = p.x;
+			const f64 y = p.y;
+			const f64 z = p.z;
+			const f64 e = xx * x * x + 2.0 * xy * x * y + 2.0 * xz * x * z + 2.0 * xw * x + yy * y * y + 2.0 * yz * y * z + 2.0 * yw * y + zz * z * z + 2.0 * zw * z + ww;
+			return std::max(e, 0.0);
+		}
+		
+		/// Finds the point which minimizes the error. Returns `false` if the minimum is not unique.
+		[[nodiscard]] bool minimize(f32vec3& p) const noexcept
+		{
+			const f64 c00 = yy * zz - yz * yz;
+			const f64 c01 = xz * yz - xy * zz;
+			const f64 c02 = xy * yz - xz * yy;
+			const f64 det = xx * c00 + xy * c01 + xz * c02;
+			const f64 scale = xx + yy + zz;
+			if (!(std::abs(det) > 1e-9 * scale * scale * scale))
+			{
+				return false;
+			}
+			const f64 c11 = xx * zz - xz * xz;
+			const f64 c12 = xy * xz - xx * yz;
+			const f64 c22 = xx * yy - xy * xy;
+			const f64 inv_det = 1.0 / det;
+			p.x = static_cast<f32>(-(c00 * xw + c01 * yw + c02 * zw) * inv_det);
+			p.y = static_cast<f32>(-(c01 * xw + c11 * yw + c12 * zw) * inv_det);
+			p.z = static_cast<f32>(-(c02 * xw + c12 * yw + c22 * zw) * inv_det);
+			return true;
+		}
+	};
+	
+	/// Range of triangles in a triangle chunk.
+	struct triangle_range
+	{
+		std::size_t first;
+		std::size_t count;
+		std::size_t chunk;
+	};
+	
+	/// Candidate edge collapse, which moves vertex `v` to vertex `u` and places `u` at a new position.
+	struct collapse
+	{
+		f64 cost;
+		u32 u;
+		u32 v;
+		u32 u_version;
+		u32 v_version;
+		f32vec3 position;
+		
+		/// Orders collapses by ascending cost, then by vertex, such that the order is deterministic.
+		[[nodiscard]] bool operator>(const collapse& other) const noexcept
+		{
+			return cost != other.cost ? cost > other.cost : (u != other.u ? u > other.u : v > other.v);
+		}
+	};
+	
+	/// Returns the difference of two vectors.
+	[[nodiscard]] inline f32vec3 subtract(const f32vec3& a, const f32vec3& b) noexcept
+	{
+		return {a.x - b.x, a.y - b.y, a.z - b.z};
+	}
+	
+	/// Returns the cross product of two vectors.
+	[[nodiscard]] inline f32vec3 cross(const f32vec3& a, const f32vec3& b) noexcept
+	{
+		return {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x};
+	}
+	
+	/// Returns the dot product of two vectors.
+	[[nodiscard]] inline f32 dot(const f32vec3& a, const f32vec3& b) noexcept
+	{
+		return a.x * b.x + a.y * b.y + a.z * b.z;
+	}
+	
+	/// Simplifies the triangles of one range, collapsing edges between vertices which no other range references.
+	class range_simplifier
+	{
+	public:
+		/**
+		 * Loads the triangles of a range.
+		 *
+		 * @param[in] triangles Triangles of the range, whose vertex indices are relative to a vertex base.
+		 * @param[in] vertex_base Vertex base of the triangles.
+		 * @param[in] vertices Vertices of the mesh.
+		 * @param[in] owners Range which references each vertex of the mesh, or #shared_owner.
+		 */
+		range_simplifier(std::span<const triangle> triangles, u64 vertex_base, const paged_vector<vertex>& vertices, std::span<const u32> owners)
+		{
+			// Map vertex indices to a dense local range, sorting corners by vertex index
+			std::vector<u64> corner_keys(triangles.size() * 3);
+			for (std::size_t i = 0; i < triangles.size(); ++i)
+			{
+				corner_keys[i * 3] = u64{triangles[i].a} << 32 | (i * 3);
+				corner_keys[i * 3 + 1] = u64{triangles[i].b} << 32 | (i * 3 + 1);
+				corner_keys[i * 3 + 2] = u64{triangles[i].c} << 32 | (i * 3 + 2);
+			}
+			std::ranges::sort(corner_keys);
+			corners.resize(triangles.size());
+			for (const u64 key: corner_keys)
+			{
+				const u32 index = static_cast<u32>(key >> 32);
+				if (vertex_ids.empty() || vertex_ids.back() != index)
+				{
+					vertex_ids.emplace_back(index);
+				}
+				const u32 corner = static_cast<u32>(key);
+				corners[corner / 3][corner % 3] = static_cast<u32>(vertex_ids.size() - 1);
+			}
+			
+			// Load vertices, locking those referenced by other ranges
+			const std::size_t vertex_count = vertex_ids.size();
+			local_vertices.resize(vertex_count);
+			quadrics.resize(vertex_count);
+			locked.resize(vertex_count);
+			versions.assign(vertex_count, 0);
+			adjacency.resize(vertex_count);
+			marks.assign(vertex_count, 0);
+			for (std::size_t v = 0; v < vertex_count; ++v)
+			{
+				const std::size_t index = static_cast<std::size_t>(vertex_base + vertex_ids[v]);
+				local_vertices[v] = vertices[index];
+				locked[v] = owners[index] == shared_owner;
+			}
+			
+			// Sum the plane quadrics of the triangles adjacent to each vertex
+			alive.assign(triangles.size(), true);
+			live_count = triangles.size();
+			for (std::size_t i = 0; i < triangles.size(); ++i)
+			{
+				const auto& [a, b, c] = corners[i];
+				adjacency[a].emplace_back(static_cast<u32>(i));
+				adjacency[b].emplace_back(static_cast<u32>(i));
+				adjacency[c].emplace_back(static_cast<u32>(i));
+				
+				const f32vec3& pa = local_vertices[a].p;
+				const f32vec3 n = cross(subtract(local_vertices[b].p, pa), subtract(local_vertices[c].p, pa));
+				const f64 length = std::sqrt(f64{n.x} * n.x + f64{n.y} * n.y + f64{n.z} * n.z);
+				if (length > 0.0)
+				{
+					quadric q;
+					q.add_plane(n.x / length, n.y / length, n.z / length, -(n.x * f64{pa.x} + n.y * f64{pa.y} + n.z * f64{pa.z}) / length);
+					quadrics[a] += q;
+					quadrics[b] += q;
+					quadrics[c] += q;
+				}
+			}
+			
+			// Find unique edges. Vertices of edges which bound the surface or are shared by more than two triangles are locked, preserving open boundaries
+			std::vector<u64> edges;
+			edges.reserve(corners.size() * 3);
+			for (const auto& t: corners)
+			{
+				for (std::size_t k = 0; k < 3; ++k)
+				{
+					const auto [a, b] = std::minmax(t[k], t[(k + 1) % 3]);
+					edges.emplace_back(u64{a} << 32 | b);
+				}
+			}
+			std::ranges::sort(edges);
+			for (std::size_t i = 0; i < edges.size();)
+			{
+				std::size_t j = i + 1;
+				while (j < edges.size() && edges[j] == edges[i])
+				{
+					++j;
+				}
+				if (j - i != 2)
+				{
+					locked[static_cast<u32>(edges[i] >> 32)] = true;
+					locked[static_cast<u32>(edges[i])] = true;
+				}
+				i = j;
+			}
+			edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+			for (const u64 edge: edges)
+			{
+				push_collapse(static_cast<u32>(edge >> 32), static_cast<u32>(edge));
+			}
+		}
+		
+		/**
+		 * Collapses edges in order of increasing error.
+		 *
+		 * @param[in] target_count Number of triangles at which to stop.
+		 * @param[in] max_error Maximum sum of squared distances between a collapsed vertex and the planes of its original triangles.
+		 */
+		void simplify(std::size_t target_count, f64 max_error)
+		{
+			while (live_count > target_count && !candidates.empty())
+			{
+				const collapse c = candidates.top();
+				candidates.pop();
+				if (c.cost > max_error)
+				{
+					break;
+				}
+				if (c.u_version == versions[c.u] && c.v_version == versions[c.v])
+				{
+					apply(c);
+				}
+			}
+		}
+		
+		/**
+		 * Stores the simplified range.
+		 *
+		 * @param[out] triangles Buffer to which the remaining triangles of the range are written, relative to the vertex base of the range.
+		 * @param[in,out] vertices Vertices of the mesh. Vertices which only this range references are updated.
+		 * @param[in] vertex_base Vertex base of the triangles.
+		 *
+		 * @return Number of remaining triangles.
+		 */
+		std::size_t store(std::span<triangle> triangles, paged_vector<vertex>& vertices, u64 vertex_base) const
+		{
+			for (std::size_t v = 0; v < local_vertices.size(); ++v)
+			{
+				if (!locked[v])
+				{
+					vertices[static_cast<std::size_t>(vertex_base + vertex_ids[v])] = local_vertices[v];
+				}
+			}
+			
+			std::size_t count = 0;
+			for (std::size_t i = 0; i < corners.size(); ++i)
+			{
+				if (alive[i])
+				{
+					triangles[count++] = {vertex_ids[corners[i][0]], vertex_ids[corners[i][1]], vertex_ids[corners[i][2]]};
+				}
+			}
+			return count;
+		}
+	
+	private:
+		/// Evaluates the collapse of an edge, and queues it if either vertex may move.
+		void push_collapse(u32 a, u32 b)
+		{
+			if (locked[a] && locked[b])
+			{
+				return;
+			}
+			
+			// Collapse an unlocked vertex into a locked vertex, or collapse two unlocked vertices to the point which minimizes their combined error
+			collapse c;
+			quadric q = quadrics[a];
+			q += quadrics[b];
+			if (locked[a] || locked[b])
+			{
+				c.u = locked[a] ? a : b;
+				c.v = locked[a] ? b : a;
+				c.position = local_vertices[c.u].p;
+				c.cost = q.error(c.position);
+			}
+			else
+			{
+				c.u = a;
+				c.v = b;
+				const f32vec3& pa = local_vertices[a].p;
+				const f32vec3& pb = local_vertices[b].p;
+				const f32vec3 midpoint = {(pa.x + pb.x) * 0.5f, (pa.y + pb.y) * 0.5f, (pa.z + pb.z) * 0.5f};
+				
+				// Fall back to the best of the endpoints and midpoint if the minimum is not unique, or lies far from the edge
+				f32vec3 optimum = midpoint;
+				if (q.minimize(optimum))
+				{
+					const f32vec3 d = subtract(optimum, midpoint);
+					const f32vec3 e = subtract(pb, pa);
+					if (!(dot(d, d) <= dot(e, e)))
+					{
+						optimum = midpoint;
+					}
+				}
+				c.position = optimum;
+				c.cost = q.error(optimum);
+				for (const f32vec3& p: {pa, pb, midpoint})
+				{
+					const f64 cost = q.error(p);
+					if (cost < c.cost)
+					{
+						c.cost = cost;
+						c.position = p;
+					}
+				}
+			}
+			
+			c.u_version = versions[c.u];
+			c.v_version = versions[c.v];
+			candidates.push(c);
+		}
+		
+		/// Returns `true` if moving a vertex to a new position flips or degenerates any of its live triangles which do not also contain another vertex. Triangles which are already degenerate, as where vertices snap to voxel corners, may take any orientation.
+		[[nodiscard]] bool flips(u32 moved, u32 other, const f32vec3& position) const
+		{
+			for (const u32 t: adjacency[moved])
+			{
+				const auto& corner = corners[t];
+				if (corner[0] == other || corner[1] == other || corner[2] == other)
+				{
+					continue;
+				}
+				
+				const std::size_t k = corner[0] == moved ? 0 : (corner[1] == moved ? 1 : 2);
+				const f32vec3& p1 = local_vertices[corner[(k + 1) % 3]].p;
+				const f32vec3& p2 = local_vertices[corner[(k + 2) % 3]].p;
+				const f32vec3 before = cross(subtract(p1, local_vertices[moved].p), subtract(p2, local_vertices[moved].p));
+				const f32vec3 after = cross(subtract(p1, position), subtract(p2, position));
+				if (dot(before, before) > 0.0f && !(dot(before, after) > 0.0f))
+				{
+					return true;
+				}
+			}
+			return false;
+		}
+		
+		/// Applies an edge collapse if it preserves the topology and orientation of the surface.
+		void apply(const collapse& c)
+		{
+			const u32 u = c.u;
+			const u32 v = c.v;
+			
+			// Find the triangles which contain the edge
+			shared_triangles.clear();
+			for (const u32 t: adjacency[v])
+			{
+				const auto& corner = corners[t];
+				if (corner[0] == u || corner[1] == u || corner[2] == u)
+				{
+					shared_triangles.emplace_back(t);
+				}
+			}
+			if (shared_triangles.empty())
+			{
+				return;
+			}
+			
+			// Require the vertices to share exactly the neighbors opposite the edge, such that the collapse does not pinch the surface
+			const u32 u_mark = ++mark;
+			for (const u32 t: adjacency[u])
+			{
+				for (const u32 w: corners[t])
+				{
+					marks[w] = u_mark;
+				}
+			}
+			const u32 common_mark = ++mark;
+			std::size_t common_count = 0;
+			bool hidden_edge = false;
+			bool enclosed = true;
+			for (const u32 t: adjacency[v])
+			{
+				for (const u32 w: corners[t])
+				{
+					if (w != u && w != v && marks[w] == u_mark)
+					{
+						marks[w] = common_mark;
+						++common_count;
+					}
+					enclosed &= w == u || w == v || marks[w] == common_mark;
+					
+					// Locked vertices may share edges in other ranges, which the collapse would duplicate
+					hidden_edge |= locked[u] && locked[w] && w != u && marks[w] != common_mark;
+				}
+			}
+			for (const u32 t: adjacency[u])
+			{
+				for (const u32 w: corners[t])
+				{
+					enclosed &= w == u || w == v || marks[w] == common_mark;
+				}
+			}
+			
+			// Also refuse to flatten a tetrahedron, whose vertices all neighbor both vertices of the edge, into a pair of coincident triangles
+			if (common_count != shared_triangles.size() || hidden_edge || enclosed || flips(u, v, c.position) || flips(v, u, c.position))
+			{
+				return;
+			}
+			
+			// Remove the triangles which contain the edge
+			for (const u32 t: shared_triangles)
+			{
+				alive[t] = false;
+				for (const u32 w: corners[t])
+				{
+					std::erase(adjacency[w], t);
+				}
+			}
+			live_count -= shared_triangles.size();
+			
+			// Move the triangles of `v` to `u`
+			for (const u32 t: adjacency[v])
+			{
+				for (auto& w: corners[t])
+				{
+					if (w == v)
+					{
+						w = u;
+					}
+				}
+				adjacency[u].emplace_back(t);
+			}
+			adjacency[v].clear();
+			adjacency[v].shrink_to_fit();
+			
+			// Merge the vertices
+			auto& vu = local_vertices[u];
+			const auto& vv = local_vertices[v];
+			vu.p = c.position;
+			const f32vec3 n = {vu.n.x + vv.n.x, vu.n.y + vv.n.y, vu.n.z + vv.n.z};
+			const f32 sqr_l = dot(n, n);
+			if (sqr_l > 0.0f)
+			{
+				const f32 inv_l = 1.0f / std::sqrt(sqr_l);
+				vu.n = {n.x * inv_l, n.y * inv_l, n.z * inv_l};
+			}
+			quadrics[u] += quadrics[v];
+			++versions[u];
+			++versions[v];
+			
+			// Requeue the edges around the merged vertex
+			const u32 requeue_mark = ++mark;
+			marks[u] = requeue_mark;
+			for (const u32 t: adjacency[u])
+			{
+				for (const u32 w: corners[t])
+				{
+					if (marks[w] != requeue_mark)
+					{
+						marks[w] = requeue_mark;
+						push_collapse(u, w);
+					}
+				}
+			}
+		}
+		
+		std::vector<u32> vertex_ids;
+		std::vector<std::array<u32, 3>> corners;
+		std::vector<vertex> local_vertices;
+		std::vector<quadric> quadrics;
+		std::vector<bool> locked;
+		std::vector<u32> versions;
+		std::vector<std::vector<u32>> adjacency;
+		std::vector<bool> alive;
+		std::size_t live_count{0};
+		std::priority_queue<collapse, std::vector<collapse>, std::greater<>> candidates;
+		std::vector<u32> shared_triangles;
+		std::vector<u32> marks;
+		u32 mark{0};
+	};
+}
+
+void decimate(mesh& model, u64 target_count, f32 max_error, u32 thread_count)
+{
+	auto& [vertices, triangles, chunks] = model;
+	const f64 max_squared_error = std::isinf(max_error) ? std::numeric_limits<f64>::infinity() : f64{max_error} * max_error;
+	if (triangles.size() <= target_count)
+	{
+		return;
+	}
+	
+	sort_triangles(model, thread_count);
+	
+	std::vector<u32> owners(vertices.size());
+	for (u32 round = 0; round < max_rounds && triangles.size() > target_count; ++round)
+	{
+		// Split triangle chunks into ranges, shifting the boundaries between ranges every other round
+		std::vector<triangle_range> ranges;
+		std::size_t first_triangle = 0;
+		for (std::size_t chunk = 0; chunk < chunks.size(); ++chunk)
+		{
+			const std::size_t triangle_count = chunks[chunk].triangle_count;
+			for (std::size_t i = 0; i < triangle_count;)
+			{
+				const std::size_t count = std::min((round % 2 && !i) ? range_size / 2 : range_size, triangle_count - i);
+				ranges.emplace_back(first_triangle + i, count, chunk);
+				i += count;
+			}
+			first_triangle += triangle_count;
+		}
+		const u32 range_count = static_cast<u32>(ranges.size());
+		
+		// Find the range which references each vertex. Vertices referenced by several ranges are locked
+		std::ranges::fill(owners, no_owner);
+		parallel_for
+		(
+			range_count,
+			thread_count,
+			[&](std::size_t r)
+			{
+				const auto& range = ranges[r];
+				const u64 vertex_base = chunks[range.chunk].vertex_base;
+				for (std::size_t i = range.first; i < range.first + range.count; ++i)
+				{
+					const auto& t = triangles[i];
+					for (const u32 index: {t.a, t.b, t.c})
+					{
+						std::atomic_ref<u32> owner(owners[static_cast<std::size_t>(vertex_base + index)]);
+						u32 expected = no_owner;
+						if (!owner.compare_exchange_strong(expected, static_cast<u32>(r), std::memory_order_relaxed) && expected != r && expected != shared_owner)
+						{
+							owner.store(shared_owner, std::memory_order_relaxed);
+						}
+					}
+				}
+			}
+		);
+		
+		// Simplify each range towards its share of the target triangle count, writing the remaining triangles to the start of the range
+		const f64 ratio = static_cast<f64>(target_count) / static_cast<f64>(triangles.size());
+		std::vector<std::size_t> remaining_counts(range_count);
+		parallel_for
+		(
+			range_count,
+			thread_count,
+			[&](std::size_t r)
+			{
+				const auto& range = ranges[r];
+				const u64 vertex_base = chunks[range.chunk].vertex_base;
+				std::vector<triangle> range_triangles(range.count);
+				for (std::size_t i = 0; i < range.count; ++i)
+				{
+					range_triangles[i] = triangles[range.first + i];
+				}
+				
+				range_simplifier simplifier(range_triangles, vertex_base, vertices, owners);
+				simplifier.simplify(static_cast<std::size_t>(std::ceil(static_cast<f64>(range.count) * ratio)), max_squared_error);
+				remaining_counts[r] = simplifier.store(range_triangles, vertices, vertex_base);
+				
+				for (std::size_t i = 0; i < remaining_counts[r]; ++i)
+				{
+					triangles[range.first + i] = range_triangles[i];
+				}
+			}
+		);
+		
+		// Compact triangles, and stop once a round makes little progress
+		const std::size_t previous_count = triangles.size();
+		std::size_t count = 0;
+		for (auto& chunk: chunks)
+		{
+			chunk.triangle_count = 0;
+		}
+		for (u32 r = 0; r < range_count; ++r)
+		{
+			const auto& range = ranges[r];
+			for (std::size_t i = 0; i < remaining_counts[r]; ++i)
+			{
+				triangles[count++] = triangles[range.first + i];
+			}
+			chunks[range.chunk].triangle_count += remaining_counts[r];
+		}
+		triangles.resize(count);
+		if (count > previous_count - previous_count / 100)
+		{
+			break;
+		}
+	}
+	
+	// Find the vertices which remain referenced, and assign them consecutive indices
+	std::vector<u64> new_indices(vertices.size(), std::numeric_limits<u64>::max());
+	std::size_t first_triangle = 0;
+	for (const auto& [triangle_count, vertex_base]: chunks)
+	{
+		for (std::size_t i = first_triangle; i < first_triangle + triangle_count; ++i)
+		{
+			const auto& t = triangles[i];
+			for (const u32 index: {t.a, t.b, t.c})
+			{
+				new_indices[static_cast<std::size_t>(vertex_base + index)] = 0;
+			}
+		}
+		first_triangle += triangle_count;
+	}
+	u64 vertex_count = 0;
+	for (std::size_t v = 0; v < vertices.size(); ++v)
+	{
+		if (!new_indices[v])
+		{
+			new_indices[v] = vertex_count;
+			vertices[static_cast<std::size_t>(vertex_count++)] = vertices[v];
+		}
+	}
+	vertices.resize(static_cast<std::size_t>(vertex_count));
+	
+	// Renumber triangle vertices. Vertices of meshes with no more than 2^32 vertices are indexed from zero. Otherwise each chunk is based at the lowest vertex it references, which is no further from its other vertices than before
+	const bool large = vertex_count > u64{1} << 32;
+	first_triangle = 0;
+	for (auto& [triangle_count, vertex_base]: chunks)
+	{
+		u64 new_base = large ? std::numeric_limits<u64>::max() : 0;
+		for (std::size_t i = first_triangle; large && i < first_triangle + triangle_count; ++i)
+		{
+			const auto& t = triangles[i];
+			new_base = std::min({new_base, new_indices[static_cast<std::size_t>(vertex_base + t.a)], new_indices[static_cast<std::size_t>(vertex_base + t.b)], new_indices[static_cast<std::size_t>(vertex_base + t.c)]});
+		}
+		for (std::size_t i = first_triangle; i < first_triangle + triangle_count; ++i)
+		{
+			auto& t = triangles[i];
+			t.a = static_cast<u32>(new_indices[static_cast<std::size_t>(vertex_base + t.a)] - new_base);
+			t.b = static_cast<u32>(new_indices[static_cast<std::size_t>(vertex_base + t.b)] - new_base);
+			t.c = static_cast<u32>(new_indices[static_cast<std::size_t>(vertex_base + t.c)] - new_base);
+		}
+		vertex_base = triangle_count ? new_base : 0;
+		first_triangle += triangle_count;
+	}
+	
+	// Merge consecutive chunks with the same base
+	std::vector<triangle_chunk> merged_chunks;
+	for (const auto& chunk: chunks)
+	{
+		if (!merged_chunks.empty() && merged_chunks.back().vertex_base == chunk.vertex_base)
+		{
+			merged_chunks.back().triangle_count += chunk.triangle_count;
+		}
+		else
+		{
+			merged_chunks.emplace_back(chunk);
+		}
+	}
+	chunks = std::move(merged_chunks);
+}
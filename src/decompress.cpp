@@ -0,0 +1,572 @@
+// SPDX-FileCopyrightText: 2023 C. J. Howard
+// SPDX-License-Identifier: MIT
+
+#include "siafu.hpp"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+	/// Throws an exception indicating the compressed data is malformed.
+	[[noreturn]] void throw_corrupt()
+	{
+		throw std::runtime_error("corrupt compressed data");
+	}
+	
+	/// Throws an exception indicating the compressed data ended before the destination was filled.
+	[[noreturn]] void throw_truncated()
+	{
+		throw std::runtime_error("truncated strip");
+	}
+	
+	/// Reads bits from a byte stream, least significant bit first.
+	class bit_reader
+	{
+	public:
+		explicit bit_reader(std::span<const std::byte> stream) noexcept:
+			data(stream)
+		{}
+		
+		/// Returns the next bits in the stream without consuming them. Bits past the end of the stream are zero.
+		[[nodiscard]] u32 peek(u32 count) noexcept
+		{
+			while (bit_count <= 56 && position < data.size())
+			{
+				bits |= u64{std::to_integer<u8>(data[position++])} << bit_count;
+				bit_count += 8;
+			}
+			return static_cast<u32>(bits & ((u64{1} << count) - 1));
+		}
+		
+		/// Consumes bits from the stream.
+		void consume(u32 count)
+		{
+			if (count > bit_count)
+			{
+				throw_truncated();
+			}
+			bits >>= count;
+			bit_count -= count;
+		}
+		
+		/// Reads bits from the stream.
+		[[nodiscard]] u32 read(u32 count)
+		{
+			const u32 value = peek(count);
+			consume(count);
+			return value;
+		}
+		
+		/// Skips to the next byte boundary, then reads whole bytes from the stream.
+		[[nodiscard]] std::span<const std::byte> read_bytes(std::size_t count)
+		{
+			// Return buffered whole bytes to the stream
+			position -= bit_count >> 3;
+			bits = 0;
+			bit_count = 0;
+			
+			if (count > data.size() - position)
+			{
+				throw_truncated();
+			}
+			position += count;
+			return data.subspan(position - count, count);
+		}
+	
+	private:
+		std::span<const std::byte> data;
+		std::size_t position{0};
+		u64 bits{0};
+		u32 bit_count{0};
+	};
+	
+	/// Canonical Huffman code, decoded with a lookup table for short codes.
+	class huffman_code
+	{
+	public:
+		/// Maximum length of a code, in bits.
+		static constexpr u32 max_length = 15;
+		
+		/// Length of the codes decoded with the lookup table, in bits.
+		static constexpr u32 table_length = 10;
+		
+		/**
+		 * Builds a code from the code lengths of its symbols.
+		 *
+		 * @param[in] lengths Code length of each symbol, or zero if the symbol is unused.
+		 */
+		explicit huffman_code(std::span<const u8> lengths)
+		{
+			// Count codes of each length
+			for (const u8 length: lengths)
+			{
+				++counts[length];
+			}
+			counts[0] = 0;
+			
+			// Reject over-subscribed codes
+			int left = 1;
+			for (u32 length = 1; length <= max_length; ++length)
+			{
+				left = (left << 1) - counts[length];
+				if (left < 0)
+				{
+					throw_corrupt();
+				}
+			}
+			
+			// Sort symbols by code length, then by value
+			std::array<u16, max_length + 1> offsets{};
+			for (u32 length = 1; length < max_length; ++length)
+			{
+				offsets[length + 1] = offsets[length] + counts[length];
+			}
+			for (std::size_t i = 0; i < lengths.size(); ++i)
+			{
+				if (lengths[i])
+				{
+					symbols[offsets[lengths[i]]++] = static_cast<u16>(i);
+				}
+			}
+			
+			// Fill the lookup table with every bit pattern which begins with a short code. Codes are stored most significant bit first in a least significant bit first stream, so table indices are bit-reversed.
+			u32 code = 0;
+			u32 index = 0;
+			for (u32 length = 1; length <= table_length; ++length, code <<= 1)
+			{
+				for (u32 i = 0; i < counts[length]; ++i, ++code)
+				{
+					u32 reversed = 0;
+					for (u32 j = 0; j < length; ++j)
+					{
+						reversed |= ((code >> j) & 1) << (length - 1 - j);
+					}
+					
+					const u16 entry = static_cast<u16>((symbols[index++] << 4) | length);
+					for (u32 k = reversed; k < table.size(); k += 1u << length)
+					{
+						table[k] = entry;
+					}
+				}
+			}
+		}
+		
+		/// Decodes a symbol from a bit stream.
+		[[nodiscard]] u32 decode(bit_reader& reader) const
+		{
+			if (const u16 entry = table[reader.peek(table_length)])
+			{
+				reader.consume(entry & 15);
+				return entry >> 4;
+			}
+			
+			// Decode long codes one bit at a time
+			u32 code = 0;
+			u32 first = 0;
+			u32 index = 0;
+			for (u32 length = 1; length <= max_length; ++length)
+			{
+				code |= reader.read(1);
+				if (code - first < counts[length])
+				{
+					return symbols[index + code - first];
+				}
+				index += counts[length];
+				first = (first + counts[length]) << 1;
+				code <<= 1;
+			}
+			
+			throw_corrupt();
+		}
+	
+	private:
+		std::array<u16, max_length + 1> counts{};
+		std::array<u16, 320> symbols{};
+		std::array<u16, 1 << table_length> table{};
+	};
+	
+	/// Deflate length and distance code bases and extra bits. @{
+	constexpr std::array<u16, 29> length_bases{3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+	constexpr std::array<u8, 29> length_extra_bits{0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+	constexpr std::array<u16, 30> distance_bases{1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+	constexpr std::array<u8, 30> distance_extra_bits{0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+	/// @}
+	
+	/// Returns the fixed literal/length and distance codes of Deflate.
+	[[nodiscard]] const std::pair<huffman_code, huffman_code>& fixed_codes()
+	{
+		static const std::pair<huffman_code, huffman_code> codes = []()
+		{
+			std::array<u8, 288> literal_lengths;
+			std::fill(literal_lengths.begin(), literal_lengths.begin() + 144, u8{8});
+			std::fill(literal_lengths.begin() + 144, literal_lengths.begin() + 256, u8{9});
+			std::fill(literal_lengths.begin() + 256, literal_lengths.begin() + 280, u8{7});
+			std::fill(literal_lengths.begin() + 280, literal_lengths.end(), u8{8});
+			
+			std::array<u8, 30> distance_lengths;
+			distance_lengths.fill(5);
+			
+			return std::pair{huffman_code(literal_lengths), huffman_code(distance_lengths)};
+		}();
+		
+		return codes;
+	}
+	
+	/// Reads the dynamic literal/length and distance codes of a Deflate block.
+	[[nodiscard]] std::pair<huffman_code, huffman_code> read_dynamic_codes(bit_reader& reader)
+	{
+		static constexpr std::array<u8, 19> order{16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+		
+		const u32 literal_count = reader.read(5) + 257;
+		const u32 distance_count = reader.read(5) + 1;
+		const u32 length_count = reader.read(4) + 4;
+		if (literal_count > 286 || distance_count > 30)
+		{
+			throw_corrupt();
+		}
+		
+		// Read the code which encodes the code lengths
+		std::array<u8, 19> length_lengths{};
+		for (u32 i = 0; i < length_count; ++i)
+		{
+			length_lengths[order[i]] = static_cast<u8>(reader.read(3));
+		}
+		const huffman_code length_code(length_lengths);
+		
+		// Read the literal/length and distance code lengths, which share a run-length encoding
+		std::array<u8, 316> lengths{};
+		for (u32 i = 0; i < literal_count + distance_count;)
+		{
+			const u32 symbol = length_code.decode(reader);
+			if (symbol < 16)
+			{
+				lengths[i++] = static_cast<u8>(symbol);
+				continue;
+			}
+			
+			u8 length = 0;
+			u32 repeat;
+			if (symbol == 16)
+			{
+				if (!i)
+				{
+					throw_corrupt();
+				}
+				length = lengths[i - 1];
+				repeat = 3 + reader.read(2);
+			}
+			else if (symbol == 17)
+			{
+				repeat = 3 + reader.read(3);
+			}
+			else
+			{
+				repeat = 11 + reader.read(7);
+			}
+			
+			if (i + repeat > literal_count + distance_count)
+			{
+				throw_corrupt();
+			}
+			std::fill_n(lengths.begin() + i, repeat, length);
+			i += repeat;
+		}
+		
+		// The end-of-block code is required
+		if (!lengths[256])
+		{
+			throw_corrupt();
+		}
+		
+		return {huffman_code(std::span{lengths}.first(literal_count)), huffman_code(std::span{lengths}.subspan(literal_count, distance_count))};
+	}
+	
+	/// Decodes the compressed data of a Deflate block, until either the end of the block is reached or the destination is filled.
+	void inflate_block(bit_reader& reader, const huffman_code& literal_code, const huffman_code& distance_code, std::span<std::byte> destination, std::size_t& position)
+	{
+		for (;;)
+		{
+			const u32 symbol = literal_code.decode(reader);
+			if (symbol < 256)
+			{
+				destination[position++] = static_cast<std::byte>(symbol);
+				if (position == destination.size())
+				{
+					return;
+				}
+			}
+			else if (symbol == 256)
+			{
+				return;
+			}
+			else
+			{
+				if (symbol - 257 >= length_bases.size())
+				{
+					throw_corrupt();
+				}
+				const std::size_t length = length_bases[symbol - 257] + reader.read(length_extra_bits[symbol - 257]);
+				
+				const u32 distance_symbol = distance_code.decode(reader);
+				if (distance_symbol >= distance_bases.size())
+				{
+					throw_corrupt();
+				}
+				const std::size_t distance = distance_bases[distance_symbol] + reader.read(distance_extra_bits[distance_symbol]);
+				if (distance > position)
+				{
+					throw_corrupt();
+				}
+				
+				// Copy previous output, which overlaps the copy if the distance is shorter than the length
+				const std::size_t count = std::min(length, destination.size() - position);
+				std::byte* target = destination.data() + position;
+				const std::byte* source = target - distance;
+				if (distance >= count)
+				{
+					std::memcpy(target, source, count);
+				}
+				else
+				{
+					for (std::size_t i = 0; i < count; ++i)
+					{
+						target[i] = source[i];
+					}
+				}
+				
+				position += count;
+				if (position == destination.size())
+				{
+					return;
+				}
+			}
+		}
+	}
+}
+
+void decompress_lzw(std::span<const std::byte> source, std::span<std::byte> destination)
+{
+	constexpr u32 clear_code = 256;
+	constexpr u32 end_code = 257;
+	constexpr u32 first_code = 258;
+	constexpr u32 max_code_count = 4096;
+	constexpr u32 no_code = max_code_count;
+	
+	// String table, where each string is a prefix string followed by a suffix byte
+	std::array<u16, max_code_count> prefixes;
+	std::array<std::byte, max_code_count> suffixes;
+	std::array<std::byte, max_code_count> firsts;
+	std::array<u16, max_code_count> lengths;
+	for (u32 i = 0; i < 256; ++i)
+	{
+		suffixes[i] = firsts[i] = static_cast<std::byte>(i);
+		lengths[i] = 1;
+	}
+	
+	u64 bits = 0;
+	u32 bit_count = 0;
+	std::size_t input_position = 0;
+	std::size_t position = 0;
+	u32 code_width = 9;
+	u32 next_code = first_code;
+	u32 previous_code = no_code;
+	
+	while (position < destination.size())
+	{
+		// Read the next code, most significant bit first
+		while (bit_count <= 56 && input_position < source.size())
+		{
+			bits = (bits << 8) | std::to_integer<u8>(source[input_position++]);
+			bit_count += 8;
+		}
+		if (bit_count < code_width)
+		{
+			break;
+		}
+		bit_count -= code_width;
+		const u32 code = static_cast<u32>(bits >> bit_count) & ((1u << code_width) - 1);
+		
+		if (code == end_code)
+		{
+			break;
+		}
+		if (code == clear_code)
+		{
+			code_width = 9;
+			next_code = first_code;
+			previous_code = no_code;
+			continue;
+		}
+		
+		if (previous_code == no_code)
+		{
+			// The first code after a clear code is a literal
+			if (code >= clear_code)
+			{
+				throw_corrupt();
+			}
+		}
+		else
+		{
+			if (code > next_code || (code >= clear_code && code < first_code))
+			{
+				throw_corrupt();
+			}
+			
+			// Add the previous string followed by the first byte of the current string, which is the current string itself if its code is not yet in the table
+			if (next_code < max_code_count)
+			{
+				prefixes[next_code] = static_cast<u16>(previous_code);
+				suffixes[next_code] = code < next_code ? firsts[code] : firsts[previous_code];
+				firsts[next_code] = firsts[previous_code];
+				lengths[next_code] = static_cast<u16>(lengths[previous_code] + 1);
+				++next_code;
+			}
+			else if (code == next_code)
+			{
+				throw_corrupt();
+			}
+			
+			// Code width increases one code early
+			if (next_code + 1 >= (1u << code_width) && code_width < 12)
+			{
+				++code_width;
+			}
+		}
+		
+		// Write the string backwards from its last byte, clipped to the destination
+		const std::size_t length = lengths[code];
+		const std::size_t end = std::min(position + length, destination.size());
+		u32 string_code = code;
+		for (std::size_t i = position + length; i > end; --i)
+		{
+			string_code = prefixes[string_code];
+		}
+		for (std::size_t i = end; i > position; --i)
+		{
+			destination[i - 1] = suffixes[string_code];
+			string_code = prefixes[string_code];
+		}
+		
+		position = end;
+		previous_code = code;
+	}
+	
+	if (position < destination.size())
+	{
+		throw_truncated();
+	}
+}
+
+void decompress_deflate(std::span<const std::byte> source, std::span<std::byte> destination)
+{
+	// Check zlib header
+	if (source.size() < 2)
+	{
+		throw_truncated();
+	}
+	const u32 method = std::to_integer<u32>(source[0]);
+	const u32 flags = std::to_integer<u32>(source[1]);
+	if ((method & 0x0f) != 8 || (method >> 4) > 7 || ((method << 8) | flags) % 31 || (flags & 0x20))
+	{
+		throw_corrupt();
+	}
+	
+	if (destination.empty())
+	{
+		return;
+	}
+	
+	// Decode blocks until the destination is filled
+	bit_reader reader(source.subspan(2));
+	std::size_t position = 0;
+	for (bool last_block = false; !last_block;)
+	{
+		last_block = reader.read(1);
+		switch (reader.read(2))
+		{
+			case 0:
+			{
+				const auto header = reader.read_bytes(4);
+				const u32 length = std::to_integer<u32>(header[0]) | (std::to_integer<u32>(header[1]) << 8);
+				const u32 inverse_length = std::to_integer<u32>(header[2]) | (std::to_integer<u32>(header[3]) << 8);
+				if (length != (~inverse_length & 0xffff))
+				{
+					throw_corrupt();
+				}
+				
+				const auto data = reader.read_bytes(length);
+				const std::size_t count = std::min<std::size_t>(length, destination.size() - position);
+				std::memcpy(destination.data() + position, data.data(), count);
+				position += count;
+				break;
+			}
+			
+			case 1:
+			{
+				const auto& [literal_code, distance_code] = fixed_codes();
+				inflate_block(reader, literal_code, distance_code, destination, position);
+				break;
+			}
+			
+			case 2:
+			{
+				const auto [literal_code, distance_code] = read_dynamic_codes(reader);
+				inflate_block(reader, literal_code, distance_code, destination, position);
+				break;
+			}
+			
+			default:
+				throw_corrupt();
+		}
+		
+		if (position == destination.size())
+		{
+			return;
+		}
+	}
+	
+	throw_truncated();
+}
+
+void decompress_packbits(std::span<const std::byte> source, std::span<std::byte> destination)
+{
+	std::size_t input_position = 0;
+	std::size_t position = 0;
+	
+	while (position < destination.size() && input_position < source.size())
+	{
+		const i8 header = static_cast<i8>(source[input_position++]);
+		if (header >= 0)
+		{
+			// Copy literal bytes
+			const std::size_t literal_count = static_cast<std::size_t>(header) + 1;
+			const std::size_t count = std::min(literal_count, destination.size() - position);
+			if (count > source.size() - input_position)
+			{
+				throw_truncated();
+			}
+			std::memcpy(destination.data() + position, source.data() + input_position, count);
+			input_position += literal_count;
+			position += count;
+		}
+		else if (header != -128)
+		{
+			// Repeat a byte
+			if (input_position == source.size())
+			{
+				throw_truncated();
+			}
+			const std::size_t count = std::min(static_cast<std::size_t>(1 - header), destination.size() - position);
+			std::memset(destination.data() + position, std::to_integer<int>(source[input_position++]), count);
+			position += count;
+		}
+	}
+	
+	if (position < destination.size())
+	{
+		throw_truncated();
+	}
+}
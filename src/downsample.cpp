@@ -0,0 +1,201 @@
+// SPDX-FileCopyrightText: 2023 C. J. Howard
+// SPDX-License-Identifier: MIT
+
+#include "siafu.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <type_traits>
+
+namespace
+{
+	/// Returns the greater of two values, or NaN if either value is NaN. Voxels which are NaN are never inside an isosurface.
+	template <class T>
+	[[nodiscard]] inline T max_value(T a, T b) noexcept
+	{
+		return (b > a || b != b) && a == a ? b : a;
+	}
+	
+	/**
+	 * Downsamples a volume of voxels of type `T`.
+	 *
+	 * @see downsample_volume()
+	 */
+	template <class T>
+	void downsample(volume& source, u32 factor, lod_filter filter, u32 thread_count)
+	{
+		const u32 width = source.width;
+		const u32 height = source.height;
+		const u32 depth = source.depth;
+		const u32 lod_width = (width + factor - 1) / factor;
+		const u32 lod_height = (height + factor - 1) / factor;
+		const u32 lod_depth = (depth + factor - 1) / factor;
+		const std::size_t lod_slice_voxel_count = std::size_t{lod_width} * lod_height;
+		const std::size_t lod_slice_size = lod_slice_voxel_count * sizeof(T);
+		
+		// Number of voxels of the full-resolution volume along the X- and Y-axes of each block, which are fewer on the far faces of the volume
+		auto get_block_size = [factor](u32 i, u32 size) -> u32
+		{
+			return std::min(factor, size - i * factor);
+		};
+		
+		auto voxels = std::make_unique_for_overwrite<std::byte[]>(lod_slice_size * lod_depth);
+		
+		// Downsample each Z-layer of blocks concurrently, reading its Z-slices in order
+		parallel_for
+		(
+			lod_depth,
+			thread_count,
+			[&](std::size_t i)
+			{
+				const u32 lz = static_cast<u32>(i);
+				const u32 z_begin = lz * factor;
+				const u32 z_end = filter == lod_filter::stride ? z_begin + 1 : z_begin + get_block_size(lz, depth);
+				T* lod_slice = reinterpret_cast<T*>(voxels.get() + lod_slice_size * lz);
+				
+				std::unique_ptr<std::byte[]> staging_buffer;
+				if (!source.voxels)
+				{
+					staging_buffer = std::make_unique_for_overwrite<std::byte[]>(source.slice_size());
+				}
+				
+				// Sums of the blocks of the Z-layer, if averaging
+				std::vector<f64> sums(filter == lod_filter::mean ? lod_slice_voxel_count : 0);
+				
+				for (u32 z = z_begin; z < z_end; ++z)
+				{
+					const T* slice = reinterpret_cast<const T*>(source.read_slice(z, staging_buffer.get()));
+					
+					if (filter == lod_filter::stride)
+					{
+						for (u32 ly = 0; ly < lod_height; ++ly)
+						{
+							const T* row = slice + std::size_t{width} * ly * factor;
+							T* lod_row = lod_slice + std::size_t{lod_width} * ly;
+							for (u32 lx = 0; lx < lod_width; ++lx)
+							{
+								lod_row[lx] = row[std::size_t{lx} * factor];
+							}
+						}
+					}
+					else
+					{
+						for (u32 y = 0; y < height; ++y)
+						{
+							const T* row = slice + std::size_t{width} * y;
+							const std::size_t lod_row_offset = std::size_t{lod_width} * (y / factor);
+							
+							// The first row of the first Z-slice of each block initializes its maximum
+							const bool first_row = filter == lod_filter::maximum && z == z_begin && !(y % factor);
+							
+							for (u32 lx = 0, x = 0; lx < lod_width; ++lx)
+							{
+								const u32 x_end = x + get_block_size(lx, width);
+								if (filter == lod_filter::mean)
+								{
+									f64 sum = 0.0;
+									for (; x < x_end; ++x)
+									{
+										sum += static_cast<f64>(row[x]);
+									}
+									sums[lod_row_offset + lx] += sum;
+								}
+								else
+								{
+									T maximum = first_row ? row[x] : lod_slice[lod_row_offset + lx];
+									for (; x < x_end; ++x)
+									{
+										maximum = max_value(maximum, row[x]);
+									}
+									lod_slice[lod_row_offset + lx] = maximum;
+								}
+							}
+						}
+					}
+					
+					if (reinterpret_cast<const std::byte*>(slice) != staging_buffer.get() && source.release_slice)
+					{
+						source.release_slice(z);
+					}
+				}
+				
+				// Divide the sum of each block by its number of voxels, rounding integer voxels to the nearest value
+				if (filter == lod_filter::mean)
+				{
+					const u32 block_depth = z_end - z_begin;
+					for (u32 ly = 0; ly < lod_height; ++ly)
+					{
+						const u32 block_height = get_block_size(ly, height);
+						for (u32 lx = 0; lx < lod_width; ++lx)
+						{
+							const std::size_t j = std::size_t{lod_width} * ly + lx;
+							const f64 mean = sums[j] / (static_cast<f64>(get_block_size(lx, width)) * block_height * block_depth);
+							if constexpr (std::is_floating_point_v<T>)
+							{
+								lod_slice[j] = static_cast<T>(mean);
+							}
+							else
+							{
+								lod_slice[j] = static_cast<T>(std::round(mean));
+							}
+						}
+					}
+				}
+			}
+		);
+		
+		// Place each voxel of the level of detail at the center of its block, or at the first voxel of its block if strided, within the full-resolution volume
+		const auto [grid_scale, grid_translation] = source.grid_transform();
+		const f32 offset = filter == lod_filter::stride ? 0.0f : static_cast<f32>(factor - 1) * 0.5f;
+		source.grid_scale = grid_scale * static_cast<f32>(factor);
+		source.grid_translation = grid_translation + grid_scale * offset;
+		
+		// Read Z-slices of the level of detail from memory
+		source.width = lod_width;
+		source.height = lod_height;
+		source.depth = lod_depth;
+		source.voxels = std::move(voxels);
+		source.bricks = nullptr;
+		source.read_slice = [voxels = source.voxels, lod_slice_size](u32 z, std::byte*) -> const std::byte*
+		{
+			return voxels.get() + lod_slice_size * z;
+		};
+		source.release_slice = nullptr;
+		source.read_slices = nullptr;
+	}
+}
+
+void downsample_volume(volume& source, u32 factor, lod_filter filter, u32 thread_count)
+{
+	if (factor <= 1)
+	{
+		return;
+	}
+	
+	const auto bits_per_voxel = source.bits_per_voxel;
+	const auto format = source.format;
+	if (bits_per_voxel == 8 && format == voxel_format::unsigned_integer)
+	{
+		downsample<u8>(source, factor, filter, thread_count);
+	}
+	else if (bits_per_voxel == 16 && format == voxel_format::unsigned_integer)
+	{
+		downsample<u16>(source, factor, filter, thread_count);
+	}
+	else if (bits_per_voxel == 16 && format == voxel_format::signed_integer)
+	{
+		downsample<i16>(source, factor, filter, thread_count);
+	}
+	else if (bits_per_voxel == 32 && format == voxel_format::unsigned_integer)
+	{
+		downsample<u32>(source, factor, filter, thread_count);
+	}
+	else if (bits_per_voxel == 32 && format == voxel_format::floating_point)
+	{
+		downsample<f32>(source, factor, filter, thread_count);
+	}
+	else
+	{
+		throw std::runtime_error("unsupported voxel format");
+	}
+}
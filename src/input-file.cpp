@@ -0,0 +1,148 @@
+// SPDX-FileCopyrightText: 2023 C. J. Howard
+// SPDX-License-Identifier: MIT
+
+#include "siafu.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+#if defined(_WIN32)
+	#define WIN32_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <windows.h>
+#else
+	#include <cerrno>
+	#include <fcntl.h>
+	#include <limits.h>
+	#include <sys/stat.h>
+	#include <sys/uio.h>
+	#include <unistd.h>
+#endif
+
+input_file::input_file(const fs::path& path)
+{
+	#if defined(_WIN32)
+		handle = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (handle == INVALID_HANDLE_VALUE)
+		{
+			throw std::runtime_error("failed to open file");
+		}
+	#else
+		handle = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (handle < 0)
+		{
+			throw std::runtime_error("failed to open file");
+		}
+	#endif
+}
+
+input_file::~input_file()
+{
+	#if defined(_WIN32)
+		CloseHandle(handle);
+	#else
+		::close(handle);
+	#endif
+}
+
+u64 input_file::size() const
+{
+	#if defined(_WIN32)
+		LARGE_INTEGER file_size;
+		if (!GetFileSizeEx(handle, &file_size))
+		{
+			throw std::runtime_error("failed to query file size");
+		}
+		return static_cast<u64>(file_size.QuadPart);
+	#else
+		struct stat file_status;
+		if (::fstat(handle, &file_status))
+		{
+			throw std::runtime_error("failed to query file size");
+		}
+		return static_cast<u64>(file_status.st_size);
+	#endif
+}
+
+void input_file::read(u64 offset, std::span<std::byte> buffer) const
+{
+	const std::span<std::byte> buffers[1] = {buffer};
+	read(offset, buffers);
+}
+
+void input_file::read(u64 offset, std::span<const std::span<std::byte>> buffers) const
+{
+	#if defined(_WIN32)
+		
+		// Read buffers one at a time, in chunks small enough for a DWORD byte count
+		for (auto buffer: buffers)
+		{
+			while (!buffer.empty())
+			{
+				OVERLAPPED overlapped = {};
+				overlapped.Offset = static_cast<DWORD>(offset);
+				overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+				
+				DWORD bytes_read = 0;
+				const DWORD bytes_requested = static_cast<DWORD>(std::min<std::size_t>(buffer.size(), 0x40000000));
+				if (!ReadFile(handle, buffer.data(), bytes_requested, &bytes_read, &overlapped) || !bytes_read)
+				{
+					throw std::runtime_error("failed to read file");
+				}
+				
+				offset += bytes_read;
+				buffer = buffer.subspan(bytes_read);
+				count_bytes_read(bytes_read);
+			}
+		}
+	
+	#else
+		
+		// Gather buffers into I/O vectors, in batches of at most `IOV_MAX`
+		iovec vectors[IOV_MAX];
+		while (!buffers.empty())
+		{
+			int vector_count = 0;
+			for (; vector_count < IOV_MAX && static_cast<std::size_t>(vector_count) < buffers.size(); ++vector_count)
+			{
+				vectors[vector_count] = {buffers[vector_count].data(), buffers[vector_count].size()};
+			}
+			buffers = buffers.subspan(vector_count);
+			
+			// Read vectors, resuming after partial reads
+			iovec* first_vector = vectors;
+			std::size_t remaining = 0;
+			for (;;)
+			{
+				// Skip vectors that have been filled, and advance into a partially-filled vector
+				while (vector_count && remaining >= first_vector->iov_len)
+				{
+					remaining -= first_vector->iov_len;
+					++first_vector;
+					--vector_count;
+				}
+				if (!vector_count)
+				{
+					break;
+				}
+				first_vector->iov_base = static_cast<std::byte*>(first_vector->iov_base) + remaining;
+				first_vector->iov_len -= remaining;
+				
+				const ssize_t bytes_read = ::preadv(handle, first_vector, vector_count, static_cast<off_t>(offset));
+				if (bytes_read < 0 && errno == EINTR)
+				{
+					remaining = 0;
+					continue;
+				}
+				if (bytes_read <= 0)
+				{
+					throw std::runtime_error("failed to read file");
+				}
+				
+				offset += static_cast<u64>(bytes_read);
+				remaining = static_cast<std::size_t>(bytes_read);
+				count_bytes_read(static_cast<u64>(bytes_read));
+			}
+		}
+	
+	#endif
+}
@@ -0,0 +1,99 @@
+// SPDX-FileCopyrightText: 2023 C. J. Howard
+// SPDX-License-Identifier: MIT
+
+#include "siafu.hpp"
+#include <stdexcept>
+
+#if defined(_WIN32)
+	#define WIN32_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+std::shared_ptr<const std::byte[]> map_file(const fs::path& path, std::size_t& size)
+{
+	size = 0;
+	
+	#if defined(_WIN32)
+		
+		// Open file for sequential reading
+		HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			throw std::runtime_error("failed to open file");
+		}
+		
+		LARGE_INTEGER file_size;
+		if (!GetFileSizeEx(file, &file_size))
+		{
+			CloseHandle(file);
+			throw std::runtime_error("failed to query file size");
+		}
+		if (!file_size.QuadPart)
+		{
+			CloseHandle(file);
+			return {};
+		}
+		
+		// Map a read-only view of the file. The view keeps the file and mapping objects alive once their handles are closed
+		HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		CloseHandle(file);
+		if (!mapping)
+		{
+			throw std::runtime_error("failed to map file");
+		}
+		const void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		CloseHandle(mapping);
+		if (!data)
+		{
+			throw std::runtime_error("failed to map file");
+		}
+		
+		size = static_cast<std::size_t>(file_size.QuadPart);
+		count_bytes_read(size);
+		return {static_cast<const std::byte*>(data), [](const std::byte* p) { UnmapViewOfFile(p); }};
+	
+	#else
+		
+		const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+		{
+			throw std::runtime_error("failed to open file");
+		}
+		
+		struct stat file_status;
+		if (::fstat(fd, &file_status))
+		{
+			::close(fd);
+			throw std::runtime_error("failed to query file size");
+		}
+		if (!file_status.st_size)
+		{
+			::close(fd);
+			return {};
+		}
+		
+		// Map file. The mapping remains valid once the file descriptor is closed
+		const std::size_t file_size = static_cast<std::size_t>(file_status.st_size);
+		void* data = ::mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if (data == MAP_FAILED)
+		{
+			throw std::runtime_error("failed to map file");
+		}
+		
+		// Hint that pages will be accessed sequentially, and start reading them ahead
+		::madvise(data, file_size, MADV_SEQUENTIAL);
+		::madvise(data, file_size, MADV_WILLNEED);
+		
+		size = file_size;
+		count_bytes_read(size);
+		return {static_cast<const std::byte*>(data), [file_size](const std::byte* p) { ::munmap(const_cast<std::byte*>(p), file_size); }};
+	
+	#endif
+}
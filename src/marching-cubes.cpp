@@ -2,8 +2,20 @@
 // SPDX-License-Identifier: MIT
 
 #include "siafu.hpp"
+#include <algorithm>
+#include <array>
+#include <bit>
 #include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <future>
+#include <limits>
 #include <memory>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <thread>
 
 namespace
 {
@@ -316,219 +328,1970 @@ namespace
 		0xfffffffffffff830,
 		0xffffffffffffffff
 	};
-}
-
-void polygonize
-(
-	f32 isolevel,
-	const std::function<f32(u32, u32, u32)>& sample,
-	u32 width,
-	u32 height,
-	u32 depth,
-	std::vector<vertex>& vertices,
-	std::vector<triangle>& triangles
-)
-{
-	const u32vec3 max{std::max(width, 1u) - 1, std::max(height, 1u) - 1, std::max(depth, 1u) - 1};
-	const u32 z_stride = width * height;
-	
-	f32vec3 scale;
-	scale.x = 2.0f / std::max(max.x, std::max(max.y, max.z));
-	scale.y = scale.x;
-	scale.z = scale.x;
-	f32vec3 translation = {-1.0f, -1.0f, -1.0f};
-	
-	// Index offset for cube vertices
-	const u32 offsets[8] =
-	{
-		0,
-		1,
-		width + 1,
-		width,
-		z_stride,
-		z_stride + 1,
-		width * (height + 1) + 1,
-		width * (height + 1),
+	
+	/// Cube intersected by an isosurface.
+	struct active_cube
+	{
+		/// X-coordinate of the cube.
+		u32 x;
+		
+		/// Cube configuration.
+		u32 config;
 	};
 	
-	// Allocate a cache to hold the indices of two Z-slices of vertices
-	const u32 vertex_cache_capacity = z_stride * 2;
-	const u32 vertex_cache_size = vertex_cache_capacity * 3;
-	auto vertex_cache = std::make_unique<u32[]>(vertex_cache_size);
-	std::memset(vertex_cache.get(), 0xff, vertex_cache_size * sizeof(u32));
+	/**
+	 * Gathers the classification bits of the cube vertices of 64 consecutive cubes in a row.
+	 *
+	 * @param[in] rows Classification bitmasks of the four rows of voxels at the cube vertices, in (y, z), (y + 1, z), (y, z + 1), (y + 1, z + 1) order.
+	 * @param[in] w Index of the word of the first cube.
+	 * @param[in] word_count Number of words in each bitmask.
+	 * @param[out] bits Classification bits of each cube vertex, in which bit `i` belongs to cube `(w << 6) + i`.
+	 */
+	inline void gather_cube_bits(const u64* const (&rows)[4], u32 w, u32 word_count, u64 (&bits)[8]) noexcept
+	{
+		for (u32 r = 0; r < 4; ++r)
+		{
+			const u64 lower = rows[r][w];
+			const u64 upper = (lower >> 1) | (w + 1 < word_count ? rows[r][w + 1] << 63 : 0);
+			
+			// Map the lower and upper X-coordinates of each row to cube vertex indices
+			const u32 cube_vertex = (r & 2) << 1;
+			bits[cube_vertex + ((r & 1) ? 3 : 0)] = lower;
+			bits[cube_vertex + ((r & 1) ? 2 : 1)] = upper;
+		}
+	}
+	
+	/**
+	 * Finds which of 64 consecutive cubes in a row are intersected by an isosurface.
+	 *
+	 * @param[in] bits Classification bits of each cube vertex, as gathered by gather_cube_bits().
+	 * @param[in] w Index of the word of the first cube.
+	 * @param[in] cube_count Number of cubes in the row.
+	 *
+	 * @return Bitmask in which bit `i` is set if cube `(w << 6) + i` is active.
+	 */
+	[[nodiscard]] inline u64 find_active_bits(const u64 (&bits)[8], u32 w, u32 cube_count) noexcept
+	{
+		// Cubes are active unless all vertices are either inside or outside the isosurface
+		u64 any_inside = 0;
+		u64 all_inside = ~u64{0};
+		for (u32 i = 0; i < 8; ++i)
+		{
+			any_inside |= bits[i];
+			all_inside &= bits[i];
+		}
+		u64 active = any_inside & ~all_inside;
+		
+		// Disregard bits past the end of the row
+		const u32 first_cube = w << 6;
+		if (cube_count - first_cube < 64)
+		{
+			active &= (u64{1} << (cube_count - first_cube)) - 1;
+		}
+		
+		return active;
+	}
+	
+	/**
+	 * Finds the cubes in a row which are intersected by an isosurface.
+	 *
+	 * @param[in] rows Classification bitmasks of the four rows of voxels at the cube vertices, in (y, z), (y + 1, z), (y, z + 1), (y + 1, z + 1) order.
+	 * @param[in] word_count Number of words in each bitmask.
+	 * @param[in] cube_count Number of cubes in the row.
+	 * @param[in] filter Bitmask of the cubes in the row which may be active, or `nullptr` if all cubes may be active.
+	 * @param[out] cubes List of active cubes.
+	 */
+	void find_active_cubes(const u64* const (&rows)[4], u32 word_count, u32 cube_count, const u64* filter, std::vector<active_cube>& cubes)
+	{
+		cubes.clear();
+		
+		for (u32 w = 0; w < word_count; ++w)
+		{
+			if (filter && !filter[w])
+			{
+				continue;
+			}
+			
+			// Gather classification bits of the cube vertices, for 64 cubes at once
+			u64 bits[8];
+			gather_cube_bits(rows, w, word_count, bits);
+			u64 active = find_active_bits(bits, w, cube_count);
+			if (filter)
+			{
+				active &= filter[w];
+			}
+			
+			// Emit active cubes
+			const u32 first_cube = w << 6;
+			while (active)
+			{
+				const u32 i = static_cast<u32>(std::countr_zero(active));
+				active &= active - 1;
+				
+				u32 config = 0;
+				for (u32 j = 0; j < 8; ++j)
+				{
+					config |= static_cast<u32>((bits[j] >> i) & 1) << j;
+				}
+				
+				cubes.emplace_back(first_cube + i, config);
+			}
+		}
+	}
+	
+	/**
+	 * Reads the Z-slices of a volume in ascending order. Z-slices of volumes which are not resident in memory are copied into staging buffers, reading ahead one Z-slice in the background.
+	 *
+	 * @tparam T Voxel type.
+	 */
+	template <class T>
+	class slice_reader
+	{
+	public:
+		/**
+		 * Constructs a Z-slice reader.
+		 *
+		 * @param[in] source Volume to read.
+		 * @param[in] last_slice Index of the last Z-slice to read, beyond which no Z-slice is read ahead.
+		 */
+		slice_reader(const volume& source, u32 last_slice):
+			source(source),
+			last_slice(last_slice)
+		{
+			if (!source.voxels)
+			{
+				staging_buffers[0] = std::make_unique_for_overwrite<std::byte[]>(source.slice_size());
+				staging_buffers[1] = std::make_unique_for_overwrite<std::byte[]>(source.slice_size());
+			}
+		}
+		
+		/// Releases the Z-slices which are accessed in place, including a Z-slice read ahead but never read.
+		~slice_reader()
+		{
+			if (read_ahead.valid())
+			{
+				try
+				{
+					if (read_ahead.get() != staging_buffers[read_ahead_slice % 2].get() && source.release_slice)
+					{
+						source.release_slice(read_ahead_slice);
+					}
+				}
+				catch (...)
+				{
+				}
+			}
+			release(0);
+			release(1);
+		}
+		
+		/**
+		 * Reads a Z-slice, and starts reading the next Z-slice in the background if the volume copied this one into a staging buffer. Z-slices must be read in ascending order.
+		 *
+		 * @param[in] z Index of the Z-slice.
+		 *
+		 * @return Pointer to the Z-slice voxels, which remains valid until the Z-slice after next is read.
+		 */
+		[[nodiscard]] const T* read(u32 z)
+		{
+			// Release the Z-slice before last, whose staging buffer this Z-slice reuses
+			release(z % 2);
+			
+			const std::byte* slice = read_ahead.valid() ? read_ahead.get() : source.read_slice(z, staging_buffers[z % 2].get());
+			if (slice != staging_buffers[z % 2].get() && source.release_slice)
+			{
+				in_place_slices[z % 2] = z;
+			}
+			
+			if (slice == staging_buffers[z % 2].get() && z < last_slice)
+			{
+				read_ahead_slice = z + 1;
+				read_ahead = std::async
+				(
+					std::launch::async,
+					[&source = source, z, buffer = staging_buffers[(z + 1) % 2].get()]()
+					{
+						return source.read_slice(z + 1, buffer);
+					}
+				);
+			}
+			
+			return reinterpret_cast<const T*>(slice);
+		}
+	
+	private:
+		/// Marks a staging buffer slot which is occupied by no Z-slice accessed in place.
+		static constexpr u32 no_slice = ~u32{0};
+		
+		/// Releases the Z-slice accessed in place which occupies a staging buffer slot, if any.
+		void release(u32 slot)
+		{
+			if (in_place_slices[slot] != no_slice)
+			{
+				source.release_slice(in_place_slices[slot]);
+				in_place_slices[slot] = no_slice;
+			}
+		}
+		
+		const volume& source;
+		u32 last_slice;
+		std::unique_ptr<std::byte[]> staging_buffers[2];
+		std::future<const std::byte*> read_ahead;
+		u32 read_ahead_slice{0};
+		u32 in_place_slices[2]{no_slice, no_slice};
+	};
 	
-	// Allocate a cache to hold 4 Z-slices of voxels
-	const auto voxel_cache_size = z_stride * 4;
-	auto voxel_cache = std::make_unique<f32[]>(voxel_cache_size);
+	/// Flag marking a slab vertex index as a reference to an edge vertex on the first Z-plane of the slab, which is owned by the preceding slab.
+	inline constexpr u32 boundary_vertex_flag = 0x80000000;
 	
-	// Fetches a voxel from the voxel cache, given X-, Y-, and Z-coordinates.
-	auto get_voxel = [&](u32 x, u32 y, u32 z) -> f32
+	/// Isosurface fragment extracted from a Z-slab of the grid.
+	struct slab
 	{
-		return voxel_cache[x + width * (y + height * (z % 4))];
+		/// Slab vertex list.
+		paged_vector<vertex> vertices;
+		
+		/// Slab triangle list, with indices into the slab vertex list or edge keys flagged with `boundary_vertex_flag`.
+		paged_vector<triangle> triangles;
+		
+		/// Edge keys and slab vertex indices of the edge vertices on the last Z-plane of the slab, sorted by edge key.
+		std::vector<std::pair<u32, u32>> boundary_vertices;
 	};
 	
-	// Calculates a gradient from the voxel cache, given X-, Y-, and Z-coordinates.
-	auto get_gradient = [&](u32 x, u32 y, u32 z) -> f32vec3
+	/**
+	 * Maps a slab vertex index to a vertex index relative to a vertex base.
+	 *
+	 * @param[in] index Slab vertex index, or edge key flagged with `boundary_vertex_flag`.
+	 * @param[in] offset Offset of the first vertex of the slab from the vertex base.
+	 * @param[in] preceding Preceding slab, which owns flagged edge vertices.
+	 * @param[in] preceding_offset Offset of the first vertex of the preceding slab from the vertex base.
+	 *
+	 * @return Vertex index relative to the vertex base.
+	 */
+	[[nodiscard]] u32 resolve_vertex(u32 index, u64 offset, const slab* preceding, u64 preceding_offset)
 	{
-		return
+		if (!(index & boundary_vertex_flag))
+		{
+			return static_cast<u32>(offset + index);
+		}
+		
+		const auto it = std::ranges::lower_bound(preceding->boundary_vertices, index & ~boundary_vertex_flag, {}, &std::pair<u32, u32>::first);
+		return static_cast<u32>(preceding_offset + it->second);
+	}
+	
+	/**
+	 * Polygonizes the Z-slabs of a scalar field, producing one fragment of each isosurface per slab.
+	 *
+	 * @param[in] isolevels Isosurface threshold values.
+	 * @param[in] source Scalar field volume.
+	 * @param[in] thread_count Maximum number of threads.
+	 * @param[in] slab_depth Maximum number of Z-layers per slab.
+	 * @param[out] slabs Slab fragments, ordered by slab and then by isolevel.
+	 * @param[in] finish_slab Function called with the index of each slab, and whether its fragments are complete, once it has been polygonized or has failed, or `nullptr`. Called concurrently.
+	 */
+	template <class T>
+	void polygonize_slabs
+	(
+		std::span<const f32> isolevels,
+		const volume& source,
+		u32 thread_count,
+		u32 slab_depth,
+		std::vector<slab>& slabs,
+		const std::function<void(std::size_t, bool)>& finish_slab
+	)
+	{
+		const u32 width = source.width;
+		const u32 height = source.height;
+		const u32 depth = source.depth;
+		const u32vec3 max{std::max(width, 1u) - 1, std::max(height, 1u) - 1, std::max(depth, 1u) - 1};
+		const std::size_t z_stride = std::size_t{width} * height;
+		const std::size_t level_count = isolevels.size();
+		if (!level_count)
+		{
+			return;
+		}
+		
+		// Edge keys of two Z-slices of vertices must fit below `boundary_vertex_flag`, such that grid indices within the voxel and vertex caches fit in 32 bits
+		if (z_stride * 6 > boundary_vertex_flag)
+		{
+			throw std::runtime_error("Z-slices too large");
+		}
+		
+		const auto [grid_scale, grid_translation] = source.grid_transform();
+		const f32vec3 scale = {grid_scale, grid_scale, grid_scale};
+		const f32vec3 translation = {grid_translation, grid_translation, grid_translation};
+		
+		// Find the rows of bricks which may be intersected by each isosurface, if the volume is indexed
+		constexpr u32 brick_size = brick_index::brick_size;
+		const brick_index* bricks = source.bricks.get();
+		const std::size_t brick_row_count = bricks ? std::size_t{bricks->dimensions.y} * bricks->dimensions.z : 0;
+		std::vector<u8> active_brick_rows(brick_row_count * level_count);
+		if (bricks)
+		{
+			for (std::size_t l = 0; l < level_count; ++l)
+			{
+				for (std::size_t i = 0; i < bricks->min_values.size(); ++i)
+				{
+					if (bricks->straddles(i, isolevels[l]))
+					{
+						active_brick_rows[brick_row_count * l + i / bricks->dimensions.x] = 1;
+					}
+				}
+			}
+		}
+		
+		// Index offset for cube vertices
+		const u32 offsets[8] =
 		{
-			get_voxel(std::max(x, 1u) - 1, y, z) - get_voxel(std::min(x + 1, max.x), y, z),
-			get_voxel(x, std::max(y, 1u) - 1, z) - get_voxel(x, std::min(y + 1, max.y), z),
-			get_voxel(x, y, std::max(z, 1u) - 1) - get_voxel(x, y, std::min(z + 1, max.z))
+			0,
+			1,
+			width + 1,
+			width,
+			width * height,
+			width * height + 1,
+			width * (height + 1) + 1,
+			width * (height + 1),
 		};
-	};
+		
+		// Size of a cache holding the indices of two Z-slices of vertices
+		const auto vertex_cache_capacity = static_cast<u32>(z_stride * 2);
+		const u32 vertex_cache_size = vertex_cache_capacity * 3;
+		
+		// Size of a cache holding 4 Z-slices of voxels
+		const auto voxel_cache_size = static_cast<u32>(z_stride * 4);
+		
+		// Polygonizes the cubes in Z-layers [`z_begin`, `z_end`) of the grid, once for each isolevel.
+		auto polygonize_slab = [&](u32 z_begin, u32 z_end, std::span<slab> level_slabs)
+		{
+			// Allocate a vertex cache for each isolevel
+			auto vertex_cache = std::make_unique<u32[]>(vertex_cache_size * level_count);
+			std::memset(vertex_cache.get(), 0xff, vertex_cache_size * level_count * sizeof(u32));
+			
+			// Allocate voxel cache, shared by all isolevels
+			auto voxel_cache = std::make_unique<f32[]>(voxel_cache_size);
+			
+			// Allocate a cache for each isolevel to hold the classification bitmasks of each cached row of voxels
+			const u32 mask_stride = (width + 63) / 64;
+			const std::size_t mask_cache_size = std::size_t{mask_stride} * height * 4;
+			auto mask_cache = std::make_unique<u64[]>(mask_cache_size * level_count);
+			
+			// Allocate active cube list
+			std::vector<active_cube> active_cubes;
+			active_cubes.reserve(max.x);
+			
+			// Number of active cubes, and of intersected edges looked up in the vertex cache
+			u64 active_cube_count = 0;
+			u64 edge_lookup_count = 0;
+			
+			// Allocate bitmasks of the cubes in each row of the current Z-layer of bricks which may be active, and of the rows of voxels required by active bricks, for each isolevel
+			std::vector<u64> brick_filters;
+			std::vector<u8> required_rows;
+			u32 filter_layer = ~u32{0};
+			if (bricks)
+			{
+				brick_filters.resize(std::size_t{mask_stride} * bricks->dimensions.y * level_count);
+				required_rows.resize(std::size_t{height} * level_count);
+			}
+			
+			// Read Z-slices up to the one above the slab, reading ahead from volumes which are not resident in memory
+			slice_reader<T> reader(source, std::min(z_end + 1, depth - 1));
+			
+			// Fetches a voxel from the voxel cache, given X-, Y-, and Z-coordinates.
+			auto get_voxel = [&](u32 x, u32 y, u32 z) -> f32
+			{
+				return voxel_cache[x + width * (y + height * (z % 4))];
+			};
+			
+			// Calculates a gradient from the voxel cache, given X-, Y-, and Z-coordinates.
+			auto get_gradient = [&](u32 x, u32 y, u32 z) -> f32vec3
+			{
+				return
+				{
+					get_voxel(std::max(x, 1u) - 1, y, z) - get_voxel(std::min(x + 1, max.x), y, z),
+					get_voxel(x, std::max(y, 1u) - 1, z) - get_voxel(x, std::min(y + 1, max.y), z),
+					get_voxel(x, y, std::max(z, 1u) - 1) - get_voxel(x, y, std::min(z + 1, max.z))
+				};
+			};
+			
+			// Fetches a row classification bitmask from the mask cache, given an isolevel index and Y- and Z-coordinates.
+			auto get_mask_row = [&](std::size_t l, u32 y, u32 z) -> u64*
+			{
+				return mask_cache.get() + mask_cache_size * l + std::size_t{mask_stride} * (y + height * (z % 4));
+			};
+			
+			// Finds the cubes in each row of a Z-layer of bricks which lie in active bricks, for each isolevel.
+			auto filter_brick_layer = [&](u32 bz)
+			{
+				std::ranges::fill(brick_filters, 0);
+				for (std::size_t l = 0; l < level_count; ++l)
+				{
+					for (u32 by = 0; by < bricks->dimensions.y; ++by)
+					{
+						u64* filter = brick_filters.data() + std::size_t{mask_stride} * (by + std::size_t{bricks->dimensions.y} * l);
+						for (u32 bx = 0; bx < bricks->dimensions.x; ++bx)
+						{
+							if (bricks->straddles(bx + bricks->dimensions.x * (by + std::size_t{bricks->dimensions.y} * bz), isolevels[l]))
+							{
+								for (u32 x = bx * brick_size; x < std::min((bx + 1) * brick_size, max.x); ++x)
+								{
+									filter[x >> 6] |= u64{1} << (x & 63);
+								}
+							}
+						}
+					}
+				}
+				filter_layer = bz;
+			};
+			
+			// Finds the rows of voxels in the given Z-slice which are required by active bricks, including neighboring rows for gradients, for each isolevel.
+			auto find_required_rows = [&](u32 z)
+			{
+				std::ranges::fill(required_rows, 0);
+				
+				// Z-slices are required by Z-layers of bricks which span them, or are adjacent to them
+				const u32 bz_begin = z > brick_size + 1 ? (z - 2) / brick_size : 0;
+				const u32 bz_end = std::min((z + 1) / brick_size + 1, bricks->dimensions.z);
+				for (std::size_t l = 0; l < level_count; ++l)
+				{
+					for (u32 bz = bz_begin; bz < bz_end; ++bz)
+					{
+						for (u32 by = 0; by < bricks->dimensions.y; ++by)
+						{
+							if (active_brick_rows[brick_row_count * l + by + std::size_t{bricks->dimensions.y} * bz])
+							{
+								const u32 y_begin = std::max(by * brick_size, 1u) - 1;
+								const u32 y_end = std::min((by + 1) * brick_size + 1, max.y);
+								std::fill(required_rows.begin() + height * l + y_begin, required_rows.begin() + height * l + y_end + 1, u8{1});
+							}
+						}
+					}
+				}
+			};
+			
+			// Caches voxels in the given Z-slice, and classifies them against each isolevel, skipping rows which are not required by active bricks.
+			auto cache_z_slice = [&](u32 z)
+			{
+				const T* slice = reader.read(z);
+				f32* v = voxel_cache.get() + (z % 4) * z_stride;
+				
+				if (bricks)
+				{
+					find_required_rows(z);
+				}
+				
+				for (u32 y = 0; y < height; ++y)
+				{
+					f32* row = v + width * y;
+					bool converted = false;
+					
+					for (std::size_t l = 0; l < level_count; ++l)
+					{
+						if (bricks && !required_rows[height * l + y])
+						{
+							continue;
+						}
+						
+						// Convert the row once for all isolevels
+						if (!converted)
+						{
+							for (u32 x = 0; x < width; ++x)
+							{
+								row[x] = static_cast<f32>(slice[width * y + x]);
+							}
+							converted = true;
+						}
+						
+						classify_row({row, width}, isolevels[l], {get_mask_row(l, y, z), mask_stride});
+					}
+				}
+			};
+			
+			// Cache voxels in the first two Z-slices of the slab, and in the preceding Z-slice for gradients
+			if (z_begin)
+			{
+				cache_z_slice(z_begin - 1);
+			}
+			cache_z_slice(z_begin);
+			if (z_begin + 1 < depth)
+			{
+				cache_z_slice(z_begin + 1);
+			}
+			
+			// Init minimum Z-coordinate of cached vertices
+			f32 min_cached_vertex_z = -std::numeric_limits<f32>::infinity();
+			
+			// Loop through the slab
+			for (u32 z = z_begin; z < z_end; ++z)
+			{
+				// Cache voxels in Z-slice `z + 2`
+				if (z + 2 < depth)
+				{
+					cache_z_slice(z + 2);
+				}
+				
+				// Calculate Z-coordinates of the cube vertices
+				u32vec3 cube_vertices[8];
+				f32vec3 transformed_cube_vertices[8];
+				for (u32 i = 0; i < 8; ++i)
+				{
+					cube_vertices[i].z = z + ((cube_offsets >> (i + 16)) & 1);
+					transformed_cube_vertices[i].z = static_cast<f32>(cube_vertices[i].z) * scale.z + translation.z;
+				}
+				
+				// Filter cubes by the active bricks of their Z-layer
+				const u32 bz = z / brick_size;
+				if (bricks && bz != filter_layer)
+				{
+					filter_brick_layer(bz);
+				}
+				
+				// Edge vertices on the first and last Z-planes of the slab are shared with adjacent slabs
+				const bool shares_bottom_edges = z == z_begin && z_begin > 0;
+				const bool shares_top_edges = z + 1 == z_end && z_end < max.z;
+				
+				// Polygonize the Z-layer once for each isolevel
+				for (std::size_t l = 0; l < level_count; ++l)
+				{
+					const f32 isolevel = isolevels[l];
+					slab& s = level_slabs[l];
+					u32* level_vertex_cache = vertex_cache.get() + std::size_t{vertex_cache_size} * l;
+					
+					for (u32 y = 0; y < max.y; ++y)
+					{
+						// Skip rows of cubes in rows of bricks which cannot be intersected by the isosurface
+						const u32 by = y / brick_size;
+						if (bricks && !active_brick_rows[brick_row_count * l + by + std::size_t{bricks->dimensions.y} * bz])
+						{
+							continue;
+						}
+						
+						// Calculate Y-coordinates of the cube vertices
+						for (u32 i = 0; i < 8; ++i)
+						{
+							cube_vertices[i].y = y + ((cube_offsets >> (i + 8)) & 1);
+							transformed_cube_vertices[i].y = static_cast<f32>(cube_vertices[i].y) * scale.y + translation.y;
+						}
+						
+						// Classify cubes in the row, skipping cubes not intersected by the isosurface
+						const u64* const mask_rows[4] = {get_mask_row(l, y, z), get_mask_row(l, y + 1, z), get_mask_row(l, y, z + 1), get_mask_row(l, y + 1, z + 1)};
+						find_active_cubes(mask_rows, mask_stride, max.x, bricks ? brick_filters.data() + std::size_t{mask_stride} * (by + std::size_t{bricks->dimensions.y} * l) : nullptr, active_cubes);
+						active_cube_count += active_cubes.size();
+						
+						for (const auto [x, cube_config]: active_cubes)
+						{
+							// Grid index of the cube within the voxel cache, which is congruent to its grid index within the volume modulo the sizes of the voxel and vertex caches
+							const u32 base_vertex_index = x + width * (y + height * (z % 4));
+							const auto edge_case = edge_table[cube_config];
+							edge_lookup_count += static_cast<u64>(std::popcount(edge_case));
+							
+							// For each cube edge
+							u32 vertex_indices[12];
+							for (u32 i = 0; i < 12; ++i)
+							{
+								// Disregard edges not intersected by the isosurface
+								if (!(edge_case & (1 << i)))
+								{
+									continue;
+								}
+								
+								// Determine indices of cube vertices that form the edge
+								const u32 v1 = (edge_vertices_a >> (i << 2)) & 0b111;
+								const u32 v2 = (edge_vertices_b >> (i << 2)) & 0b111;
+								const auto v1_index = base_vertex_index + offsets[v1];
+								const auto v2_index = base_vertex_index + offsets[v2];
+								
+								// Fetch cached edge vertex with edge key
+								const auto edge_key = (v1_index % vertex_cache_capacity) * 3 + ((edge_directions >> (i << 1)) & 0b11);
+								auto& cached_vertex = level_vertex_cache[edge_key];
+								
+								// Defer edge vertices on the bottom face to the preceding slab, which has already generated them
+								if (shares_bottom_edges && i < 4)
+								{
+									vertex_indices[i] = boundary_vertex_flag | edge_key;
+									continue;
+								}
+								
+								// Reuse cached edge vertex if not invalid or expired
+								if (cached_vertex != ~u32{0} && s.vertices[cached_vertex].p.z >= min_cached_vertex_z)
+								{
+									vertex_indices[i] = cached_vertex;
+									continue;
+								}
+								
+								// Valid cached edge vertex not found, cache a new edge vertex
+								cached_vertex = static_cast<u32>(s.vertices.size());
+								vertex_indices[i] = cached_vertex;
+								
+								// Expose edge vertices on the top face to the succeeding slab
+								if (shares_top_edges && i >= 4 && i < 8)
+								{
+									s.boundary_vertices.emplace_back(edge_key, cached_vertex);
+								}
+								
+								// Calculate X-coordinates of the cube vertices
+								cube_vertices[v1].x = x + ((cube_offsets >> v1) & 1);
+								cube_vertices[v2].x = x + ((cube_offsets >> v2) & 1);
+								transformed_cube_vertices[v1].x = static_cast<f32>(cube_vertices[v1].x) * scale.x + translation.x;
+								transformed_cube_vertices[v2].x = static_cast<f32>(cube_vertices[v2].x) * scale.x + translation.x;
+								
+								// Get transformed edge vertex positions
+								const auto& p1 = transformed_cube_vertices[v1];
+								const auto& p2 = transformed_cube_vertices[v2];
+								
+								// Fetch voxel values from voxel cache
+								const auto voxel1 = voxel_cache[v1_index % voxel_cache_size];
+								const auto voxel2 = voxel_cache[v2_index % voxel_cache_size];
+								
+								// Calculate interpolation factor between edge endpoints. Edges to NaN voxels are split at their midpoint, as NaN vertex positions would defeat the expiry check of the vertex cache
+								const f32 t = !(std::abs(voxel1 - voxel2) >= 1e-6) ? 0.5f : (isolevel - voxel1) / (voxel2 - voxel1);
+								
+								// Construct new vertex between edge endpoints
+								vertex v;
+								v.p = {(p2.x - p1.x) * t + p1.x, (p2.y - p1.y) * t + p1.y, (p2.z - p1.z) * t + p1.z};
+								
+								// Interpolate between isofield gradients at edge endpoints
+								const auto g1 = get_gradient(cube_vertices[v1].x, cube_vertices[v1].y, cube_vertices[v1].z);
+								const auto g2 = get_gradient(cube_vertices[v2].x, cube_vertices[v2].y, cube_vertices[v2].z);
+								const f32vec3 g = {(g2.x - g1.x) * t + g1.x, (g2.y - g1.y) * t + g1.y, (g2.z - g1.z) * t + g1.z};
+								
+								// Calculate vertex normal from normalized interpolated gradient
+								const f32 sqr_gl = g.x * g.x + g.y * g.y + g.z * g.z;
+								const f32 inv_gl = (sqr_gl > 1e-6f) ? 1.0f / std::sqrt(sqr_gl) : 0.0f;
+								v.n = {g.x * inv_gl, g.y * inv_gl, g.z * inv_gl};
+								
+								// Add vertex to slab vertex list
+								s.vertices.emplace_back(std::move(v));
+							}
+							
+							// Generate triangles
+							auto triangulation = triangle_table[cube_config];
+							for (int i = 0; (triangulation & 0xf) != 0xf && i < 15; i += 3)
+							{
+								const auto a = vertex_indices[triangulation & 0xf];
+								const auto b = vertex_indices[(triangulation >> 4) & 0xf];
+								const auto c = vertex_indices[(triangulation >> 8) & 0xf];
+								triangulation >>= 12;
+								
+								// If triangle is not degenerate
+								if (a != b && a != c && b != c)
+								{
+									s.triangles.emplace_back(a, b, c);
+								}
+							}
+						}
+					}
+				}
+				
+				// Update minimum Z-coordinate of cached vertices
+				min_cached_vertex_z = transformed_cube_vertices[7].z;
+			}
+			
+			u64 generated_vertex_count = 0;
+			for (auto& s: level_slabs)
+			{
+				std::ranges::sort(s.boundary_vertices);
+				generated_vertex_count += s.vertices.size();
+			}
+			
+			// Edge vertices which were not generated by the slab were found in its vertex cache, or deferred to the preceding slab
+			count_cubes(u64{max.x} * max.y * (z_end - z_begin) * level_count, active_cube_count);
+			count_edge_vertices(edge_lookup_count, generated_vertex_count);
+		};
+		
+		// Split the grid into Z-slabs, several per thread to balance uneven workloads. Each slab holds one fragment of each isosurface. Each Z-slice of grid points owns at most three edge vertices per point, so slabs are kept thin enough that their vertex indices stay below `boundary_vertex_flag`
+		const u64 max_slab_depth = std::min<u64>(boundary_vertex_flag / (std::max<u64>(z_stride, 1) * 3) - 1, std::max(slab_depth, 1u));
+		const auto min_slab_count = static_cast<u32>((max.z + max_slab_depth - 1) / max_slab_depth);
+		const u32 slab_count = std::max({std::min(max.z, thread_count > 1 ? thread_count * 4 : 1), min_slab_count, 1u});
+		slabs.resize(slab_count * level_count);
+		
+		// Polygonize slabs in parallel
+		parallel_for
+		(
+			slab_count,
+			thread_count,
+			[&](std::size_t i)
+			{
+				const auto z_begin = static_cast<u32>(u64{max.z} * i / slab_count);
+				const auto z_end = static_cast<u32>(u64{max.z} * (i + 1) / slab_count);
+				try
+				{
+					polygonize_slab(z_begin, z_end, std::span{slabs}.subspan(i * level_count, level_count));
+				}
+				catch (...)
+				{
+					if (finish_slab)
+					{
+						finish_slab(i, false);
+					}
+					throw;
+				}
+				
+				if (finish_slab)
+				{
+					finish_slab(i, true);
+				}
+			}
+		);
+	}
 	
-	// Caches voxels in the given Z-slice.
-	auto cache_z_slice = [&](u32 z)
+	/// Number of triangles for each cube configuration.
+	static const auto triangle_counts = []()
 	{
-		f32* s = voxel_cache.get() + (z % 4) * z_stride;
-		for (u32 y = 0; y < height; ++y)
+		std::array<u8, 256> counts{};
+		for (std::size_t i = 0; i < counts.size(); ++i)
 		{
-			for (u32 x = 0; x < width; ++x)
+			for (u64 triangulation = triangle_table[i]; (triangulation & 0xf) != 0xf; triangulation >>= 12)
 			{
-				*(s++) = sample(x, y, z);
+				++counts[i];
 			}
 		}
+		return counts;
+	}();
+	
+	/// Intersected edges owned by a row of grid points, which are the edges from each grid point in the row to its neighbors along the X-, Y-, and Z-axes.
+	struct edge_row
+	{
+		/// Index of the first vertex of the row within its Z-layer of grid points. Vertices of intersected X-edges precede those of Y-edges, which precede those of Z-edges, each in order of X-coordinate.
+		u32 offset;
+		
+		/// Number of intersected X-edges.
+		u32 x_count;
+		
+		/// Number of intersected Y-edges.
+		u32 y_count;
+		
+		/// Number of intersected Z-edges.
+		u32 z_count;
 	};
 	
-	// Cache voxels in the first two Z-slices
-	cache_z_slice(0);
-	cache_z_slice(1);
+	/// Range of elements generated by a row of cubes or grid points.
+	struct row_span
+	{
+		/// Index of the first element of the row within its Z-layer.
+		u32 offset;
+		
+		/// Number of elements of the row.
+		u32 count;
+	};
 	
-	// Init minimum Z-coordinate of cached vertices
-	f32 min_cached_vertex_z = -std::numeric_limits<f32>::infinity();
+	/**
+	 * Finds the X-edges intersected by an isosurface in a word of a row classification bitmask.
+	 *
+	 * @param[in] row Classification bitmask of a row of voxels.
+	 * @param[in] w Index of the word.
+	 * @param[in] word_count Number of words in the bitmask.
+	 * @param[in] edge_count Number of X-edges in the row.
+	 *
+	 * @return Bitmask in which bit `i` is set if the X-edge from voxel `(w << 6) + i` to its successor is intersected.
+	 */
+	[[nodiscard]] inline u64 find_x_edges(const u64* row, u32 w, u32 word_count, u32 edge_count) noexcept
+	{
+		const u64 upper = (row[w] >> 1) | (w + 1 < word_count ? row[w + 1] << 63 : 0);
+		u64 edges = row[w] ^ upper;
+		
+		// Disregard bits past the last X-edge of the row
+		const u32 first_edge = w << 6;
+		if (edge_count - first_edge < 64)
+		{
+			edges &= (u64{1} << (edge_count - first_edge)) - 1;
+		}
+		
+		return edges;
+	}
 	
-	// Loop through the grid
-	for (u32 z = 0; z < max.z; ++z)
+	/**
+	 * Window of four consecutive Z-slices of a volume, through which a slab of the grid is swept. Each Z-slice is read, converted, and classified against each isolevel once.
+	 *
+	 * @tparam T Voxel type.
+	 */
+	template <class T>
+	class slice_window
 	{
-		// Cache voxels in Z-slice `z + 2`
-		if (z + 2 < depth)
+	public:
+		/**
+		 * Constructs a Z-slice window.
+		 *
+		 * @param[in] isolevels Isosurface threshold values.
+		 * @param[in] source Volume to read.
+		 * @param[in] last_slice Index of the last Z-slice to cache.
+		 */
+		slice_window(std::span<const f32> isolevels, const volume& source, u32 last_slice):
+			isolevels(isolevels),
+			width(source.width),
+			height(source.height),
+			max{std::max(source.width, 1u) - 1, std::max(source.height, 1u) - 1, std::max(source.depth, 1u) - 1},
+			mask_stride((source.width + 63) / 64),
+			mask_size(std::size_t{mask_stride} * source.height * 4),
+			reader(source, last_slice),
+			voxels(std::make_unique_for_overwrite<f32[]>(std::size_t{source.width} * source.height * 4)),
+			masks(std::make_unique_for_overwrite<u64[]>(mask_size * isolevels.size()))
+		{}
+		
+		/// Number of words in each row classification bitmask.
+		[[nodiscard]] inline u32 word_count() const noexcept
 		{
-			cache_z_slice(z + 2);
+			return mask_stride;
 		}
 		
-		// Calculate Z-coordinates of the cube vertices
-		u32vec3 cube_vertices[8];
-		f32vec3 transformed_cube_vertices[8];
-		for (u32 i = 0; i < 8; ++i)
+		/**
+		 * Caches a Z-slice, replacing the Z-slice four below it. Z-slices must be cached in ascending order.
+		 *
+		 * @param[in] z Index of the Z-slice.
+		 */
+		void cache(u32 z)
+		{
+			const T* slice = reader.read(z);
+			for (u32 y = 0; y < height; ++y)
+			{
+				f32* row = voxels.get() + width * (y + std::size_t{height} * (z % 4));
+				for (u32 x = 0; x < width; ++x)
+				{
+					row[x] = static_cast<f32>(slice[std::size_t{width} * y + x]);
+				}
+				
+				for (std::size_t l = 0; l < isolevels.size(); ++l)
+				{
+					classify_row({row, width}, isolevels[l], {mask_row(l, y, z), mask_stride});
+				}
+			}
+		}
+		
+		/// Returns a cached voxel, given its X-, Y-, and Z-coordinates.
+		[[nodiscard]] inline f32 voxel(u32 x, u32 y, u32 z) const noexcept
+		{
+			return voxels[x + width * (y + std::size_t{height} * (z % 4))];
+		}
+		
+		/// Returns the classification bitmask of a cached row of voxels, given an isolevel index and Y- and Z-coordinates. @{
+		[[nodiscard]] inline u64* mask_row(std::size_t l, u32 y, u32 z) noexcept
+		{
+			return masks.get() + mask_size * l + std::size_t{mask_stride} * (y + std::size_t{height} * (z % 4));
+		}
+		[[nodiscard]] inline const u64* mask_row(std::size_t l, u32 y, u32 z) const noexcept
+		{
+			return masks.get() + mask_size * l + std::size_t{mask_stride} * (y + std::size_t{height} * (z % 4));
+		}
+		/// @}
+		
+		/// Calculates a gradient from cached voxels, given X-, Y-, and Z-coordinates.
+		[[nodiscard]] f32vec3 gradient(u32 x, u32 y, u32 z) const noexcept
 		{
-			cube_vertices[i].z = z + ((cube_offsets >> (i + 16)) & 1);
-			transformed_cube_vertices[i].z = static_cast<f32>(cube_vertices[i].z) * scale.z + translation.z;
+			return
+			{
+				voxel(std::max(x, 1u) - 1, y, z) - voxel(std::min(x + 1, max.x), y, z),
+				voxel(x, std::max(y, 1u) - 1, z) - voxel(x, std::min(y + 1, max.y), z),
+				voxel(x, y, std::max(z, 1u) - 1) - voxel(x, y, std::min(z + 1, max.z))
+			};
 		}
+	
+	private:
+		std::span<const f32> isolevels;
+		u32 width;
+		u32 height;
+		u32vec3 max;
+		u32 mask_stride;
+		std::size_t mask_size;
+		slice_reader<T> reader;
+		std::unique_ptr<f32[]> voxels;
+		std::unique_ptr<u64[]> masks;
+	};
+	
+	/**
+	 * Interpolates the position and gradient at which an isosurface intersects the edge between two grid points, as marching cubes does.
+	 *
+	 * @param[in] window Z-slice window which caches both grid points and their neighbors.
+	 * @param[in] isolevel Isosurface threshold value.
+	 * @param[in] a Coordinates of the lower grid point.
+	 * @param[in] b Coordinates of the upper grid point.
+	 * @param[in] scale Scale of grid coordinates.
+	 * @param[in] translation Translation of scaled grid coordinates.
+	 * @param[out] p Position of the intersection.
+	 * @param[out] g Gradient of the scalar field at the intersection.
+	 */
+	template <class T>
+	void interpolate_edge(const slice_window<T>& window, f32 isolevel, const u32vec3& a, const u32vec3& b, const f32vec3& scale, const f32vec3& translation, f32vec3& p, f32vec3& g) noexcept
+	{
+		const f32vec3 p1 = {static_cast<f32>(a.x) * scale.x + translation.x, static_cast<f32>(a.y) * scale.y + translation.y, static_cast<f32>(a.z) * scale.z + translation.z};
+		const f32vec3 p2 = {static_cast<f32>(b.x) * scale.x + translation.x, static_cast<f32>(b.y) * scale.y + translation.y, static_cast<f32>(b.z) * scale.z + translation.z};
+		const f32 voxel1 = window.voxel(a.x, a.y, a.z);
+		const f32 voxel2 = window.voxel(b.x, b.y, b.z);
+		
+		// Calculate interpolation factor between edge endpoints, splitting edges to NaN voxels at their midpoint
+		const f32 t = !(std::abs(voxel1 - voxel2) >= 1e-6) ? 0.5f : (isolevel - voxel1) / (voxel2 - voxel1);
+		p = {(p2.x - p1.x) * t + p1.x, (p2.y - p1.y) * t + p1.y, (p2.z - p1.z) * t + p1.z};
 		
-		for (u32 y = 0; y < max.y; ++y)
+		// Interpolate between isofield gradients at edge endpoints
+		const auto g1 = window.gradient(a.x, a.y, a.z);
+		const auto g2 = window.gradient(b.x, b.y, b.z);
+		g = {(g2.x - g1.x) * t + g1.x, (g2.y - g1.y) * t + g1.y, (g2.z - g1.z) * t + g1.z};
+	}
+	
+	/// Calculates a vertex normal from a gradient, or a zero vector if the gradient vanishes.
+	[[nodiscard]] inline f32vec3 normalize_gradient(const f32vec3& g) noexcept
+	{
+		const f32 sqr_gl = g.x * g.x + g.y * g.y + g.z * g.z;
+		const f32 inv_gl = (sqr_gl > 1e-6f) ? 1.0f / std::sqrt(sqr_gl) : 0.0f;
+		return {g.x * inv_gl, g.y * inv_gl, g.z * inv_gl};
+	}
+}
+
+template <class T>
+void polygonize
+(
+	std::span<const f32> isolevels,
+	const volume& source,
+	u32 thread_count,
+	std::span<mesh> meshes
+)
+{
+	const std::size_t level_count = isolevels.size();
+	std::vector<slab> slabs;
+	polygonize_slabs<T>(isolevels, source, thread_count, ~u32{0}, slabs, nullptr);
+	
+	// Determine offsets of the slabs in the vertex and triangle lists of their isosurface
+	std::vector<std::size_t> vertex_offsets(slabs.size());
+	std::vector<std::size_t> triangle_offsets(slabs.size());
+	for (std::size_t l = 0; l < level_count; ++l)
+	{
+		std::size_t vertex_count = meshes[l].vertices.size();
+		std::size_t triangle_count = meshes[l].triangles.size();
+		for (std::size_t i = l; i < slabs.size(); i += level_count)
+		{
+			vertex_offsets[i] = vertex_count;
+			triangle_offsets[i] = triangle_count;
+			vertex_count += slabs[i].vertices.size();
+			triangle_count += slabs[i].triangles.size();
+		}
+		meshes[l].vertices.resize(vertex_count);
+		meshes[l].triangles.resize(triangle_count);
+	}
+	
+	// Determine the vertex base of each slab. Slabs reference their own vertices and those of the preceding slab, which together number fewer than 2^32, so the vertices of the preceding slab serve as the base of large isosurfaces
+	std::vector<u64> vertex_bases(slabs.size());
+	for (std::size_t l = 0; l < level_count; ++l)
+	{
+		auto& m = meshes[l];
+		const bool large = m.vertices.size() > u64{1} << 32 || std::ranges::any_of(m.chunks, [](const auto& chunk) { return chunk.vertex_base != 0; });
+		for (std::size_t i = l; i < slabs.size(); i += level_count)
+		{
+			if (large)
+			{
+				vertex_bases[i] = i >= level_count ? vertex_offsets[i - level_count] : vertex_offsets[i];
+			}
+			
+			// Merge the triangles of the slab into the last chunk if they share a vertex base
+			if (!m.chunks.empty() && m.chunks.back().vertex_base == vertex_bases[i])
+			{
+				m.chunks.back().triangle_count += slabs[i].triangles.size();
+			}
+			else if (!slabs[i].triangles.empty() || m.chunks.empty())
+			{
+				m.chunks.emplace_back(slabs[i].triangles.size(), vertex_bases[i]);
+			}
+		}
+	}
+	
+	// Stitch slabs together, resolving references to edge vertices owned by preceding slabs
+	parallel_for
+	(
+		slabs.size(),
+		thread_count,
+		[&](std::size_t i)
+		{
+			auto& s = slabs[i];
+			auto& m = meshes[i % level_count];
+			
+			const slab* preceding = i >= level_count ? &slabs[i - level_count] : nullptr;
+			const u64 offset = vertex_offsets[i] - vertex_bases[i];
+			const u64 preceding_offset = preceding ? vertex_offsets[i - level_count] - vertex_bases[i] : 0;
+			
+			// Copy slab geometry into the pages of the isosurface, which are committed to memory as the slab geometry is freed
+			std::size_t vertex_index = vertex_offsets[i];
+			s.vertices.for_each_span
+			(
+				0,
+				s.vertices.size(),
+				[&](std::span<const vertex> vertices)
+				{
+					for (const auto& v: vertices)
+					{
+						m.vertices[vertex_index++] = v;
+					}
+				}
+			);
+			std::size_t triangle_index = triangle_offsets[i];
+			s.triangles.for_each_span
+			(
+				0,
+				s.triangles.size(),
+				[&](std::span<const triangle> triangles)
+				{
+					for (const auto& t: triangles)
+					{
+						m.triangles[triangle_index++] = {resolve_vertex(t.a, offset, preceding, preceding_offset), resolve_vertex(t.b, offset, preceding, preceding_offset), resolve_vertex(t.c, offset, preceding, preceding_offset)};
+					}
+				}
+			);
+			
+			// Free slab geometry
+			s.vertices = {};
+			s.triangles = {};
+		}
+	);
+}
+
+template <class T>
+void polygonize
+(
+	std::span<const f32> isolevels,
+	const volume& source,
+	u32 thread_count,
+	std::span<mesh_stream> streams
+)
+{
+	const std::size_t level_count = isolevels.size();
+	std::vector<slab> slabs;
+	
+	// Slabs which are complete but not yet written, the index of the next slab to write, and the number of slabs which may be held ahead of it
+	std::mutex mutex;
+	std::condition_variable condition;
+	std::set<std::size_t> finished_slabs;
+	std::size_t next_slab = 0;
+	const std::size_t slab_window = std::size_t{thread_count} * 2;
+	bool extracted = false;
+	bool failed = false;
+	std::exception_ptr write_exception;
+	
+	// Vertex offsets of the slabs preceding the next slab to write, in each isosurface
+	std::vector<u64> vertex_offsets(level_count);
+	std::vector<u64> preceding_offsets(level_count);
+	
+	// Writes a complete slab, resolving references to edge vertices owned by the preceding slab, which is thereafter no longer referenced.
+	auto write_slab = [&](std::size_t i)
+	{
+		for (std::size_t l = 0; l < level_count; ++l)
 		{
-			// Calculate Y-coordinates of the cube vertices
-			for (u32 i = 0; i < 8; ++i)
+			auto& s = slabs[i * level_count + l];
+			slab* preceding = i ? &slabs[(i - 1) * level_count + l] : nullptr;
+			const u64 vertex_base = preceding ? preceding_offsets[l] : vertex_offsets[l];
+			const u64 offset = vertex_offsets[l] - vertex_base;
+			
+			for (std::size_t j = 0; j < s.triangles.size(); ++j)
 			{
-				cube_vertices[i].y = y + ((cube_offsets >> (i + 8)) & 1);
-				transformed_cube_vertices[i].y = static_cast<f32>(cube_vertices[i].y) * scale.y + translation.y;
+				auto& t = s.triangles[j];
+				t = {resolve_vertex(t.a, offset, preceding, 0), resolve_vertex(t.b, offset, preceding, 0), resolve_vertex(t.c, offset, preceding, 0)};
 			}
 			
-			for (u32 x = 0; x < max.x; ++x)
+			const std::size_t vertex_count = s.vertices.size();
+			const std::size_t triangle_count = s.triangles.size();
+			mesh part{std::move(s.vertices), std::move(s.triangles), {{triangle_count, vertex_base}}};
+			streams[l].write(std::move(part));
+			streams[l].vertex_count += vertex_count;
+			streams[l].triangle_count += triangle_count;
+			
+			if (preceding)
+			{
+				preceding->boundary_vertices = {};
+			}
+			preceding_offsets[l] = vertex_offsets[l];
+			vertex_offsets[l] += vertex_count;
+		}
+	};
+	
+	// Write slabs in order on a separate thread, overlapping output with extraction
+	std::jthread writer
+	(
+		[&]()
+		{
+			std::unique_lock lock(mutex);
+			while (true)
 			{
-				const auto base_vertex_index = x + width * (y + height * z);
+				condition.wait(lock, [&]() { return finished_slabs.contains(next_slab) || extracted || failed; });
+				if (!finished_slabs.contains(next_slab))
+				{
+					break;
+				}
+				finished_slabs.erase(next_slab);
 				
-				// Determine cube configuration
-				u32 cube_config = 0;
-				for (u32 i = 0; i < 8; ++i)
+				lock.unlock();
+				try
 				{
-					const auto value = voxel_cache[(base_vertex_index + offsets[i]) % voxel_cache_size];
-					cube_config |= (value < isolevel) << i;
+					write_slab(next_slab);
 				}
+				catch (...)
+				{
+					lock.lock();
+					write_exception = std::current_exception();
+					condition.notify_all();
+					break;
+				}
+				lock.lock();
 				
-				// Skip cubes not intersected by the isosurface
-				const auto edge_case = edge_table[cube_config];
-				if (!edge_case)
+				++next_slab;
+				condition.notify_all();
+			}
+		}
+	);
+	
+	// Extract slabs, holding back threads which get too far ahead of the writer such that memory usage stays bounded. Slabs are dispensed in ascending order, so the next slab to write is always in progress or complete
+	try
+	{
+		polygonize_slabs<T>
+		(
+			isolevels,
+			source,
+			thread_count,
+			brick_index::brick_size,
+			slabs,
+			[&](std::size_t i, bool complete)
+			{
+				std::unique_lock lock(mutex);
+				if (!complete)
+				{
+					failed = true;
+					condition.notify_all();
+					return;
+				}
+				
+				finished_slabs.insert(i);
+				condition.notify_all();
+				condition.wait(lock, [&]() { return i < next_slab + slab_window || write_exception || failed; });
+				if (write_exception)
+				{
+					std::rethrow_exception(write_exception);
+				}
+			}
+		);
+	}
+	catch (...)
+	{
+		{
+			std::lock_guard lock(mutex);
+			extracted = true;
+		}
+		condition.notify_all();
+		writer.join();
+		throw;
+	}
+	
+	// Wait for the writer to finish
+	{
+		std::lock_guard lock(mutex);
+		extracted = true;
+	}
+	condition.notify_all();
+	writer.join();
+	if (write_exception)
+	{
+		std::rethrow_exception(write_exception);
+	}
+}
+
+template <class T>
+void polygonize_flying_edges
+(
+	std::span<const f32> isolevels,
+	const volume& source,
+	u32 thread_count,
+	std::span<mesh> meshes
+)
+{
+	const u32 width = source.width;
+	const u32 height = source.height;
+	const u32 depth = source.depth;
+	const u32vec3 max{std::max(width, 1u) - 1, std::max(height, 1u) - 1, std::max(depth, 1u) - 1};
+	const std::size_t z_stride = std::size_t{width} * height;
+	const std::size_t level_count = isolevels.size();
+	if (!level_count || !max.x || !max.y || !max.z)
+	{
+		return;
+	}
+	
+	// Vertices of two Z-layers of grid points, and triangles of a Z-layer of cubes, must be indexable relative to a common base with 32-bit indices
+	if (z_stride * 6 > boundary_vertex_flag)
+	{
+		throw std::runtime_error("Z-slices too large");
+	}
+	
+	const auto [grid_scale, grid_translation] = source.grid_transform();
+	const f32vec3 scale = {grid_scale, grid_scale, grid_scale};
+	const f32vec3 translation = {grid_translation, grid_translation, grid_translation};
+	
+	// Intersected edges of each row of grid points, triangle counts of each row of cubes, and vertex and triangle offsets of each Z-layer, for each isolevel
+	std::vector<edge_row> edge_rows(std::size_t{height} * depth * level_count);
+	std::vector<u32> cube_rows(std::size_t{max.y} * max.z * level_count);
+	std::vector<u64> layer_vertex_offsets(std::size_t{depth} * level_count);
+	std::vector<u64> layer_triangle_offsets(std::size_t{max.z} * level_count);
+	
+	// Fetches the intersected edges of a row of grid points, given an isolevel index and Y- and Z-coordinates.
+	auto get_edge_row = [&](std::size_t l, u32 y, u32 z) -> edge_row&
+	{
+		return edge_rows[y + height * (z + std::size_t{depth} * l)];
+	};
+	
+	// Fetches the triangle count, and later the triangle offset within its Z-layer, of a row of cubes, given an isolevel index and Y- and Z-coordinates.
+	auto get_cube_row = [&](std::size_t l, u32 y, u32 z) -> u32&
+	{
+		return cube_rows[y + max.y * (z + std::size_t{max.z} * l)];
+	};
+	
+	// Split the grid into Z-slabs, several per thread to balance uneven workloads. The last slab also owns the last Z-layer of grid points
+	const u32 slab_count = std::max(std::min(max.z, thread_count > 1 ? thread_count * 4 : 1), 1u);
+	auto get_slab_bounds = [&](std::size_t i) -> std::pair<u32, u32>
+	{
+		return {static_cast<u32>(u64{max.z} * i / slab_count), static_cast<u32>(u64{max.z} * (i + 1) / slab_count)};
+	};
+	
+	// First pass: count the intersected edges of each row of grid points, and the triangles of each row of cubes
+	parallel_for
+	(
+		slab_count,
+		thread_count,
+		[&](std::size_t i)
+		{
+			const auto [z_begin, z_end] = get_slab_bounds(i);
+			slice_window<T> window(isolevels, source, z_end);
+			const u32 word_count = window.word_count();
+			std::vector<active_cube> active_cubes;
+			active_cubes.reserve(max.x);
+			u64 active_cube_count = 0;
+			
+			window.cache(z_begin);
+			for (u32 z = z_begin; z <= z_end; ++z)
+			{
+				if (z < z_end)
+				{
+					window.cache(z + 1);
+				}
+				else if (z_end < max.z)
 				{
-					continue;
+					break;
 				}
 				
-				// For each cube edge
-				u32 vertex_indices[12];
-				for (u32 i = 0; i < 12; ++i)
+				for (std::size_t l = 0; l < level_count; ++l)
 				{
-					// Disregard edges not intersected by the isosurface
-					if (!(edge_case & (1 << i)))
+					for (u32 y = 0; y < height; ++y)
 					{
-						continue;
+						const u64* row = window.mask_row(l, y, z);
+						const u64* next_row = y < max.y ? window.mask_row(l, y + 1, z) : nullptr;
+						const u64* upper_row = z < max.z ? window.mask_row(l, y, z + 1) : nullptr;
+						
+						edge_row& edges = get_edge_row(l, y, z);
+						edges = {0, 0, 0, 0};
+						for (u32 w = 0; w < word_count; ++w)
+						{
+							edges.x_count += static_cast<u32>(std::popcount(find_x_edges(row, w, word_count, max.x)));
+							if (next_row)
+							{
+								edges.y_count += static_cast<u32>(std::popcount(row[w] ^ next_row[w]));
+							}
+							if (upper_row)
+							{
+								edges.z_count += static_cast<u32>(std::popcount(row[w] ^ upper_row[w]));
+							}
+						}
+						
+						if (y < max.y && z < max.z)
+						{
+							const u64* const mask_rows[4] = {row, next_row, upper_row, window.mask_row(l, y + 1, z + 1)};
+							find_active_cubes(mask_rows, word_count, max.x, nullptr, active_cubes);
+							active_cube_count += active_cubes.size();
+							
+							u32 triangle_count = 0;
+							for (const auto& cube: active_cubes)
+							{
+								triangle_count += triangle_counts[cube.config];
+							}
+							get_cube_row(l, y, z) = triangle_count;
+						}
 					}
+				}
+			}
+			
+			count_cubes(u64{max.x} * max.y * (z_end - z_begin) * level_count, active_cube_count);
+		}
+	);
+	
+	// Prefix-sum the counts into the offsets of each row within its Z-layer, and of each Z-layer within its isosurface, then size each isosurface exactly
+	std::vector<u8> large(level_count);
+	for (std::size_t l = 0; l < level_count; ++l)
+	{
+		auto& m = meshes[l];
+		
+		u64 vertex_count = m.vertices.size();
+		for (u32 z = 0; z < depth; ++z)
+		{
+			layer_vertex_offsets[depth * l + z] = vertex_count;
+			u32 offset = 0;
+			for (u32 y = 0; y < height; ++y)
+			{
+				edge_row& edges = get_edge_row(l, y, z);
+				edges.offset = offset;
+				offset += edges.x_count + edges.y_count + edges.z_count;
+			}
+			vertex_count += offset;
+		}
+		
+		u64 triangle_count = m.triangles.size();
+		for (u32 z = 0; z < max.z; ++z)
+		{
+			layer_triangle_offsets[max.z * l + z] = triangle_count;
+			u32 offset = 0;
+			for (u32 y = 0; y < max.y; ++y)
+			{
+				u32& cube_row = get_cube_row(l, y, z);
+				offset += std::exchange(cube_row, offset);
+			}
+			triangle_count += offset;
+		}
+		
+		m.vertices.resize(static_cast<std::size_t>(vertex_count));
+		m.triangles.resize(static_cast<std::size_t>(triangle_count));
+		
+		// Each Z-layer of cubes references vertices of two Z-layers of grid points, which together number fewer than 2^32, so the first of them serves as the vertex base of the Z-layer in large isosurfaces
+		large[l] = m.vertices.size() > u64{1} << 32 || std::ranges::any_of(m.chunks, [](const auto& chunk) { return chunk.vertex_base != 0; });
+		for (u32 z = 0; z < max.z; ++z)
+		{
+			const u64 vertex_base = large[l] ? layer_vertex_offsets[depth * l + z] : 0;
+			const std::size_t layer_triangle_count = static_cast<std::size_t>((z + 1 < max.z ? layer_triangle_offsets[max.z * l + z + 1] : triangle_count) - layer_triangle_offsets[max.z * l + z]);
+			
+			// Merge the triangles of the Z-layer into the last chunk if they share a vertex base
+			if (!m.chunks.empty() && m.chunks.back().vertex_base == vertex_base)
+			{
+				m.chunks.back().triangle_count += layer_triangle_count;
+			}
+			else if (layer_triangle_count || m.chunks.empty())
+			{
+				m.chunks.emplace_back(layer_triangle_count, vertex_base);
+			}
+		}
+	}
+	
+	// Second pass: generate the vertices of each row of grid points and the triangles of each row of cubes directly at their offsets in the isosurfaces
+	parallel_for
+	(
+		slab_count,
+		thread_count,
+		[&](std::size_t i)
+		{
+			const auto [z_begin, z_end] = get_slab_bounds(i);
+			slice_window<T> window(isolevels, source, std::min(z_end + 1, depth - 1));
+			const u32 word_count = window.word_count();
+			std::vector<active_cube> active_cubes;
+			active_cubes.reserve(max.x);
+			
+			// Constructs the vertex at which an isosurface intersects the edge between two grid points.
+			auto make_vertex = [&](f32 isolevel, const u32vec3& a, const u32vec3& b) -> vertex
+			{
+				vertex v;
+				f32vec3 g;
+				interpolate_edge(window, isolevel, a, b, scale, translation, v.p, g);
+				v.n = normalize_gradient(g);
+				return v;
+			};
+			
+			// Generates the vertices of the intersected edges owned by the rows of grid points in a Z-layer.
+			auto generate_vertices = [&](u32 z)
+			{
+				for (std::size_t l = 0; l < level_count; ++l)
+				{
+					const f32 isolevel = isolevels[l];
+					auto& vertices = meshes[l].vertices;
 					
-					// Determine indices of cube vertices that form the edge
-					const u32 v1 = (edge_vertices_a >> (i << 2)) & 0b111;
-					const u32 v2 = (edge_vertices_b >> (i << 2)) & 0b111;
-					const auto v1_index = base_vertex_index + offsets[v1];
-					const auto v2_index = base_vertex_index + offsets[v2];
-					
-					// Fetch cached edge vertex with edge key
-					const auto edge_key = (v1_index % vertex_cache_capacity) * 3 + ((edge_directions >> (i << 1)) & 0b11);
-					auto& cached_vertex = vertex_cache[edge_key];
-					
-					// Reuse cached edge vertex if not invalid or expired
-					if (cached_vertex != ~u32{0} && vertices[cached_vertex].p.z >= min_cached_vertex_z)
+					for (u32 y = 0; y < height; ++y)
 					{
-						vertex_indices[i] = cached_vertex;
-						continue;
+						const edge_row& edges = get_edge_row(l, y, z);
+						if (!edges.x_count && !edges.y_count && !edges.z_count)
+						{
+							continue;
+						}
+						
+						const u64* row = window.mask_row(l, y, z);
+						std::size_t vertex_index = static_cast<std::size_t>(layer_vertex_offsets[depth * l + z] + edges.offset);
+						
+						// Generates a vertex for each set bit of an edge bitmask word, given the offset from each grid point to the other end of its edge.
+						auto generate_edge_vertices = [&](u32 w, u64 bits, const u32vec3& offset)
+						{
+							while (bits)
+							{
+								const u32 x = (w << 6) + static_cast<u32>(std::countr_zero(bits));
+								bits &= bits - 1;
+								vertices[vertex_index++] = make_vertex(isolevel, {x, y, z}, {x + offset.x, y + offset.y, z + offset.z});
+							}
+						};
+						
+						for (u32 w = 0; edges.x_count && w < word_count; ++w)
+						{
+							generate_edge_vertices(w, find_x_edges(row, w, word_count, max.x), {1, 0, 0});
+						}
+						
+						if (edges.y_count)
+						{
+							const u64* next_row = window.mask_row(l, y + 1, z);
+							for (u32 w = 0; w < word_count; ++w)
+							{
+								generate_edge_vertices(w, row[w] ^ next_row[w], {0, 1, 0});
+							}
+						}
+						
+						if (edges.z_count)
+						{
+							const u64* upper_row = window.mask_row(l, y, z + 1);
+							for (u32 w = 0; w < word_count; ++w)
+							{
+								generate_edge_vertices(w, row[w] ^ upper_row[w], {0, 0, 1});
+							}
+						}
 					}
+				}
+			};
+			
+			// Generates the triangles of the rows of cubes in a Z-layer.
+			auto generate_triangles = [&](u32 z)
+			{
+				for (std::size_t l = 0; l < level_count; ++l)
+				{
+					auto& triangles = meshes[l].triangles;
+					const u64 vertex_base = large[l] ? layer_vertex_offsets[depth * l + z] : 0;
 					
-					// Valid cached edge vertex not found, cache a new edge vertex
-					cached_vertex = static_cast<u32>(vertices.size());
-					vertex_indices[i] = cached_vertex;
-					
-					// Calculate X-coordinates of the cube vertices
-					cube_vertices[v1].x = x + ((cube_offsets >> v1) & 1);
-					cube_vertices[v2].x = x + ((cube_offsets >> v2) & 1);
-					transformed_cube_vertices[v1].x = static_cast<f32>(cube_vertices[v1].x) * scale.x + translation.x;
-					transformed_cube_vertices[v2].x = static_cast<f32>(cube_vertices[v2].x) * scale.x + translation.x;
-					
-					// Get transformed edge vertex positions
-					const auto& p1 = transformed_cube_vertices[v1];
-					const auto& p2 = transformed_cube_vertices[v2];
-					
-					// Fetch voxel values from voxel cache
-					const auto voxel1 = voxel_cache[v1_index % voxel_cache_size];
-					const auto voxel2 = voxel_cache[v2_index % voxel_cache_size];
-					
-					// Calculate interpolation factor between edge endpoints
-					const f32 t = std::abs(voxel1 - voxel2) < 1e-6 ? 0.5f : (isolevel - voxel1) / (voxel2 - voxel1);
-					
-					// Construct new vertex between edge endpoints
-					vertex v;
-					v.p = {(p2.x - p1.x) * t + p1.x, (p2.y - p1.y) * t + p1.y, (p2.z - p1.z) * t + p1.z};
-					
-					// Interpolate between isofield gradients at edge endpoints
-					const auto g1 = get_gradient(cube_vertices[v1].x, cube_vertices[v1].y, cube_vertices[v1].z);
-					const auto g2 = get_gradient(cube_vertices[v2].x, cube_vertices[v2].y, cube_vertices[v2].z);
-					const f32vec3 g = {(g2.x - g1.x) * t + g1.x, (g2.y - g1.y) * t + g1.y, (g2.z - g1.z) * t + g1.z};
-					
-					// Calculate vertex normal from normalized interpolated gradient
-					const f32 sqr_gl = g.x * g.x + g.y * g.y + g.z * g.z;
-					const f32 inv_gl = (sqr_gl > 1e-6f) ? 1.0f / std::sqrt(sqr_gl) : 0.0f;
-					v.n = {g.x * inv_gl, g.y * inv_gl, g.z * inv_gl};
-					
-					// Add vertex to isosurface vertex list
-					vertices.emplace_back(std::move(v));
+					for (u32 y = 0; y < max.y; ++y)
+					{
+						// Rows of grid points at the cube vertices, in (y, z), (y + 1, z), (y, z + 1), (y + 1, z + 1) order
+						const edge_row* const edges[4] = {&get_edge_row(l, y, z), &get_edge_row(l, y + 1, z), &get_edge_row(l, y, z + 1), &get_edge_row(l, y + 1, z + 1)};
+						if (!edges[0]->x_count && !edges[1]->x_count && !edges[2]->x_count && !edges[3]->x_count && !edges[0]->y_count && !edges[2]->y_count && !edges[0]->z_count && !edges[1]->z_count)
+						{
+							continue;
+						}
+						
+						const u64* const mask_rows[4] = {window.mask_row(l, y, z), window.mask_row(l, y + 1, z), window.mask_row(l, y, z + 1), window.mask_row(l, y + 1, z + 1)};
+						find_active_cubes(mask_rows, word_count, max.x, nullptr, active_cubes);
+						
+						// Indices of the first vertex of each row of grid points, relative to the vertex base
+						u64 firsts[4];
+						for (u32 r = 0; r < 4; ++r)
+						{
+							firsts[r] = layer_vertex_offsets[depth * l + z + (r >> 1)] + edges[r]->offset - vertex_base;
+						}
+						
+						// Edge bitmasks of the current word, and numbers of intersected edges preceding the word, of the X-edges of each row, the Y-edges of the rows at `y`, and the Z-edges of the rows at `z`
+						u64 edge_words[8];
+						u32 preceding[8] = {};
+						u32 current_word = 0;
+						auto find_edge_words = [&](u32 w)
+						{
+							for (u32 r = 0; r < 4; ++r)
+							{
+								edge_words[r] = find_x_edges(mask_rows[r], w, word_count, max.x);
+							}
+							edge_words[4] = mask_rows[0][w] ^ mask_rows[1][w];
+							edge_words[5] = mask_rows[2][w] ^ mask_rows[3][w];
+							edge_words[6] = mask_rows[0][w] ^ mask_rows[2][w];
+							edge_words[7] = mask_rows[1][w] ^ mask_rows[3][w];
+						};
+						find_edge_words(0);
+						
+						std::size_t triangle_index = static_cast<std::size_t>(layer_triangle_offsets[max.z * l + z] + get_cube_row(l, y, z));
+						for (const auto [x, cube_config]: active_cubes)
+						{
+							// Advance to the word of the cube, counting the intersected edges of the words passed over
+							const u32 w = x >> 6;
+							for (; current_word < w; find_edge_words(++current_word))
+							{
+								for (u32 k = 0; k < 8; ++k)
+								{
+									preceding[k] += static_cast<u32>(std::popcount(edge_words[k]));
+								}
+							}
+							
+							// Rank each edge bitmask at the cube and at its successor along the X-axis
+							const u32 bit = x & 63;
+							u64 ranks[8];
+							u64 next_ranks[8];
+							for (u32 k = 0; k < 8; ++k)
+							{
+								ranks[k] = preceding[k] + static_cast<u32>(std::popcount(edge_words[k] & ((u64{1} << bit) - 1)));
+								next_ranks[k] = ranks[k] + ((edge_words[k] >> bit) & 1);
+							}
+							
+							// Map cube edges to the vertices of the edges owned by each row
+							const u64 y_edges[2] = {firsts[0] + edges[0]->x_count, firsts[2] + edges[2]->x_count};
+							const u64 z_edges[2] = {y_edges[0] + edges[0]->y_count, firsts[1] + edges[1]->x_count + edges[1]->y_count};
+							const u64 vertex_indices[12] =
+							{
+								firsts[0] + ranks[0],
+								y_edges[0] + next_ranks[4],
+								firsts[1] + ranks[1],
+								y_edges[0] + ranks[4],
+								firsts[2] + ranks[2],
+								y_edges[1] + next_ranks[5],
+								firsts[3] + ranks[3],
+								y_edges[1] + ranks[5],
+								z_edges[0] + ranks[6],
+								z_edges[0] + next_ranks[6],
+								z_edges[1] + next_ranks[7],
+								z_edges[1] + ranks[7]
+							};
+							
+							// Generate triangles
+							for (auto triangulation = triangle_table[cube_config]; (triangulation & 0xf) != 0xf; triangulation >>= 12)
+							{
+								triangles[triangle_index++] =
+								{
+									static_cast<u32>(vertex_indices[triangulation & 0xf]),
+									static_cast<u32>(vertex_indices[(triangulation >> 4) & 0xf]),
+									static_cast<u32>(vertex_indices[(triangulation >> 8) & 0xf])
+								};
+							}
+						}
+					}
+				}
+			};
+			
+			// Cache voxels in the first two Z-slices of the slab, and in the preceding Z-slice for gradients
+			if (z_begin)
+			{
+				window.cache(z_begin - 1);
+			}
+			window.cache(z_begin);
+			window.cache(z_begin + 1);
+			
+			// Loop through the slab, and through the last Z-layer of grid points if the slab owns it
+			for (u32 z = z_begin; z < z_end || (z == z_end && z_end == max.z); ++z)
+			{
+				if (z < z_end && z + 2 < depth)
+				{
+					window.cache(z + 2);
 				}
 				
-				// Generate triangles
-				auto triangulation = triangle_table[cube_config];
-				for (int i = 0; (triangulation & 0xf) != 0xf && i < 15; i += 3)
-				{
-					const auto a = vertex_indices[triangulation & 0xf];
-					const auto b = vertex_indices[(triangulation >> 4) & 0xf];
-					const auto c = vertex_indices[(triangulation >> 8) & 0xf];
-					triangulation >>= 12;
-					
-					// If triangle is not degenerate
-					if (a != b && a != c && b != c)
+				generate_vertices(z);
+				if (z < z_end)
+				{
+					generate_triangles(z);
+				}
+			}
+		}
+	);
+}
+
+template <class T>
+void polygonize_surface_nets
+(
+	std::span<const f32> isolevels,
+	const volume& source,
+	u32 thread_count,
+	std::span<mesh> meshes
+)
+{
+	const u32 width = source.width;
+	const u32 height = source.height;
+	const u32 depth = source.depth;
+	const u32vec3 max{std::max(width, 1u) - 1, std::max(height, 1u) - 1, std::max(depth, 1u) - 1};
+	const std::size_t z_stride = std::size_t{width} * height;
+	const std::size_t level_count = isolevels.size();
+	if (!level_count || !max.x || !max.y || !max.z)
+	{
+		return;
+	}
+	
+	// Vertices of two Z-layers of cubes, and triangles of a Z-layer of grid points, must be indexable relative to a common base with 32-bit indices
+	if (z_stride * 6 > boundary_vertex_flag)
+	{
+		throw std::runtime_error("Z-slices too large");
+	}
+	
+	const auto [grid_scale, grid_translation] = source.grid_transform();
+	const f32vec3 scale = {grid_scale, grid_scale, grid_scale};
+	const f32vec3 translation = {grid_translation, grid_translation, grid_translation};
+	
+	// Active cubes of each row of cubes, and quads of the intersected edges owned by each row of grid points, for each isolevel. Only grid points with cubes on all sides of an edge own a quad, so the grid rows which own quads are indexed like rows of cubes
+	std::vector<row_span> cube_rows(std::size_t{max.y} * max.z * level_count);
+	std::vector<row_span> quad_rows(std::size_t{max.y} * max.z * level_count);
+	std::vector<u64> layer_vertex_offsets(std::size_t{max.z} * level_count);
+	std::vector<u64> layer_triangle_offsets(std::size_t{max.z} * level_count);
+	
+	// Fetches a row of cubes or of grid points, given an isolevel index and Y- and Z-coordinates.
+	auto get_row = [&](std::vector<row_span>& rows, std::size_t l, u32 y, u32 z) -> row_span&
+	{
+		return rows[y + max.y * (z + std::size_t{max.z} * l)];
+	};
+	
+	// Returns the bits of a bitmask word which belong to grid points with cubes on both sides along the X-axis.
+	auto interior_bits = [&](u32 w) -> u64
+	{
+		u64 bits = w ? ~u64{0} : ~u64{1};
+		const u32 first = w << 6;
+		if (max.x - first < 64)
+		{
+			bits &= (u64{1} << (max.x - first)) - 1;
+		}
+		return bits;
+	};
+	
+	// Finds the bitmask words of the edges which own quads in a row of grid points, given the classification bitmasks of the row, of the next row along the Y-axis, and of the next row along the Z-axis.
+	auto find_quad_edges = [&](u32 w, u32 word_count, u32 y, u32 z, const u64* row, const u64* next_row, const u64* upper_row, u64 (&edges)[3])
+	{
+		edges[0] = y && z ? find_x_edges(row, w, word_count, max.x) : 0;
+		edges[1] = z ? (row[w] ^ next_row[w]) & interior_bits(w) : 0;
+		edges[2] = y ? (row[w] ^ upper_row[w]) & interior_bits(w) : 0;
+	};
+	
+	// Split the grid into Z-slabs, several per thread to balance uneven workloads
+	const u32 slab_count = std::max(std::min(max.z, thread_count > 1 ? thread_count * 4 : 1), 1u);
+	auto get_slab_bounds = [&](std::size_t i) -> std::pair<u32, u32>
+	{
+		return {static_cast<u32>(u64{max.z} * i / slab_count), static_cast<u32>(u64{max.z} * (i + 1) / slab_count)};
+	};
+	
+	// First pass: count the active cubes of each row of cubes, and the quads of each row of grid points
+	parallel_for
+	(
+		slab_count,
+		thread_count,
+		[&](std::size_t i)
+		{
+			const auto [z_begin, z_end] = get_slab_bounds(i);
+			slice_window<T> window(isolevels, source, z_end);
+			const u32 word_count = window.word_count();
+			u64 active_cube_count = 0;
+			
+			window.cache(z_begin);
+			for (u32 z = z_begin; z < z_end; ++z)
+			{
+				window.cache(z + 1);
+				
+				for (std::size_t l = 0; l < level_count; ++l)
+				{
+					for (u32 y = 0; y < max.y; ++y)
 					{
-						triangles.emplace_back(a, b, c);
+						const u64* const mask_rows[4] = {window.mask_row(l, y, z), window.mask_row(l, y + 1, z), window.mask_row(l, y, z + 1), window.mask_row(l, y + 1, z + 1)};
+						
+						u32 cube_count = 0;
+						u32 quad_count = 0;
+						for (u32 w = 0; w < word_count; ++w)
+						{
+							u64 bits[8];
+							gather_cube_bits(mask_rows, w, word_count, bits);
+							cube_count += static_cast<u32>(std::popcount(find_active_bits(bits, w, max.x)));
+							
+							u64 edges[3];
+							find_quad_edges(w, word_count, y, z, mask_rows[0], mask_rows[1], mask_rows[2], edges);
+							quad_count += static_cast<u32>(std::popcount(edges[0]) + std::popcount(edges[1]) + std::popcount(edges[2]));
+						}
+						
+						get_row(cube_rows, l, y, z) = {0, cube_count};
+						get_row(quad_rows, l, y, z) = {0, quad_count};
+						active_cube_count += cube_count;
 					}
 				}
 			}
+			
+			count_cubes(u64{max.x} * max.y * (z_end - z_begin) * level_count, active_cube_count);
+		}
+	);
+	
+	// Prefix-sum the counts into the offsets of each row within its Z-layer, and of each Z-layer within its isosurface, then size each isosurface exactly
+	std::vector<u8> large(level_count);
+	for (std::size_t l = 0; l < level_count; ++l)
+	{
+		auto& m = meshes[l];
+		
+		u64 vertex_count = m.vertices.size();
+		u64 triangle_count = m.triangles.size();
+		for (u32 z = 0; z < max.z; ++z)
+		{
+			layer_vertex_offsets[max.z * l + z] = vertex_count;
+			layer_triangle_offsets[max.z * l + z] = triangle_count;
+			u32 vertex_offset = 0;
+			u32 triangle_offset = 0;
+			for (u32 y = 0; y < max.y; ++y)
+			{
+				row_span& cubes = get_row(cube_rows, l, y, z);
+				cubes.offset = vertex_offset;
+				vertex_offset += cubes.count;
+				
+				row_span& quads = get_row(quad_rows, l, y, z);
+				quads.offset = triangle_offset;
+				triangle_offset += quads.count * 2;
+			}
+			vertex_count += vertex_offset;
+			triangle_count += triangle_offset;
 		}
 		
-		// Update minimum Z-coordinate of cached vertices
-		min_cached_vertex_z = transformed_cube_vertices[7].z;
+		m.vertices.resize(static_cast<std::size_t>(vertex_count));
+		m.triangles.resize(static_cast<std::size_t>(triangle_count));
+		
+		// Quads of a Z-layer of grid points reference the vertices of the Z-layers of cubes on either side, which together number fewer than 2^32, so the first of them serves as the vertex base of the Z-layer in large isosurfaces
+		large[l] = m.vertices.size() > u64{1} << 32 || std::ranges::any_of(m.chunks, [](const auto& chunk) { return chunk.vertex_base != 0; });
+		for (u32 z = 0; z < max.z; ++z)
+		{
+			const u64 vertex_base = large[l] ? layer_vertex_offsets[max.z * l + std::max(z, 1u) - 1] : 0;
+			const std::size_t layer_triangle_count = static_cast<std::size_t>((z + 1 < max.z ? layer_triangle_offsets[max.z * l + z + 1] : triangle_count) - layer_triangle_offsets[max.z * l + z]);
+			
+			// Merge the triangles of the Z-layer into the last chunk if they share a vertex base
+			if (!m.chunks.empty() && m.chunks.back().vertex_base == vertex_base)
+			{
+				m.chunks.back().triangle_count += layer_triangle_count;
+			}
+			else if (layer_triangle_count || m.chunks.empty())
+			{
+				m.chunks.emplace_back(layer_triangle_count, vertex_base);
+			}
+		}
+	}
+	
+	// Second pass: generate the vertex of each active cube and the quads of each row of grid points directly at their offsets in the isosurfaces
+	parallel_for
+	(
+		slab_count,
+		thread_count,
+		[&](std::size_t i)
+		{
+			const auto [z_begin, z_end] = get_slab_bounds(i);
+			slice_window<T> window(isolevels, source, std::min(z_end + 1, depth - 1));
+			const u32 word_count = window.word_count();
+			std::vector<active_cube> active_cubes;
+			active_cubes.reserve(max.x);
+			
+			// Generates the vertices of the active cubes in a Z-layer, each placed at the mean of the intersections of the isosurface with the edges of its cube.
+			auto generate_vertices = [&](u32 z)
+			{
+				for (std::size_t l = 0; l < level_count; ++l)
+				{
+					const f32 isolevel = isolevels[l];
+					auto& vertices = meshes[l].vertices;
+					
+					for (u32 y = 0; y < max.y; ++y)
+					{
+						const row_span& cubes = get_row(cube_rows, l, y, z);
+						if (!cubes.count)
+						{
+							continue;
+						}
+						
+						const u64* const mask_rows[4] = {window.mask_row(l, y, z), window.mask_row(l, y + 1, z), window.mask_row(l, y, z + 1), window.mask_row(l, y + 1, z + 1)};
+						find_active_cubes(mask_rows, word_count, max.x, nullptr, active_cubes);
+						
+						std::size_t vertex_index = static_cast<std::size_t>(layer_vertex_offsets[max.z * l + z] + cubes.offset);
+						for (const auto [x, cube_config]: active_cubes)
+						{
+							f32vec3 p_sum = {0.0f, 0.0f, 0.0f};
+							f32vec3 g_sum = {0.0f, 0.0f, 0.0f};
+							const auto edge_case = edge_table[cube_config];
+							for (u32 e = 0; e < 12; ++e)
+							{
+								if (!(edge_case & (1 << e)))
+								{
+									continue;
+								}
+								
+								const u32 v1 = (edge_vertices_a >> (e << 2)) & 0b111;
+								const u32 v2 = (edge_vertices_b >> (e << 2)) & 0b111;
+								const u32vec3 a = {x + ((cube_offsets >> v1) & 1), y + ((cube_offsets >> (v1 + 8)) & 1), z + ((cube_offsets >> (v1 + 16)) & 1)};
+								const u32vec3 b = {x + ((cube_offsets >> v2) & 1), y + ((cube_offsets >> (v2 + 8)) & 1), z + ((cube_offsets >> (v2 + 16)) & 1)};
+								
+								f32vec3 p;
+								f32vec3 g;
+								interpolate_edge(window, isolevel, a, b, scale, translation, p, g);
+								p_sum = {p_sum.x + p.x, p_sum.y + p.y, p_sum.z + p.z};
+								g_sum = {g_sum.x + g.x, g_sum.y + g.y, g_sum.z + g.z};
+							}
+							
+							const f32 inv_count = 1.0f / static_cast<f32>(std::popcount(edge_case));
+							vertex& v = vertices[vertex_index++];
+							v.p = {p_sum.x * inv_count, p_sum.y * inv_count, p_sum.z * inv_count};
+							v.n = normalize_gradient(g_sum);
+						}
+					}
+				}
+			};
+			
+			// Generates the quads of the rows of grid points in a Z-layer, each connecting the vertices of the four cubes around an intersected edge.
+			auto generate_quads = [&](u32 z)
+			{
+				for (std::size_t l = 0; l < level_count; ++l)
+				{
+					auto& triangles = meshes[l].triangles;
+					const u64 vertex_base = large[l] ? layer_vertex_offsets[max.z * l + std::max(z, 1u) - 1] : 0;
+					
+					for (u32 y = 0; y < max.y; ++y)
+					{
+						const row_span& quads = get_row(quad_rows, l, y, z);
+						if (!quads.count)
+						{
+							continue;
+						}
+						
+						// Rows of cubes around the row of grid points, in (y - 1, z - 1), (y, z - 1), (y - 1, z), (y, z) order, of which those before the first row or Z-layer are absent
+						bool present[4];
+						const u64* mask_rows[4][4];
+						u64 firsts[4];
+						for (u32 r = 0; r < 4; ++r)
+						{
+							const u32 cube_y = y + (r & 1) - 1;
+							const u32 cube_z = z + (r >> 1) - 1;
+							present[r] = (y || (r & 1)) && (z || (r >> 1));
+							if (present[r])
+							{
+								for (u32 k = 0; k < 4; ++k)
+								{
+									mask_rows[r][k] = window.mask_row(l, cube_y + (k & 1), cube_z + (k >> 1));
+								}
+								firsts[r] = layer_vertex_offsets[max.z * l + cube_z] + get_row(cube_rows, l, cube_y, cube_z).offset - vertex_base;
+							}
+						}
+						
+						const u64* row = window.mask_row(l, y, z);
+						const u64* next_row = window.mask_row(l, y + 1, z);
+						const u64* upper_row = window.mask_row(l, y, z + 1);
+						std::size_t triangle_index = static_cast<std::size_t>(layer_triangle_offsets[max.z * l + z] + quads.offset);
+						
+						// Emits a quad as two triangles, wound such that the quad faces away from the inside of the isosurface.
+						auto emit_quad = [&](u64 a, u64 b, u64 c, u64 d, bool flip)
+						{
+							if (flip)
+							{
+								std::swap(b, d);
+							}
+							triangles[triangle_index++] = {static_cast<u32>(a), static_cast<u32>(b), static_cast<u32>(c)};
+							triangles[triangle_index++] = {static_cast<u32>(a), static_cast<u32>(c), static_cast<u32>(d)};
+						};
+						
+						// Number of active cubes preceding the current word in each row of cubes
+						u64 preceding[4] = {};
+						for (u32 w = 0; w < word_count; ++w)
+						{
+							u64 active[4] = {};
+							for (u32 r = 0; r < 4; ++r)
+							{
+								if (present[r])
+								{
+									u64 bits[8];
+									gather_cube_bits(mask_rows[r], w, word_count, bits);
+									active[r] = find_active_bits(bits, w, max.x);
+								}
+							}
+							
+							// Finds the vertex of the active cube at an X-coordinate within the word in a row of cubes
+							auto find_vertex = [&](u32 r, u32 bit) -> u64
+							{
+								return firsts[r] + preceding[r] + static_cast<u64>(std::popcount(active[r] & ((u64{1} << bit) - 1)));
+							};
+							
+							u64 edges[3];
+							find_quad_edges(w, word_count, y, z, row, next_row, upper_row, edges);
+							for (u32 axis = 0; axis < 3; ++axis)
+							{
+								for (u64 bits = edges[axis]; bits; bits &= bits - 1)
+								{
+									const u32 bit = static_cast<u32>(std::countr_zero(bits));
+									const bool flip = (row[w] >> bit) & 1;
+									
+									// The cubes around an edge are ordered counterclockwise about its axis. The cube at `x - 1` is active, so it immediately precedes the cube at `x` in its row
+									if (axis == 0)
+									{
+										emit_quad(find_vertex(0, bit), find_vertex(1, bit), find_vertex(3, bit), find_vertex(2, bit), flip);
+									}
+									else if (axis == 1)
+									{
+										const u64 lower = find_vertex(1, bit);
+										const u64 upper = find_vertex(3, bit);
+										emit_quad(lower - 1, upper - 1, upper, lower, flip);
+									}
+									else
+									{
+										const u64 lower = find_vertex(2, bit);
+										const u64 upper = find_vertex(3, bit);
+										emit_quad(lower - 1, lower, upper, upper - 1, flip);
+									}
+								}
+							}
+							
+							for (u32 r = 0; r < 4; ++r)
+							{
+								preceding[r] += static_cast<u64>(std::popcount(active[r]));
+							}
+						}
+					}
+				}
+			};
+			
+			// Cache voxels in the first two Z-slices of the slab, and in the preceding Z-slice for gradients and the cubes below the slab
+			if (z_begin)
+			{
+				window.cache(z_begin - 1);
+			}
+			window.cache(z_begin);
+			window.cache(z_begin + 1);
+			
+			for (u32 z = z_begin; z < z_end; ++z)
+			{
+				if (z + 2 < depth)
+				{
+					window.cache(z + 2);
+				}
+				
+				generate_vertices(z);
+				generate_quads(z);
+			}
+		}
+	);
+	
+	// Split each quad along its shorter diagonal, once the vertices of the cubes on either side of each slab boundary have been generated
+	for (std::size_t l = 0; l < level_count; ++l)
+	{
+		auto& m = meshes[l];
+		parallel_for
+		(
+			max.z,
+			thread_count,
+			[&](std::size_t z)
+			{
+				const u64 vertex_base = large[l] ? layer_vertex_offsets[max.z * l + std::max<std::size_t>(z, 1) - 1] : 0;
+				const std::size_t first = static_cast<std::size_t>(layer_triangle_offsets[max.z * l + z]);
+				const std::size_t last = static_cast<std::size_t>(z + 1 < max.z ? layer_triangle_offsets[max.z * l + z + 1] : m.triangles.size());
+				
+				auto distance_squared = [&](u32 a, u32 b) -> f32
+				{
+					const auto& p = m.vertices[static_cast<std::size_t>(vertex_base + a)].p;
+					const auto& q = m.vertices[static_cast<std::size_t>(vertex_base + b)].p;
+					return (p.x - q.x) * (p.x - q.x) + (p.y - q.y) * (p.y - q.y) + (p.z - q.z) * (p.z - q.z);
+				};
+				
+				for (std::size_t j = first; j < last; j += 2)
+				{
+					auto& t0 = m.triangles[j];
+					auto& t1 = m.triangles[j + 1];
+					const u32 a = t0.a;
+					const u32 b = t0.b;
+					const u32 c = t0.c;
+					const u32 d = t1.c;
+					if (distance_squared(b, d) < distance_squared(a, c))
+					{
+						t0 = {a, b, d};
+						t1 = {b, c, d};
+					}
+				}
+			}
+		);
 	}
 }
+
+template void polygonize<u8>(std::span<const f32>, const volume&, u32, std::span<mesh>);
+template void polygonize<u16>(std::span<const f32>, const volume&, u32, std::span<mesh>);
+template void polygonize<i16>(std::span<const f32>, const volume&, u32, std::span<mesh>);
+template void polygonize<u32>(std::span<const f32>, const volume&, u32, std::span<mesh>);
+template void polygonize<f32>(std::span<const f32>, const volume&, u32, std::span<mesh>);
+template void polygonize<u8>(std::span<const f32>, const volume&, u32, std::span<mesh_stream>);
+template void polygonize<u16>(std::span<const f32>, const volume&, u32, std::span<mesh_stream>);
+template void polygonize<i16>(std::span<const f32>, const volume&, u32, std::span<mesh_stream>);
+template void polygonize<u32>(std::span<const f32>, const volume&, u32, std::span<mesh_stream>);
+template void polygonize<f32>(std::span<const f32>, const volume&, u32, std::span<mesh_stream>);
+template void polygonize_flying_edges<u8>(std::span<const f32>, const volume&, u32, std::span<mesh>);
+template void polygonize_flying_edges<u16>(std::span<const f32>, const volume&, u32, std::span<mesh>);
+template void polygonize_flying_edges<i16>(std::span<const f32>, const volume&, u32, std::span<mesh>);
+template void polygonize_flying_edges<u32>(std::span<const f32>, const volume&, u32, std::span<mesh>);
+template void polygonize_flying_edges<f32>(std::span<const f32>, const volume&, u32, std::span<mesh>);
+template void polygonize_surface_nets<u8>(std::span<const f32>, const volume&, u32, std::span<mesh>);
+template void polygonize_surface_nets<u16>(std::span<const f32>, const volume&, u32, std::span<mesh>);
+template void polygonize_surface_nets<i16>(std::span<const f32>, const volume&, u32, std::span<mesh>);
+template void polygonize_surface_nets<u32>(std::span<const f32>, const volume&, u32, std::span<mesh>);
+template void polygonize_surface_nets<f32>(std::span<const f32>, const volume&, u32, std::span<mesh>);
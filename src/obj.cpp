@@ -2,20 +2,176 @@
 // SPDX-License-Identifier: MIT
 
 #include "siafu.hpp"
-#include <format>
+#include <algorithm>
+#include <charconv>
+#include <fstream>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <string>
 
-void write_obj(std::ostream& file, std::span<const vertex> vertices, std::span<const triangle> triangles)
+namespace
 {
-	for (const auto& v: vertices)
+	/// Number of vertices or triangles formatted per block.
+	inline constexpr std::size_t block_size = paged_vector<vertex>::page_size;
+	
+	/// Maximum size of a formatted vertex position or normal line, in bytes.
+	inline constexpr std::size_t max_vertex_line_size = 4 + 3 * (max_float_size + 1);
+	
+	/// Maximum size of a formatted face line, in bytes.
+	inline constexpr std::size_t max_face_line_size = 2 + 3 * 44;
+	
+	/// Formats an OBJ line with a keyword and three floating-point values.
+	[[nodiscard]] inline char* format_vector(char* first, char keyword, char suffix, const f32vec3& v, u32 precision)
 	{
-		file << std::format("v {} {} {}\n", v.p.x, v.p.y, v.p.z);
+		*first++ = keyword;
+		if (suffix)
+		{
+			*first++ = suffix;
+		}
+		*first++ = ' ';
+		first = format_float(first, v.x, precision);
+		*first++ = ' ';
+		first = format_float(first, v.y, precision);
+		*first++ = ' ';
+		first = format_float(first, v.z, precision);
+		*first++ = '\n';
+		return first;
 	}
-	for (const auto& v: vertices)
+	
+	/// Formats an OBJ face line, which references the vertex position and normal with the same one-based index for each corner.
+	[[nodiscard]] inline char* format_face(char* first, u64 a, u64 b, u64 c)
 	{
-		file << std::format("vn {} {} {}\n", v.n.x, v.n.y, v.n.z);
+		*first++ = 'f';
+		for (const u64 index: {a + 1, b + 1, c + 1})
+		{
+			*first++ = ' ';
+			char* const index_first = first;
+			first = std::to_chars(first, first + 20, index).ptr;
+			const std::size_t index_size = static_cast<std::size_t>(first - index_first);
+			*first++ = '/';
+			*first++ = '/';
+			first = std::copy_n(index_first, index_size, first);
+		}
+		*first++ = '\n';
+		return first;
 	}
-	for (const auto& t: triangles)
+	
+	/// Writes OBJ vertex positions and then vertex normals.
+	void write_vertices(std::ostream& file, const paged_vector<vertex>& vertices, u32 thread_count, u32 precision)
 	{
-		file << std::format("f {0}//{0} {1}//{1} {2}//{2}\n", t.a + 1, t.b + 1, t.c + 1);
+		const std::size_t block_count = (vertices.size() + block_size - 1) / block_size;
+		for (const bool normals: {false, true})
+		{
+			write_blocks
+			(
+				file,
+				block_count,
+				thread_count,
+				[&](std::size_t block, std::string& buffer)
+				{
+					const std::size_t first_vertex = block * block_size;
+					const std::size_t count = std::min(block_size, vertices.size() - first_vertex);
+					buffer.resize(count * max_vertex_line_size);
+					
+					char* output = buffer.data();
+					vertices.for_each_span
+					(
+						first_vertex,
+						count,
+						[&](std::span<const vertex> page)
+						{
+							for (const auto& v: page)
+							{
+								output = normals ? format_vector(output, 'v', 'n', v.n, precision) : format_vector(output, 'v', '\0', v.p, precision);
+							}
+						}
+					);
+					buffer.resize(static_cast<std::size_t>(output - buffer.data()));
+				}
+			);
+		}
 	}
+	
+	/// Writes OBJ faces for the triangles of each triangle chunk.
+	void write_faces(std::ostream& file, const paged_vector<triangle>& triangles, std::span<const triangle_chunk> chunks, u32 thread_count)
+	{
+		// Find the index one past the last triangle of each chunk
+		std::vector<std::size_t> chunk_ends(chunks.size());
+		std::size_t triangle_count = 0;
+		for (std::size_t i = 0; i < chunks.size(); ++i)
+		{
+			triangle_count += chunks[i].triangle_count;
+			chunk_ends[i] = triangle_count;
+		}
+		
+		write_blocks
+		(
+			file,
+			(triangle_count + block_size - 1) / block_size,
+			thread_count,
+			[&](std::size_t block, std::string& buffer)
+			{
+				const std::size_t first_triangle = block * block_size;
+				const std::size_t count = std::min(block_size, triangle_count - first_triangle);
+				buffer.resize(count * max_face_line_size);
+				
+				char* output = buffer.data();
+				std::size_t chunk = static_cast<std::size_t>(std::ranges::upper_bound(chunk_ends, first_triangle) - chunk_ends.begin());
+				std::size_t i = first_triangle;
+				triangles.for_each_span
+				(
+					first_triangle,
+					count,
+					[&](std::span<const triangle> page)
+					{
+						for (const auto& t: page)
+						{
+							while (i >= chunk_ends[chunk])
+							{
+								++chunk;
+							}
+							const u64 vertex_base = chunks[chunk].vertex_base;
+							output = format_face(output, vertex_base + t.a, vertex_base + t.b, vertex_base + t.c);
+							++i;
+						}
+					}
+				);
+				buffer.resize(static_cast<std::size_t>(output - buffer.data()));
+			}
+		);
+	}
+}
+
+void write_obj(std::ostream& file, const mesh& model, u32 thread_count, u32 precision)
+{
+	write_vertices(file, model.vertices, thread_count, precision);
+	write_faces(file, model.triangles, model.chunks, thread_count);
+}
+
+mesh_stream stream_obj(const fs::path& path, u32 thread_count, u32 precision)
+{
+	auto file = std::make_shared<std::ofstream>(path, std::ios::binary);
+	if (!file->is_open())
+	{
+		throw std::runtime_error("failed to open output file");
+	}
+	
+	// OBJ faces may follow any vertices they reference, so each part is written as a block of vertices followed by faces
+	mesh_stream stream;
+	stream.write = [file, thread_count, precision](mesh&& part)
+	{
+		write_vertices(*file, part.vertices, thread_count, precision);
+		write_faces(*file, part.triangles, part.chunks, thread_count);
+	};
+	stream.finish = [file]()
+	{
+		file->close();
+		if (!*file)
+		{
+			throw std::runtime_error("failed to write output file");
+		}
+	};
+	
+	return stream;
 }
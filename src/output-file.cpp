@@ -0,0 +1,287 @@
+// SPDX-FileCopyrightText: 2023 C. J. Howard
+// SPDX-License-Identifier: MIT
+
+#include "siafu.hpp"
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstring>
+#include <future>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+	#define WIN32_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <windows.h>
+#else
+	#include <cerrno>
+	#include <fcntl.h>
+	#include <limits.h>
+	#include <sys/uio.h>
+	#include <unistd.h>
+#endif
+
+output_file::output_file(const fs::path& path, bool direct)
+{
+	#if defined(_WIN32)
+		// Fall back to buffered writes if unbuffered writes are unsupported
+		handle = INVALID_HANDLE_VALUE;
+		if (direct)
+		{
+			handle = CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH, nullptr);
+			direct_io = handle != INVALID_HANDLE_VALUE;
+		}
+		if (handle == INVALID_HANDLE_VALUE)
+		{
+			handle = CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+		}
+		if (handle == INVALID_HANDLE_VALUE)
+		{
+			throw std::runtime_error("failed to open output file");
+		}
+	#else
+		// Fall back to buffered writes if the file system does not support direct I/O
+		handle = -1;
+		#if defined(O_DIRECT)
+			if (direct)
+			{
+				handle = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_DIRECT, 0666);
+				direct_io = handle >= 0;
+			}
+		#endif
+		if (handle < 0)
+		{
+			handle = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+		}
+		if (handle < 0)
+		{
+			throw std::runtime_error("failed to open output file");
+		}
+	#endif
+}
+
+output_file::~output_file()
+{
+	#if defined(_WIN32)
+		CloseHandle(handle);
+	#else
+		::close(handle);
+	#endif
+}
+
+void output_file::resize(u64 size)
+{
+	#if defined(_WIN32)
+		FILE_END_OF_FILE_INFO info = {};
+		info.EndOfFile.QuadPart = static_cast<LONGLONG>(size);
+		if (!SetFileInformationByHandle(handle, FileEndOfFileInfo, &info, sizeof(info)))
+		{
+			throw std::runtime_error("failed to resize output file");
+		}
+	#else
+		if (::ftruncate(handle, static_cast<off_t>(size)))
+		{
+			throw std::runtime_error("failed to resize output file");
+		}
+	#endif
+}
+
+void output_file::write(u64 offset, std::span<const std::byte> buffer) const
+{
+	const std::span<const std::byte> buffers[1] = {buffer};
+	write(offset, buffers);
+}
+
+void output_file::write(u64 offset, std::span<const std::span<const std::byte>> buffers) const
+{
+	#if defined(_WIN32)
+		
+		// Write buffers one at a time, in chunks small enough for a DWORD byte count
+		for (auto buffer: buffers)
+		{
+			while (!buffer.empty())
+			{
+				OVERLAPPED overlapped = {};
+				overlapped.Offset = static_cast<DWORD>(offset);
+				overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+				
+				DWORD bytes_written = 0;
+				const DWORD bytes_requested = static_cast<DWORD>(std::min<std::size_t>(buffer.size(), 0x40000000));
+				if (!WriteFile(handle, buffer.data(), bytes_requested, &bytes_written, &overlapped) || !bytes_written)
+				{
+					throw std::runtime_error("failed to write output file");
+				}
+				
+				offset += bytes_written;
+				buffer = buffer.subspan(bytes_written);
+			}
+		}
+	
+	#else
+		
+		// Gather buffers into I/O vectors, in batches of at most `IOV_MAX`
+		iovec vectors[IOV_MAX];
+		while (!buffers.empty())
+		{
+			int vector_count = 0;
+			for (; vector_count < IOV_MAX && static_cast<std::size_t>(vector_count) < buffers.size(); ++vector_count)
+			{
+				vectors[vector_count] = {const_cast<std::byte*>(buffers[vector_count].data()), buffers[vector_count].size()};
+			}
+			buffers = buffers.subspan(vector_count);
+			
+			// Write vectors, resuming after partial writes
+			iovec* first_vector = vectors;
+			std::size_t remaining = 0;
+			for (;;)
+			{
+				// Skip vectors that have been written, and advance into a partially-written vector
+				while (vector_count && remaining >= first_vector->iov_len)
+				{
+					remaining -= first_vector->iov_len;
+					++first_vector;
+					--vector_count;
+				}
+				if (!vector_count)
+				{
+					break;
+				}
+				first_vector->iov_base = static_cast<std::byte*>(first_vector->iov_base) + remaining;
+				first_vector->iov_len -= remaining;
+				
+				const ssize_t bytes_written = ::pwritev(handle, first_vector, vector_count, static_cast<off_t>(offset));
+				if (bytes_written < 0 && errno == EINTR)
+				{
+					remaining = 0;
+					continue;
+				}
+				if (bytes_written <= 0)
+				{
+					throw std::runtime_error("failed to write output file");
+				}
+				
+				offset += static_cast<u64>(bytes_written);
+				remaining = static_cast<std::size_t>(bytes_written);
+			}
+		}
+	
+	#endif
+}
+
+void write_file(const fs::path& path, u64 size, u32 thread_count, bool direct, const std::function<void(u64, std::span<std::byte>)>& serialize)
+{
+	constexpr std::size_t segment_size = std::size_t{1} << 22;
+	static_assert(segment_size % output_file::direct_alignment == 0);
+	
+	// Pre-size the file, such that segments can be written at their offsets in any order
+	output_file file(path, direct);
+	file.resize(size);
+	
+	const std::size_t segment_count = static_cast<std::size_t>((size + segment_size - 1) / segment_size);
+	thread_count = static_cast<u32>(std::min<std::size_t>(std::max(thread_count, 1u), segment_count));
+	
+	// Each thread serializes segments into its own aligned staging buffer and writes them, until no segments remain
+	std::atomic<std::size_t> next_segment{0};
+	parallel_for
+	(
+		thread_count,
+		thread_count,
+		[&](std::size_t)
+		{
+			struct aligned_delete
+			{
+				void operator()(std::byte* p) const noexcept
+				{
+					::operator delete[](p, std::align_val_t{output_file::direct_alignment});
+				}
+			};
+			const std::unique_ptr<std::byte[], aligned_delete> buffer(new (std::align_val_t{output_file::direct_alignment}) std::byte[segment_size]);
+			
+			for (std::size_t i = next_segment++; i < segment_count; i = next_segment++)
+			{
+				try
+				{
+					const u64 offset = u64{i} * segment_size;
+					const std::size_t count = static_cast<std::size_t>(std::min<u64>(segment_size, size - offset));
+					serialize(offset, {buffer.get(), count});
+					
+					// Direct writes must span whole blocks, so the last segment is zero-padded and the file is truncated afterwards
+					std::size_t write_size = count;
+					if (file.is_direct())
+					{
+						write_size = (count + output_file::direct_alignment - 1) / output_file::direct_alignment * output_file::direct_alignment;
+						std::memset(buffer.get() + count, 0, write_size - count);
+					}
+					file.write(offset, {buffer.get(), write_size});
+				}
+				catch (...)
+				{
+					// Stop other threads from starting new segments
+					next_segment = segment_count;
+					throw;
+				}
+			}
+		}
+	);
+	
+	if (file.is_direct() && size % output_file::direct_alignment)
+	{
+		file.resize(size);
+	}
+}
+
+void write_blocks(std::ostream& file, std::size_t block_count, u32 thread_count, const std::function<void(std::size_t, std::string&)>& format_block)
+{
+	// Bound the memory held by formatted blocks to a few blocks per thread
+	const std::size_t batch_size = std::size_t{std::max(thread_count, 1u)} * 2;
+	std::vector<std::string> buffers[2];
+	std::future<void> pending_write;
+	
+	for (std::size_t first_block = 0, batch = 0; first_block < block_count; first_block += batch_size, ++batch)
+	{
+		auto& batch_buffers = buffers[batch % 2];
+		batch_buffers.resize(std::min(batch_size, block_count - first_block));
+		
+		parallel_for
+		(
+			batch_buffers.size(),
+			thread_count,
+			[&](std::size_t i)
+			{
+				format_block(first_block + i, batch_buffers[i]);
+			}
+		);
+		
+		// Write the batch on a separate thread while the next batch is formatted
+		if (pending_write.valid())
+		{
+			pending_write.get();
+		}
+		pending_write = std::async
+		(
+			std::launch::async,
+			[&file, &batch_buffers]()
+			{
+				for (const auto& buffer: batch_buffers)
+				{
+					file.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+				}
+			}
+		);
+	}
+	
+	if (pending_write.valid())
+	{
+		pending_write.get();
+	}
+}
+
+char* format_float(char* first, f32 value, u32 precision)
+{
+	// Nine significant digits round-trip any `f32`
+	return (precision ? std::to_chars(first, first + max_float_size, value, std::chars_format::general, std::min(precision, 9u)) : std::to_chars(first, first + max_float_size, value)).ptr;
+}
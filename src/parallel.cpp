@@ -0,0 +1,80 @@
+// SPDX-FileCopyrightText: 2023 C. J. Howard
+// SPDX-License-Identifier: MIT
+
+#include "siafu.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+void parallel_for(std::size_t count, u32 thread_count, const std::function<void(std::size_t)>& function)
+{
+	thread_count = static_cast<u32>(std::min<std::size_t>(std::max(thread_count, 1u), count));
+	
+	// Returns the time elapsed since a time point, in seconds.
+	auto seconds_since = [](std::chrono::steady_clock::time_point start) -> f64
+	{
+		return std::chrono::duration<f64>(std::chrono::steady_clock::now() - start).count();
+	};
+	const auto region_start = std::chrono::steady_clock::now();
+	
+	// Run on the calling thread if no additional threads are required
+	if (thread_count <= 1)
+	{
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			function(i);
+		}
+		
+		const f64 busy_seconds[1] = {seconds_since(region_start)};
+		count_parallel_region(busy_seconds[0], busy_seconds);
+		return;
+	}
+	
+	std::atomic<std::size_t> next_index{0};
+	std::exception_ptr exception;
+	std::mutex exception_mutex;
+	std::vector<f64> busy_seconds(thread_count);
+	
+	// Dispenses indices in ascending order until the range is exhausted or an exception is thrown, then records how long the worker ran.
+	auto worker = [&](u32 slot)
+	{
+		const auto worker_start = std::chrono::steady_clock::now();
+		for (std::size_t i = next_index++; i < count; i = next_index++)
+		{
+			try
+			{
+				function(i);
+			}
+			catch (...)
+			{
+				std::lock_guard lock(exception_mutex);
+				if (!exception)
+				{
+					exception = std::current_exception();
+				}
+				next_index = count;
+			}
+		}
+		busy_seconds[slot] = seconds_since(worker_start);
+	};
+	
+	// Launch worker threads and join them on scope exit
+	{
+		std::vector<std::jthread> threads;
+		threads.reserve(thread_count - 1);
+		for (u32 i = 1; i < thread_count; ++i)
+		{
+			threads.emplace_back(worker, i);
+		}
+		worker(0);
+	}
+	count_parallel_region(seconds_since(region_start), busy_seconds);
+	
+	if (exception)
+	{
+		std::rethrow_exception(exception);
+	}
+}
@@ -2,49 +2,342 @@
 // SPDX-License-Identifier: MIT
 
 #include "siafu.hpp"
+#include <algorithm>
 #include <bit>
+#include <cstring>
 #include <format>
+#include <fstream>
+#include <limits>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
 
-void write_ply(std::ostream& file, std::span<const vertex> vertices, std::span<const triangle> triangles)
+namespace
 {
-	// Write header
-	file << std::format
-	(
-		"ply\n"
-		"format binary_{}_endian 1.0\n"
-		"element vertex {}\n"
-		"property float x\n"
-		"property float y\n"
-		"property float z\n"
-		"property float nx\n"
-		"property float ny\n"
-		"property float nz\n"
-		"element face {}\n"
-		"property list uchar uint32 vertex_indices\n"
-		"end_header\n",
-		std::endian::native == std::endian::big ? "big" : "little",
-		vertices.size(),
-		triangles.size()
-	);
+	/**
+	 * Formats a PLY header.
+	 *
+	 * @param[in] vertex_count Number of vertices.
+	 * @param[in] triangle_count Number of triangles.
+	 * @param[in] wide_indices Whether vertex indices are 64-bit rather than 32-bit integers.
+	 * @param[in] size Size of the header, in bytes, which is reached by padding the header with a comment. If smaller than the size of the unpadded header, the header is not padded.
+	 *
+	 * @return PLY header.
+	 */
+	[[nodiscard]] std::string format_header(u64 vertex_count, u64 triangle_count, bool wide_indices, std::size_t size = 0)
+	{
+		std::string header = std::format
+		(
+			"ply\n"
+			"format binary_{}_endian 1.0\n"
+			"element vertex {}\n"
+			"property float x\n"
+			"property float y\n"
+			"property float z\n"
+			"property float nx\n"
+			"property float ny\n"
+			"property float nz\n"
+			"element face {}\n"
+			"property list uchar {} vertex_indices\n",
+			std::endian::native == std::endian::big ? "big" : "little",
+			vertex_count,
+			triangle_count,
+			wide_indices ? "uint64" : "uint32"
+		);
+		
+		constexpr std::string_view end_header = "end_header\n";
+		constexpr std::string_view comment = "comment \n";
+		if (size >= header.size() + comment.size() + end_header.size())
+		{
+			header += "comment ";
+			header.append(size - header.size() - end_header.size() - 1, ' ');
+			header += '\n';
+		}
+		header += end_header;
+		
+		return header;
+	}
+	
+	/// Size of a PLY vertex record, in bytes.
+	inline constexpr std::size_t vertex_record_size = sizeof(f32) * 6;
+	
+	/// Returns the size of a PLY face record, in bytes.
+	[[nodiscard]] inline constexpr std::size_t face_record_size(bool wide_indices) noexcept
+	{
+		return 1 + 3 * (wide_indices ? sizeof(u64) : sizeof(u32));
+	}
+	
+	/// Serializes a PLY vertex record.
+	inline void serialize_vertex(std::byte* record, const vertex& v) noexcept
+	{
+		std::memcpy(record, &v.p, sizeof(f32) * 3);
+		std::memcpy(record + sizeof(f32) * 3, &v.n, sizeof(f32) * 3);
+	}
+	
+	/// Serializes a PLY face record for a triangle whose vertex indices are relative to a vertex base.
+	inline void serialize_face(std::byte* record, const triangle& t, u64 vertex_base, bool wide_indices) noexcept
+	{
+		record[0] = std::byte{3};
+		if (wide_indices)
+		{
+			const u64 indices[3] = {vertex_base + t.a, vertex_base + t.b, vertex_base + t.c};
+			std::memcpy(record + 1, indices, sizeof(indices));
+		}
+		else
+		{
+			const u32 indices[3] = {static_cast<u32>(vertex_base + t.a), static_cast<u32>(vertex_base + t.b), static_cast<u32>(vertex_base + t.c)};
+			std::memcpy(record + 1, indices, sizeof(indices));
+		}
+	}
+	
+	/**
+	 * Serializes the fixed-size records of a section of a file which overlap a segment of the file. Records which straddle the bounds of the segment are serialized to a temporary buffer, and only their overlapping bytes are copied.
+	 *
+	 * @param[in] section_offset Offset of the section in the file, in bytes.
+	 * @param[in] record_count Number of records in the section.
+	 * @param[in] record_size Size of each record, in bytes, at most 32.
+	 * @param[in] offset Offset of the segment in the file, in bytes.
+	 * @param[out] segment Segment to fill.
+	 * @param[in] serialize_record Function which serializes a record, given its index and a pointer to its first byte. Called with ascending indices.
+	 */
+	template <class Function>
+	void serialize_section(u64 section_offset, u64 record_count, std::size_t record_size, u64 offset, std::span<std::byte> segment, Function&& serialize_record)
+	{
+		const u64 segment_end = offset + segment.size();
+		const u64 begin = std::max(offset, section_offset);
+		const u64 end = std::min(segment_end, section_offset + record_count * record_size);
+		
+		std::byte record[32];
+		for (u64 i = (begin - section_offset) / record_size, record_offset = section_offset + i * record_size; record_offset < end; ++i, record_offset += record_size)
+		{
+			if (record_offset >= offset && record_offset + record_size <= segment_end)
+			{
+				serialize_record(i, segment.data() + (record_offset - offset));
+			}
+			else
+			{
+				serialize_record(i, record);
+				const u64 first = std::max(record_offset, offset);
+				const u64 last = std::min(record_offset + record_size, segment_end);
+				std::memcpy(segment.data() + (first - offset), record + (first - record_offset), static_cast<std::size_t>(last - first));
+			}
+		}
+	}
 	
-	// Write vertex data
-	if constexpr (sizeof(vertex) == sizeof(f32) * 6)
+	/// Writes PLY vertex data, one page at a time.
+	void write_vertices(std::ostream& file, const paged_vector<vertex>& vertices)
 	{
-		file.write(reinterpret_cast<const char*>(vertices.data()), vertices.size() * sizeof(vertex));
+		std::vector<std::byte> staging_buffer;
+		vertices.for_each_span
+		(
+			0,
+			vertices.size(),
+			[&](std::span<const vertex> page)
+			{
+				if constexpr (sizeof(vertex) == vertex_record_size)
+				{
+					file.write(reinterpret_cast<const char*>(page.data()), page.size_bytes());
+				}
+				else
+				{
+					staging_buffer.resize(page.size() * vertex_record_size);
+					for (std::size_t i = 0; i < page.size(); ++i)
+					{
+						serialize_vertex(staging_buffer.data() + i * vertex_record_size, page[i]);
+					}
+					file.write(reinterpret_cast<const char*>(staging_buffer.data()), staging_buffer.size());
+				}
+			}
+		);
 	}
-	else
+	
+	/// Writes PLY face data for triangles whose vertex indices are relative to a vertex base.
+	void write_faces(std::ostream& file, std::span<const triangle> triangles, u64 vertex_base, bool wide_indices)
 	{
-		for (const auto& v: vertices)
+		const std::size_t record_size = face_record_size(wide_indices);
+		std::vector<std::byte> staging_buffer(triangles.size() * record_size);
+		for (std::size_t i = 0; i < triangles.size(); ++i)
 		{
-			file.write(reinterpret_cast<const char*>(&v.p), sizeof(f32) * 3);
-			file.write(reinterpret_cast<const char*>(&v.n), sizeof(f32) * 3);
+			serialize_face(staging_buffer.data() + i * record_size, triangles[i], vertex_base, wide_indices);
 		}
+		file.write(reinterpret_cast<const char*>(staging_buffer.data()), staging_buffer.size());
+	}
+}
+
+void write_ply(const fs::path& path, const mesh& model, u32 thread_count, bool direct)
+{
+	const auto& [vertices, triangles, chunks] = model;
+	
+	// Vertex indices are written as 32-bit integers unless the mesh has more than 2^32 vertices
+	const bool wide_indices = vertices.size() > u64{1} << 32;
+	
+	// Lay out the file as a header followed by vertex records and then face records
+	const std::string header = format_header(vertices.size(), triangles.size(), wide_indices);
+	const u64 vertices_offset = header.size();
+	const u64 faces_offset = vertices_offset + u64{vertices.size()} * vertex_record_size;
+	const std::size_t face_size = face_record_size(wide_indices);
+	const u64 file_size = faces_offset + u64{triangles.size()} * face_size;
+	
+	// Find the index one past the last triangle of each chunk
+	std::vector<std::size_t> chunk_ends(chunks.size());
+	std::size_t triangle_count = 0;
+	for (std::size_t i = 0; i < chunks.size(); ++i)
+	{
+		triangle_count += chunks[i].triangle_count;
+		chunk_ends[i] = triangle_count;
 	}
 	
-	// Write face data
-	for (const auto& t: triangles)
+	// Serialize and write segments of the file concurrently
+	write_file
+	(
+		path,
+		file_size,
+		thread_count,
+		direct,
+		[&](u64 offset, std::span<std::byte> segment)
+		{
+			// Copy header
+			if (offset < header.size())
+			{
+				const std::size_t count = std::min(segment.size(), header.size() - static_cast<std::size_t>(offset));
+				std::memcpy(segment.data(), header.data() + offset, count);
+			}
+			
+			// Serialize vertex records
+			serialize_section
+			(
+				vertices_offset,
+				vertices.size(),
+				vertex_record_size,
+				offset,
+				segment,
+				[&](u64 i, std::byte* record)
+				{
+					serialize_vertex(record, vertices[static_cast<std::size_t>(i)]);
+				}
+			);
+			
+			// Serialize face records, advancing through triangle chunks
+			std::size_t chunk = 0;
+			if (offset > faces_offset)
+			{
+				const std::size_t first_triangle = static_cast<std::size_t>((offset - faces_offset) / face_size);
+				chunk = static_cast<std::size_t>(std::ranges::upper_bound(chunk_ends, first_triangle) - chunk_ends.begin());
+			}
+			serialize_section
+			(
+				faces_offset,
+				triangles.size(),
+				face_size,
+				offset,
+				segment,
+				[&](u64 i, std::byte* record)
+				{
+					while (i >= chunk_ends[chunk])
+					{
+						++chunk;
+					}
+					serialize_face(record, triangles[static_cast<std::size_t>(i)], chunks[chunk].vertex_base, wide_indices);
+				}
+			);
+		}
+	);
+}
+
+mesh_stream stream_ply(const fs::path& path)
+{
+	// PLY stores all vertices before all faces, so vertex data is written to the file as it arrives while face data is spooled to a temporary file
+	struct state
+	{
+		std::ofstream file;
+		fs::path faces_path;
+		std::fstream faces;
+		std::vector<triangle_chunk> chunks;
+		u64 vertex_count{0};
+		u64 triangle_count{0};
+		
+		~state()
+		{
+			faces.close();
+			std::error_code error;
+			fs::remove(faces_path, error);
+		}
+	};
+	
+	auto s = std::make_shared<state>();
+	s->file.open(path, std::ios::binary);
+	s->faces_path = path;
+	s->faces_path += ".faces";
+	s->faces.open(s->faces_path, std::ios::binary | std::ios::in | std::ios::out | std::ios::trunc);
+	if (!s->file.is_open() || !s->faces.is_open())
 	{
-		file.put(3);
-		file.write(reinterpret_cast<const char*>(&t), sizeof(u32) * 3);
+		throw std::runtime_error("failed to open output file");
 	}
+	
+	// Reserve room for a header with the largest possible counts
+	const std::size_t header_size = format_header(std::numeric_limits<u64>::max(), std::numeric_limits<u64>::max(), true).size() + 9;
+	s->file << std::string(header_size, ' ');
+	
+	mesh_stream stream;
+	stream.write = [s](mesh&& part)
+	{
+		write_vertices(s->file, part.vertices);
+		s->vertex_count += part.vertices.size();
+		
+		part.triangles.for_each_span
+		(
+			0,
+			part.triangles.size(),
+			[&](std::span<const triangle> page)
+			{
+				s->faces.write(reinterpret_cast<const char*>(page.data()), page.size_bytes());
+			}
+		);
+		s->triangle_count += part.triangles.size();
+		
+		for (const auto& chunk: part.chunks)
+		{
+			if (!s->chunks.empty() && s->chunks.back().vertex_base == chunk.vertex_base)
+			{
+				s->chunks.back().triangle_count += chunk.triangle_count;
+			}
+			else
+			{
+				s->chunks.emplace_back(chunk);
+			}
+		}
+	};
+	stream.finish = [s, header_size]()
+	{
+		const bool wide_indices = s->vertex_count > u64{1} << 32;
+		
+		// Append spooled face data, one page at a time
+		s->faces.seekg(0);
+		std::vector<triangle> page(paged_vector<triangle>::page_size);
+		for (const auto& [triangle_count, vertex_base]: s->chunks)
+		{
+			for (std::size_t i = 0; i < triangle_count; i += page.size())
+			{
+				const std::size_t count = std::min(page.size(), triangle_count - i);
+				if (!s->faces.read(reinterpret_cast<char*>(page.data()), count * sizeof(triangle)))
+				{
+					throw std::runtime_error("failed to read spooled faces");
+				}
+				write_faces(s->file, std::span{page}.first(count), vertex_base, wide_indices);
+			}
+		}
+		
+		// Back-patch header
+		s->file.seekp(0);
+		s->file << format_header(s->vertex_count, s->triangle_count, wide_indices, header_size);
+		s->file.close();
+		if (!s->file)
+		{
+			throw std::runtime_error("failed to write output file");
+		}
+	};
+	
+	return stream;
 }
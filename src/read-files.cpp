@@ -0,0 +1,425 @@
+// SPDX-FileCopyrightText: 2023 C. J. Howard
+// SPDX-License-Identifier: MIT
+
+#include "siafu.hpp"
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <format>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+	#define SIAFU_IO_URING
+	#include <linux/io_uring.h>
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <sys/syscall.h>
+	#include <unistd.h>
+	#include <cerrno>
+#endif
+
+namespace
+{
+	/// First error encountered while reading a set of files.
+	struct read_error
+	{
+		std::exception_ptr exception;
+		std::mutex mutex;
+		std::atomic<bool> raised{false};
+		
+		/// Records the current exception, prefixed with the path of the file being processed, unless an error has already been recorded.
+		void raise(const fs::path& path)
+		{
+			std::lock_guard lock(mutex);
+			if (exception)
+			{
+				return;
+			}
+			
+			try
+			{
+				throw;
+			}
+			catch (const std::exception& e)
+			{
+				exception = std::make_exception_ptr(std::runtime_error(std::format("{}: {}", path.string(), e.what())));
+			}
+			catch (...)
+			{
+				exception = std::current_exception();
+			}
+			
+			raised = true;
+		}
+	};
+	
+	/// Reads whole files with a pool of threads issuing blocking reads. Each thread consumes the files it reads, so the pool is no larger than the thread count, nor than the queue depth.
+	void read_files_blocking(std::span<const fs::path> paths, u32 thread_count, u32 queue_depth, const std::function<void(std::size_t, std::span<const std::byte>)>& consume, read_error& error)
+	{
+		parallel_for
+		(
+			paths.size(),
+			std::min(thread_count, queue_depth),
+			[&](std::size_t i)
+			{
+				if (error.raised)
+				{
+					return;
+				}
+				
+				try
+				{
+					const input_file file(paths[i]);
+					std::vector<std::byte> contents(static_cast<std::size_t>(file.size()));
+					file.read(0, contents);
+					consume(i, contents);
+				}
+				catch (...)
+				{
+					error.raise(paths[i]);
+				}
+			}
+		);
+	}
+	
+	#if defined(SIAFU_IO_URING)
+	
+	/// io_uring submission and completion queues.
+	struct ring
+	{
+		int fd{-1};
+		void* sq_ring{MAP_FAILED};
+		void* cq_ring{MAP_FAILED};
+		io_uring_sqe* sqes{static_cast<io_uring_sqe*>(MAP_FAILED)};
+		std::size_t sq_ring_size{0};
+		std::size_t cq_ring_size{0};
+		std::size_t sqes_size{0};
+		io_uring_params params{};
+		
+		/// Number of submission queue entries which have not been submitted yet.
+		u32 unsubmitted{0};
+		
+		/// Returns a pointer to a field of the submission queue ring.
+		[[nodiscard]] u32* sq_field(u32 offset) const noexcept
+		{
+			return reinterpret_cast<u32*>(static_cast<std::byte*>(sq_ring) + offset);
+		}
+		
+		/// Returns a pointer to a field of the completion queue ring.
+		[[nodiscard]] u32* cq_field(u32 offset) const noexcept
+		{
+			return reinterpret_cast<u32*>(static_cast<std::byte*>(cq_ring) + offset);
+		}
+		
+		/// Sets up a ring with at least the given number of entries. Returns `false` if io_uring or the required operations are unsupported.
+		[[nodiscard]] bool setup(u32 entries) noexcept
+		{
+			fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+			if (fd < 0)
+			{
+				return false;
+			}
+			
+			// Probe for asynchronous open and read operations (Linux 5.6)
+			constexpr std::size_t probe_size = sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op);
+			alignas(io_uring_probe) std::byte probe_data[probe_size] = {};
+			auto probe = reinterpret_cast<io_uring_probe*>(probe_data);
+			if (::syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) < 0 || !(probe->ops[IORING_OP_OPENAT].flags & IO_URING_OP_SUPPORTED) || !(probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED))
+			{
+				return false;
+			}
+			
+			// Map queues
+			sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(u32);
+			cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+			if (params.features & IORING_FEAT_SINGLE_MMAP)
+			{
+				sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+			}
+			sq_ring = ::mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+			if (sq_ring == MAP_FAILED)
+			{
+				return false;
+			}
+			if (params.features & IORING_FEAT_SINGLE_MMAP)
+			{
+				cq_ring = sq_ring;
+			}
+			else
+			{
+				cq_ring = ::mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+				if (cq_ring == MAP_FAILED)
+				{
+					return false;
+				}
+			}
+			sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+			sqes = static_cast<io_uring_sqe*>(::mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+			
+			return sqes != MAP_FAILED;
+		}
+		
+		/// Unmaps the queues and closes the ring.
+		~ring()
+		{
+			if (sqes != MAP_FAILED)
+			{
+				::munmap(sqes, sqes_size);
+			}
+			if (cq_ring != MAP_FAILED && cq_ring != sq_ring)
+			{
+				::munmap(cq_ring, cq_ring_size);
+			}
+			if (sq_ring != MAP_FAILED)
+			{
+				::munmap(sq_ring, sq_ring_size);
+			}
+			if (fd >= 0)
+			{
+				::close(fd);
+			}
+		}
+		
+		/// Queues a submission queue entry. The number of queued and in-flight entries must not exceed the ring size.
+		void push(const io_uring_sqe& sqe) noexcept
+		{
+			const u32 tail = std::atomic_ref(*sq_field(params.sq_off.tail)).load(std::memory_order_relaxed);
+			const u32 index = tail & *sq_field(params.sq_off.ring_mask);
+			sqes[index] = sqe;
+			sq_field(params.sq_off.array)[index] = index;
+			std::atomic_ref(*sq_field(params.sq_off.tail)).store(tail + 1, std::memory_order_release);
+			++unsubmitted;
+		}
+		
+		/// Submits queued entries and waits for at least one completion.
+		void submit_and_wait()
+		{
+			for (;;)
+			{
+				const long submitted = ::syscall(__NR_io_uring_enter, fd, unsubmitted, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+				if (submitted >= 0)
+				{
+					unsubmitted -= static_cast<u32>(submitted);
+					return;
+				}
+				if (errno != EINTR)
+				{
+					throw std::system_error(errno, std::system_category(), "io_uring_enter");
+				}
+			}
+		}
+		
+		/// Invokes a function with each available completion queue entry.
+		template <class Function>
+		void reap(Function&& function)
+		{
+			u32 head = std::atomic_ref(*cq_field(params.cq_off.head)).load(std::memory_order_relaxed);
+			const u32 tail = std::atomic_ref(*cq_field(params.cq_off.tail)).load(std::memory_order_acquire);
+			const u32 mask = *cq_field(params.cq_off.ring_mask);
+			const auto cqes = reinterpret_cast<const io_uring_cqe*>(static_cast<std::byte*>(cq_ring) + params.cq_off.cqes);
+			
+			for (; head != tail; ++head)
+			{
+				const io_uring_cqe cqe = cqes[head & mask];
+				std::atomic_ref(*cq_field(params.cq_off.head)).store(head + 1, std::memory_order_release);
+				function(cqe);
+			}
+		}
+	};
+	
+	/// File being read through an io_uring.
+	struct ring_slot
+	{
+		std::size_t file_index{0};
+		int fd{-1};
+		std::vector<std::byte> contents;
+		std::size_t bytes_read{0};
+	};
+	
+	/// Reads whole files through one io_uring per thread. Returns `false` if io_uring is unavailable.
+	[[nodiscard]] bool read_files_io_uring(std::span<const fs::path> paths, u32 thread_count, u32 queue_depth, const std::function<void(std::size_t, std::span<const std::byte>)>& consume, read_error& error)
+	{
+		const u32 ring_count = static_cast<u32>(std::min<std::size_t>(std::max(thread_count, 1u), paths.size()));
+		const u32 ring_depth = std::max(queue_depth / std::max(ring_count, 1u), 1u);
+		
+		// Check that io_uring is available before starting any threads
+		{
+			ring probe;
+			if (!probe.setup(ring_depth))
+			{
+				return false;
+			}
+		}
+		
+		std::atomic<std::size_t> next_file_index{0};
+		
+		parallel_for
+		(
+			ring_count,
+			ring_count,
+			[&](std::size_t)
+			{
+				ring r;
+				if (!r.setup(ring_depth))
+				{
+					throw std::runtime_error("failed to set up io_uring");
+				}
+				
+				std::vector<ring_slot> slots(ring_depth);
+				std::vector<u32> free_slots(ring_depth);
+				for (u32 i = 0; i < ring_depth; ++i)
+				{
+					free_slots[i] = ring_depth - 1 - i;
+				}
+				
+				// Queues a read of the remaining contents of the file in a slot.
+				auto queue_read = [&](u32 slot_index)
+				{
+					auto& slot = slots[slot_index];
+					io_uring_sqe sqe = {};
+					sqe.opcode = IORING_OP_READ;
+					sqe.fd = slot.fd;
+					sqe.addr = reinterpret_cast<u64>(slot.contents.data() + slot.bytes_read);
+					sqe.len = static_cast<u32>(std::min<std::size_t>(slot.contents.size() - slot.bytes_read, 0x40000000));
+					sqe.off = slot.bytes_read;
+					sqe.user_data = slot_index;
+					r.push(sqe);
+				};
+				
+				// Releases the file in a slot, reporting the current exception if any.
+				auto release_slot = [&](u32 slot_index, bool failed)
+				{
+					auto& slot = slots[slot_index];
+					if (failed)
+					{
+						error.raise(paths[slot.file_index]);
+					}
+					if (slot.fd >= 0)
+					{
+						::close(slot.fd);
+						slot.fd = -1;
+					}
+					free_slots.push_back(slot_index);
+				};
+				
+				for (;;)
+				{
+					// Open files while slots are free
+					while (!free_slots.empty() && !error.raised)
+					{
+						const std::size_t file_index = next_file_index++;
+						if (file_index >= paths.size())
+						{
+							break;
+						}
+						
+						const u32 slot_index = free_slots.back();
+						free_slots.pop_back();
+						
+						auto& slot = slots[slot_index];
+						slot.file_index = file_index;
+						slot.bytes_read = 0;
+						
+						io_uring_sqe sqe = {};
+						sqe.opcode = IORING_OP_OPENAT;
+						sqe.fd = AT_FDCWD;
+						sqe.addr = reinterpret_cast<u64>(paths[file_index].c_str());
+						sqe.open_flags = O_RDONLY | O_CLOEXEC;
+						sqe.user_data = slot_index;
+						r.push(sqe);
+					}
+					
+					// Finish once no files are in flight
+					if (free_slots.size() == ring_depth)
+					{
+						break;
+					}
+					
+					r.submit_and_wait();
+					r.reap
+					(
+						[&](const io_uring_cqe& cqe)
+						{
+							const u32 slot_index = static_cast<u32>(cqe.user_data);
+							auto& slot = slots[slot_index];
+							
+							try
+							{
+								if (cqe.res < 0)
+								{
+									throw std::system_error(-cqe.res, std::system_category());
+								}
+								
+								if (slot.fd < 0)
+								{
+									// File opened, size its contents buffer
+									slot.fd = cqe.res;
+									struct stat file_status;
+									if (::fstat(slot.fd, &file_status))
+									{
+										throw std::system_error(errno, std::system_category());
+									}
+									slot.contents.resize(static_cast<std::size_t>(file_status.st_size));
+								}
+								else
+								{
+									// File contents read
+									if (!cqe.res)
+									{
+										throw std::runtime_error("unexpected end of file");
+									}
+									slot.bytes_read += static_cast<std::size_t>(cqe.res);
+									count_bytes_read(static_cast<u64>(cqe.res));
+								}
+								
+								// Read remaining contents, or consume the file once it has been read
+								if (slot.bytes_read < slot.contents.size() && !error.raised)
+								{
+									queue_read(slot_index);
+									return;
+								}
+								if (!error.raised)
+								{
+									consume(slot.file_index, slot.contents);
+								}
+								release_slot(slot_index, false);
+							}
+							catch (...)
+							{
+								release_slot(slot_index, true);
+							}
+						}
+					);
+				}
+			}
+		);
+		
+		return true;
+	}
+	
+	#endif
+}
+
+void read_files(std::span<const fs::path> paths, u32 thread_count, u32 queue_depth, const std::function<void(std::size_t, std::span<const std::byte>)>& consume)
+{
+	queue_depth = std::max(queue_depth, 1u);
+	read_error error;
+	
+	#if defined(SIAFU_IO_URING)
+		if (!read_files_io_uring(paths, thread_count, queue_depth, consume, error))
+		{
+			read_files_blocking(paths, thread_count, queue_depth, consume, error);
+		}
+	#else
+		read_files_blocking(paths, thread_count, queue_depth, consume, error);
+	#endif
+	
+	if (error.exception)
+	{
+		std::rethrow_exception(error.exception);
+	}
+}
@@ -3,123 +3,470 @@
 
 #include "siafu.hpp"
 #include "config.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cmath>
 #include <fstream>
 #include <iostream>
+#include <limits>
 #include <format>
 #include <stdexcept>
+#include <string>
 #include <string_view>
+#include <thread>
 
 int main(int argc, char* argv[])
 {
+	std::vector<std::string_view> arguments;
+	u32 thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+	u32 queue_depth = 64;
+	u32 precision = 0;
+	u32 lod_factor = 1;
+	lod_filter filter = lod_filter::mean;
+	bool stream = false;
+	bool map = false;
+	bool pipeline = false;
+	bool direct = false;
+	bool ascii = false;
+	bool optimize = false;
+	bool flying_edges = false;
+	bool surface_nets = false;
+	bool simplify = false;
+	bool print_statistics = false;
+	u64 target_triangles = 0;
+	f32 max_error = std::numeric_limits<f32>::infinity();
+	std::string stats_json_path;
+	
 	// Parse options
-	if (argc > 1)
+	for (int i = 1; i < argc; ++i)
 	{
-		std::string_view option(argv[1]);
+		std::string_view argument(argv[i]);
 		
-		if (option == "--version")
+		if (argument == "--version")
 		{
 			std::cout << siafu_version_string << std::endl;
 			return 0;
 		}
-		else if (option == "--help")
+		else if (argument == "--help")
 		{
 			std::cout << siafu_help_string << std::endl;
 			return 0;
 		}
+		else if (argument == "--stream")
+		{
+			stream = true;
+		}
+		else if (argument == "--mmap")
+		{
+			map = true;
+		}
+		else if (argument == "--pipeline")
+		{
+			pipeline = true;
+		}
+		else if (argument == "--direct-io")
+		{
+			direct = true;
+		}
+		else if (argument == "--ascii")
+		{
+			ascii = true;
+		}
+		else if (argument == "--optimize")
+		{
+			optimize = true;
+		}
+		else if (argument == "--flying-edges")
+		{
+			flying_edges = true;
+		}
+		else if (argument == "--surface-nets")
+		{
+			surface_nets = true;
+		}
+		else if (argument == "--stats")
+		{
+			print_statistics = true;
+		}
+		else if (argument == "--stats-json" && i + 1 < argc)
+		{
+			stats_json_path = argv[++i];
+			if (stats_json_path.empty())
+			{
+				std::cerr << siafu_help_string << std::endl;
+				return 1;
+			}
+		}
+		else if (argument == "--threads" && i + 1 < argc)
+		{
+			std::string_view value(argv[++i]);
+			const auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), thread_count);
+			if (ec != std::errc{} || ptr != value.data() + value.size() || !thread_count)
+			{
+				std::cerr << siafu_help_string << std::endl;
+				return 1;
+			}
+		}
+		else if (argument == "--queue-depth" && i + 1 < argc)
+		{
+			std::string_view value(argv[++i]);
+			const auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), queue_depth);
+			if (ec != std::errc{} || ptr != value.data() + value.size() || !queue_depth)
+			{
+				std::cerr << siafu_help_string << std::endl;
+				return 1;
+			}
+		}
+		else if (argument == "--precision" && i + 1 < argc)
+		{
+			std::string_view value(argv[++i]);
+			const auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), precision);
+			if (ec != std::errc{} || ptr != value.data() + value.size() || !precision || precision > 9)
+			{
+				std::cerr << siafu_help_string << std::endl;
+				return 1;
+			}
+		}
+		else if (argument == "--lod" && i + 1 < argc)
+		{
+			std::string_view value(argv[++i]);
+			const auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), lod_factor);
+			if (ec != std::errc{} || ptr != value.data() + value.size() || !lod_factor)
+			{
+				std::cerr << siafu_help_string << std::endl;
+				return 1;
+			}
+		}
+		else if (argument == "--lod-filter" && i + 1 < argc)
+		{
+			std::string_view value(argv[++i]);
+			if (value == "mean")
+			{
+				filter = lod_filter::mean;
+			}
+			else if (value == "max")
+			{
+				filter = lod_filter::maximum;
+			}
+			else if (value == "stride")
+			{
+				filter = lod_filter::stride;
+			}
+			else
+			{
+				std::cerr << siafu_help_string << std::endl;
+				return 1;
+			}
+		}
+		else if (argument == "--target-triangles" && i + 1 < argc)
+		{
+			std::string_view value(argv[++i]);
+			const auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), target_triangles);
+			if (ec != std::errc{} || ptr != value.data() + value.size())
+			{
+				std::cerr << siafu_help_string << std::endl;
+				return 1;
+			}
+			simplify = true;
+		}
+		else if (argument == "--max-error" && i + 1 < argc)
+		{
+			const std::string value(argv[++i]);
+			char* endptr;
+			max_error = std::strtof(value.c_str(), &endptr);
+			if (value.empty() || *endptr != '\0' || !std::isfinite(max_error) || max_error < 0.0f)
+			{
+				std::cerr << siafu_help_string << std::endl;
+				return 1;
+			}
+			simplify = true;
+		}
+		else if (argument.starts_with("--"))
+		{
+			// Unrecognized option
+			std::cerr << siafu_help_string << std::endl;
+			return 1;
+		}
+		else
+		{
+			arguments.emplace_back(argument);
+		}
 	}
 	
-	// Incorrect usage
-	if (argc != 4)
+	// Incorrect usage. Streamed isosurfaces are written before they could be simplified or reordered, or before the bounds by which SQM files are quantized are known, and are only extracted with marching cubes
+	if (arguments.size() != 3 || (flying_edges && surface_nets) || (pipeline && (simplify || optimize || flying_edges || surface_nets || fs::path(arguments[2]).extension() == ".sqm")))
 	{
 		std::cerr << siafu_help_string << std::endl;
 		return 1;
 	}
 	
-	// Parse isolevel parameter
-	char* endptr;
-	f32 isolevel = std::strtof(argv[2], &endptr);
-	if (*endptr != '\0')
+	// Parse comma-separated isolevel parameter
+	std::vector<f32> isolevels;
+	std::vector<std::string> isolevel_strings;
+	for (std::string_view list = arguments[1];;)
 	{
-		// NaN
-		std::cerr << siafu_help_string << std::endl;
-		return 1;
+		const auto comma = list.find(',');
+		const std::string isolevel_string(list.substr(0, comma));
+		char* endptr;
+		const f32 isolevel = std::strtof(isolevel_string.c_str(), &endptr);
+		if (isolevel_string.empty() || *endptr != '\0')
+		{
+			// NaN
+			std::cerr << siafu_help_string << std::endl;
+			return 1;
+		}
+		isolevels.emplace_back(isolevel);
+		isolevel_strings.emplace_back(isolevel_string);
+		
+		if (comma == std::string_view::npos)
+		{
+			break;
+		}
+		list.remove_prefix(comma + 1);
 	}
 	
-	// Load volume
-	u32 volume_w, volume_h, volume_d, bits_per_voxel;
-	std::unique_ptr<std::byte[]> voxels;
+	// Resources used by each stage of the program
+	run_stats stats;
+	stats.thread_count = thread_count;
+	
+	// Open volume, and load it into memory unless streaming or memory-mapping. Levels of detail are downsampled as Z-slices are read, without loading the full-resolution volume
+	volume source;
 	try
 	{
-		voxels = load_volume(argv[1], volume_w, volume_h, volume_d, bits_per_voxel);
+		stats.begin_stage("load");
+		source = open_volume(arguments[0], map);
+		if (lod_factor > 1)
+		{
+			downsample_volume(source, lod_factor, filter, thread_count);
+		}
+		else if (!stream && !map)
+		{
+			load_volume(source, thread_count, queue_depth);
+		}
+		stats.end_stage();
 	}
 	catch (const std::exception& e)
 	{
 		std::cerr << std::format("failed to load volume: {}\n", e.what());
 		return 1;
 	}
-	std::cout << std::format("loaded volume ({}x{}x{}@{}bpv)\n", volume_w, volume_h, volume_d, bits_per_voxel);
+	stats.dimensions = {source.width, source.height, source.depth};
+	stats.bits_per_voxel = source.bits_per_voxel;
+	std::cout << std::format("{} volume ({}x{}x{}@{}bpv)\n", lod_factor > 1 ? "downsampled" : stream || map ? "opened" : "loaded", source.width, source.height, source.depth, source.bits_per_voxel);
 	
-	// Select sampling function
-	std::function<f32(u32, u32, u32)> sample;
-	if (bits_per_voxel == 8)
+	// Determine output file paths. If there are multiple isolevels, the isolevel is appended to the stem of each output file path
+	const fs::path output_path(arguments[2]);
+	std::vector<fs::path> file_paths(isolevels.size(), output_path);
+	if (isolevels.size() > 1)
 	{
-		sample = [=, vu8 = reinterpret_cast<const u8*>(voxels.get())](u32 x, u32 y, u32 z) -> f32
+		for (std::size_t i = 0; i < isolevels.size(); ++i)
 		{
-			return vu8[x + volume_w * (y + volume_h * z)];		
-		};
+			file_paths[i].replace_filename(output_path.stem().string() + "-" + isolevel_strings[i] + output_path.extension().string());
+		}
 	}
-	else if (bits_per_voxel == 16)
+	
+	// Open output streams if writing isosurfaces while they are extracted
+	std::vector<mesh_stream> streams;
+	if (pipeline)
 	{
-		sample = [=, vu16 = reinterpret_cast<const u16*>(voxels.get())](u32 x, u32 y, u32 z) -> f32
+		try
 		{
-			return vu16[x + volume_w * (y + volume_h * z)];		
-		};
+			for (const auto& file_path: file_paths)
+			{
+				if (file_path.extension() == ".obj")
+				{
+					streams.emplace_back(stream_obj(file_path, thread_count, precision));
+				}
+				else if (file_path.extension() == ".stl")
+				{
+					streams.emplace_back(stream_stl(file_path, ascii, thread_count, precision));
+				}
+				else
+				{
+					streams.emplace_back(stream_ply(file_path));
+				}
+			}
+		}
+		catch (const std::exception& e)
+		{
+			std::cerr << std::format("failed to save isosurface: {}\n", e.what());
+			return 1;
+		}
 	}
 	
-	// Extract isosurface
-	std::vector<vertex> vertices;
-	std::vector<triangle> triangles;
+	// Extracts an isosurface at each isolevel from voxels of type `T`, in a single pass over the volume.
+	std::vector<mesh> meshes(pipeline ? 0 : isolevels.size());
+	auto extract = [&]<class T>(T)
+	{
+		// Index the value ranges of bricks in volumes which are in memory, such that marching cubes skips empty regions
+		if ((!stream || lod_factor > 1) && !flying_edges && !surface_nets)
+		{
+			stats.begin_stage("index");
+			index_bricks<T>(source, thread_count);
+			stats.end_stage();
+		}
+		
+		// Isosurfaces are also written while they are extracted in a pipeline
+		stats.begin_stage("extract");
+		if (pipeline)
+		{
+			polygonize<T>(isolevels, source, thread_count, streams);
+		}
+		else if (flying_edges)
+		{
+			polygonize_flying_edges<T>(isolevels, source, thread_count, meshes);
+		}
+		else if (surface_nets)
+		{
+			polygonize_surface_nets<T>(isolevels, source, thread_count, meshes);
+		}
+		else
+		{
+			polygonize<T>(isolevels, source, thread_count, meshes);
+		}
+		stats.end_stage();
+	};
+	
+	// Extract isosurfaces, selecting the polygonization kernel for the voxel type
 	try
 	{
-		polygonize(isolevel, sample, volume_w, volume_h, volume_d, vertices, triangles);
+		const auto bits_per_voxel = source.bits_per_voxel;
+		const auto format = source.format;
+		if (bits_per_voxel == 8 && format == voxel_format::unsigned_integer)
+		{
+			extract(u8{});
+		}
+		else if (bits_per_voxel == 16 && format == voxel_format::unsigned_integer)
+		{
+			extract(u16{});
+		}
+		else if (bits_per_voxel == 16 && format == voxel_format::signed_integer)
+		{
+			extract(i16{});
+		}
+		else if (bits_per_voxel == 32 && format == voxel_format::unsigned_integer)
+		{
+			extract(u32{});
+		}
+		else if (bits_per_voxel == 32 && format == voxel_format::floating_point)
+		{
+			extract(f32{});
+		}
+		else
+		{
+			throw std::runtime_error("unsupported voxel format");
+		}
 	}
 	catch (const std::exception& e)
 	{
 		std::cerr << std::format("failed to extract isosurface: {}\n", e.what());
 		return 1;
 	}
-	std::cout << std::format("extracted isosurface ({} triangles, {} vertices)\n", triangles.size(), vertices.size());
 	
-	// Save isosurface
-	fs::path file_path(argv[3]);
-	try
+	// Save each isosurface, or complete its output stream
+	for (std::size_t i = 0; i < isolevels.size(); ++i)
 	{
-		std::ofstream file(file_path, std::ios::binary);
-		if (!file.is_open())
+		const auto& file_path = file_paths[i];
+		try
 		{
-			throw std::runtime_error("failed to open output file");
+			if (pipeline)
+			{
+				std::cout << std::format("extracted isosurface ({} triangles, {} vertices)\n", streams[i].triangle_count, streams[i].vertex_count);
+				stats.begin_stage("save");
+				streams[i].finish();
+				stats.end_stage(fs::file_size(file_path));
+				stats.isosurfaces.emplace_back(isolevel_strings[i], file_path, streams[i].triangle_count, streams[i].vertex_count);
+			}
+			else
+			{
+				auto& model = meshes[i];
+				std::cout << std::format("extracted isosurface ({} triangles, {} vertices)\n", model.triangles.size(), model.vertices.size());
+				
+				// Simplify isosurface
+				if (simplify)
+				{
+					stats.begin_stage("simplify");
+					decimate(model, target_triangles, max_error, thread_count);
+					stats.end_stage();
+					std::cout << std::format("simplified isosurface ({} triangles, {} vertices)\n", model.triangles.size(), model.vertices.size());
+				}
+				
+				// Reorder isosurface for vertex cache efficiency
+				if (optimize)
+				{
+					stats.begin_stage("optimize");
+					optimize_vertex_cache(model, thread_count);
+					stats.end_stage();
+				}
+				
+				// Output isosurface. Text formats are written through a stream, and binary formats at offsets in a pre-sized file
+				stats.begin_stage("save");
+				if (file_path.extension() == ".obj" || (file_path.extension() == ".stl" && ascii))
+				{
+					std::ofstream file(file_path, std::ios::binary);
+					if (!file.is_open())
+					{
+						throw std::runtime_error("failed to open output file");
+					}
+					
+					if (file_path.extension() == ".obj")
+					{
+						write_obj(file, model, thread_count, precision);
+					}
+					else
+					{
+						write_stl_ascii(file, model, thread_count, precision);
+					}
+					
+					file.close();
+					if (!file)
+					{
+						throw std::runtime_error("failed to write output file");
+					}
+				}
+				else if (file_path.extension() == ".stl")
+				{
+					write_stl(file_path, model, thread_count, direct);
+				}
+				else if (file_path.extension() == ".sqm")
+				{
+					write_sqm(file_path, model, thread_count, direct);
+				}
+				else
+				{
+					write_ply(file_path, model, thread_count, direct);
+				}
+				stats.end_stage(fs::file_size(file_path));
+				stats.isosurfaces.emplace_back(isolevel_strings[i], file_path, model.triangles.size(), model.vertices.size());
+			}
 		}
-		
-		// Output isosurface
-		if (file_path.extension() == ".obj")
+		catch (const std::exception& e)
 		{
-			write_obj(file, vertices, triangles);
+			std::cerr << std::format("failed to save isosurface: {}\n", e.what());
+			return 1;
 		}
-		else if (file_path.extension() == ".stl")
+		std::cout << std::format("saved isosurface to {}\n", file_path.string());
+	}
+	
+	// Report the resources used by each stage
+	if (print_statistics)
+	{
+		print_stats(std::cout, stats);
+	}
+	if (!stats_json_path.empty())
+	{
+		std::ofstream file(stats_json_path, std::ios::binary);
+		if (file.is_open())
 		{
-			write_stl(file, vertices, triangles);
+			write_stats_json(file, stats);
+			file.close();
 		}
-		else
+		if (!file)
 		{
-			write_ply(file, vertices, triangles);
+			std::cerr << "failed to save stats\n";
+			return 1;
 		}
 	}
-	catch (const std::exception& e)
-	{
-		std::cerr << std::format("failed to save isosurface: {}\n", e.what());
-		return 1;
-	}
-	std::cout << std::format("saved isosurface to {}\n", file_path.string());
 	
 	return 0;
 }
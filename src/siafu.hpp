@@ -4,12 +4,19 @@
 #ifndef SIAFU_HPP
 #define SIAFU_HPP
 
+#include <algorithm>
 #include <bit>
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
 #include <filesystem>
 #include <functional>
+#include <iosfwd>
+#include <memory>
 #include <span>
+#include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
 namespace fs = std::filesystem;
@@ -51,6 +58,125 @@ using f32vec3 = vec3<f32>;
 using u32vec3 = vec3<u32>;
 /// @}
 
+/// Voxel sample formats.
+enum class voxel_format: u32
+{
+	/// Unsigned integer data.
+	unsigned_integer = 1,
+	
+	/// Two's complement signed integer data.
+	signed_integer = 2,
+	
+	/// IEEE floating-point data.
+	floating_point = 3
+};
+
+/// Value ranges of the bricks of a volume, used to skip regions which cannot be intersected by an isosurface.
+struct brick_index
+{
+	/// Size of a brick, in cubes along each axis. Bricks overlap by one voxel, such that each brick spans every voxel of its cubes.
+	static constexpr u32 brick_size = 16;
+	
+	/// Number of bricks along each axis.
+	u32vec3 dimensions{0, 0, 0};
+	
+	/// Minimum and maximum voxel values of each brick, in X-major order. The maximum value is NaN if any voxel of the brick is NaN. @{
+	std::vector<f32> min_values;
+	std::vector<f32> max_values;
+	/// @}
+	
+	/// Returns `true` if a brick contains voxels both inside and outside of the isosurface at an isolevel, `false` otherwise.
+	[[nodiscard]] bool straddles(std::size_t i, f32 isolevel) const noexcept
+	{
+		return min_values[i] < isolevel && !(max_values[i] < isolevel);
+	}
+};
+
+/// 3D volume, stored as a sequence of Z-slices.
+struct volume
+{
+	/// Volume width, in voxels.
+	u32 width{0};
+	
+	/// Volume height, in voxels.
+	u32 height{0};
+	
+	/// Volume depth, in voxels.
+	u32 depth{0};
+	
+	/// Voxel size, in bits.
+	u32 bits_per_voxel{0};
+	
+	/// Voxel sample format.
+	voxel_format format{voxel_format::unsigned_integer};
+	
+	/// Voxel data, if the volume is resident in memory.
+	std::shared_ptr<const std::byte[]> voxels;
+	
+	/// Brick index, if the volume has been indexed.
+	std::shared_ptr<const brick_index> bricks;
+	
+	/// Scale and translation which map grid coordinates to isosurface coordinates, if the volume has been downsampled. Otherwise, the scale is `0` and the largest dimension of the volume spans [-1, 1]. @{
+	f32 grid_scale{0.0f};
+	f32 grid_translation{-1.0f};
+	/// @}
+	
+	/**
+	 * Reads a Z-slice of native-endian voxels. Safe to call concurrently.
+	 *
+	 * @param[in] z Index of the Z-slice.
+	 * @param[out] buffer Buffer with room for one Z-slice of voxels.
+	 *
+	 * @return Pointer to the Z-slice voxels, which is either @p buffer or a pointer into the resident voxel data.
+	 */
+	std::function<const std::byte*(u32 z, std::byte* buffer)> read_slice;
+	
+	/**
+	 * Releases a Z-slice which `read_slice` returned in place rather than in its buffer, once its voxels are no longer accessed, if the volume holds resources for it. Safe to call concurrently.
+	 *
+	 * @param[in] z Index of the Z-slice.
+	 */
+	std::function<void(u32 z)> release_slice;
+	
+	/**
+	 * Reads all Z-slices of native-endian voxels at once, if the volume supports it.
+	 *
+	 * @param[out] voxels Buffer with room for all Z-slices of voxels, in order.
+	 * @param[in] thread_count Maximum number of threads.
+	 * @param[in] queue_depth Maximum number of reads in flight.
+	 */
+	std::function<void(std::byte* voxels, u32 thread_count, u32 queue_depth)> read_slices;
+	
+	/// Returns the size of a Z-slice, in bytes.
+	[[nodiscard]] std::size_t slice_size() const noexcept
+	{
+		return std::size_t{width} * height * (bits_per_voxel >> 3);
+	}
+	
+	/// Returns the scale and translation which map grid coordinates to isosurface coordinates.
+	[[nodiscard]] std::pair<f32, f32> grid_transform() const noexcept
+	{
+		if (grid_scale > 0.0f)
+		{
+			return {grid_scale, grid_translation};
+		}
+		return {2.0f / static_cast<f32>(std::max({width, height, depth, 1u}) - 1), -1.0f};
+	}
+};
+
+/// Filters with which a volume is downsampled into a level of detail.
+enum class lod_filter: u32
+{
+	/// Mean of each block of voxels.
+	mean,
+	
+	/// Maximum of each block of voxels, which preserves thin structures with high values.
+	maximum,
+	
+	/// First voxel of each block. Only the first Z-slice of each block is read.
+	stride
+};
+
 /// Isosurface vertex.
 struct vertex
 {
@@ -64,65 +190,809 @@ struct vertex
 /// Isosurface triangle.
 struct triangle
 {
-	/// Indices of triangle vertices.
+	/// Indices of triangle vertices, relative to the vertex base of the triangle chunk which contains the triangle.
 	u32 a, b, c;
 };
 
+/// Run of consecutive triangles whose vertex indices are relative to a common vertex base.
+struct triangle_chunk
+{
+	/// Number of triangles in the chunk.
+	std::size_t triangle_count;
+	
+	/// Index of the vertex to which the vertex indices of the triangles in the chunk are relative.
+	u64 vertex_base;
+};
+
+/**
+ * Sequence of elements stored in fixed-size pages, such that appending never moves existing elements and the sequence is consumed as spans of consecutive elements.
+ *
+ * @tparam T Element type. Must be trivially copyable.
+ */
+template <class T>
+class paged_vector
+{
+public:
+	/// Number of elements per page.
+	static constexpr std::size_t page_size = std::size_t{1} << 14;
+	
+	/// Returns the number of elements.
+	[[nodiscard]] std::size_t size() const noexcept
+	{
+		return element_count;
+	}
+	
+	/// Returns `true` if there are no elements, `false` otherwise.
+	[[nodiscard]] bool empty() const noexcept
+	{
+		return !element_count;
+	}
+	
+	/// Returns the element at an index. @{
+	[[nodiscard]] T& operator[](std::size_t i) noexcept
+	{
+		return pages[i / page_size][i % page_size];
+	}
+	[[nodiscard]] const T& operator[](std::size_t i) const noexcept
+	{
+		return pages[i / page_size][i % page_size];
+	}
+	/// @}
+	
+	/**
+	 * Constructs an element at the end of the sequence, allocating a page if the last page is full.
+	 *
+	 * @param[in] args Arguments with which to initialize the element.
+	 *
+	 * @return Reference to the element.
+	 */
+	template <class... Args>
+	T& emplace_back(Args&&... args)
+	{
+		if (element_count == pages.size() * page_size)
+		{
+			pages.emplace_back(std::make_unique_for_overwrite<T[]>(page_size));
+		}
+		
+		T& element = (*this)[element_count++];
+		element = T{std::forward<Args>(args)...};
+		return element;
+	}
+	
+	/**
+	 * Changes the number of elements. Added elements are left uninitialized, and pages are allocated only for them, such that memory is committed as they are written.
+	 *
+	 * @param[in] count Number of elements.
+	 */
+	void resize(std::size_t count)
+	{
+		pages.resize((count + page_size - 1) / page_size);
+		for (auto& page: pages)
+		{
+			if (!page)
+			{
+				page = std::make_unique_for_overwrite<T[]>(page_size);
+			}
+		}
+		element_count = count;
+	}
+	
+	/**
+	 * Invokes a function with each span of consecutive elements within a range of elements, in order.
+	 *
+	 * @param[in] first Index of the first element of the range.
+	 * @param[in] count Number of elements in the range.
+	 * @param[in] function Function to invoke with each span.
+	 */
+	template <class Function>
+	void for_each_span(std::size_t first, std::size_t count, Function&& function) const
+	{
+		for (std::size_t i = first, end = first + count; i < end;)
+		{
+			const std::size_t span_size = std::min(page_size - i % page_size, end - i);
+			function(std::span<const T>{&(*this)[i], span_size});
+			i += span_size;
+		}
+	}
+
+private:
+	std::vector<std::unique_ptr<T[]>> pages;
+	std::size_t element_count{0};
+};
+
+/// Isosurface mesh.
+struct mesh
+{
+	/// Vertex list.
+	paged_vector<vertex> vertices;
+	
+	/// Triangle list.
+	paged_vector<triangle> triangles;
+	
+	/// Triangle chunks, in order, which together cover the triangle list. Meshes with no more than 2^32 vertices have a single chunk with a vertex base of zero, while larger meshes are split into chunks which each reference fewer than 2^32 consecutive vertices.
+	std::vector<triangle_chunk> chunks;
+};
+
+/// Mesh file which is written incrementally, one part of the mesh at a time, such that the whole mesh is never held in memory.
+struct mesh_stream
+{
+	/// Number of vertices written.
+	u64 vertex_count{0};
+	
+	/// Number of triangles written.
+	u64 triangle_count{0};
+	
+	/**
+	 * Writes the next part of the mesh.
+	 *
+	 * @param[in] part Vertices and triangles of the part. The vertices of the part follow the vertices of the preceding parts, and its triangles reference vertices of the part and of the preceding part only.
+	 */
+	std::function<void(mesh&& part)> write;
+	
+	/**
+	 * Completes the file, back-patching the counts in its header.
+	 *
+	 * @exception std::runtime_error Failed to complete the file.
+	 */
+	std::function<void()> finish;
+};
+
+/**
+ * Invokes a function once for each index in a range, distributing the invocations across a pool of threads.
+ *
+ * @param[in] count Number of indices.
+ * @param[in] thread_count Maximum number of threads, including the calling thread.
+ * @param[in] function Function to invoke with each index.
+ *
+ * @exception Rethrows the first exception thrown by @p function, after all threads have finished.
+ */
+void parallel_for(std::size_t count, u32 thread_count, const std::function<void(std::size_t)>& function);
+
+/// Running totals of instrumented work, or the work done between two snapshots of the running totals.
+struct work_totals
+{
+	/// Number of bytes read from input files. Memory-mapped files count in full when they are mapped.
+	u64 bytes_read{0};
+	
+	/// Number of cubes considered for extraction, once for each isolevel.
+	u64 cube_count{0};
+	
+	/// Number of considered cubes which are intersected by an isosurface.
+	u64 active_cube_count{0};
+	
+	/// Number of intersected cube edges looked up in the vertex cache of marching cubes.
+	u64 edge_lookup_count{0};
+	
+	/// Number of looked up edges whose vertex was reused rather than generated.
+	u64 edge_hit_count{0};
+	
+	/// Wall-clock time spent in parallel_for(), in seconds.
+	f64 parallel_seconds{0.0};
+	
+	/// Time each thread of parallel_for() spent between starting and running out of indices, in seconds, where element `0` is the calling thread.
+	std::vector<f64> thread_busy_seconds;
+	
+	/// Adds the work of another snapshot or difference.
+	work_totals& operator+=(const work_totals& other);
+};
+
+/// Returns the work done between two snapshots of the running totals.
+[[nodiscard]] work_totals operator-(const work_totals& end, const work_totals& begin);
+
+/// Adds to the running totals of instrumented work. Safe to call concurrently. @{
+void count_bytes_read(u64 count);
+void count_cubes(u64 cube_count, u64 active_cube_count);
+void count_edge_vertices(u64 lookup_count, u64 generated_count);
+void count_parallel_region(f64 wall_seconds, std::span<const f64> busy_seconds);
+/// @}
+
+/// Returns a snapshot of the running totals of instrumented work.
+[[nodiscard]] work_totals get_work_totals();
+
+/// Returns the user and system CPU time consumed by all threads of the process, in seconds.
+[[nodiscard]] f64 get_cpu_time();
+
+/// Returns the peak resident set size of the process, in bytes.
+[[nodiscard]] u64 get_peak_memory();
+
 /**
- * Extracts an isosurface from a scalar field.
+ * Classifies a row of scalar values against an isolevel, using the widest SIMD instruction set supported by the CPU.
  *
+ * @param[in] values Row of scalar values.
  * @param[in] isolevel Isosurface threshold value.
- * @param[in] sample Scalar field sampling function.
- * @param[in] width X-axis sampling resolution.
- * @param[in] height Y-axis sampling resolution.
- * @param[in] depth Z-axis sampling resolution.
- * @param[out] vertices Isosurface vertex list.
- * @param[out] triangles Isosurface triangle list.
+ * @param[out] mask Classification bitmask, in which bit `i % 64` of word `i / 64` is set if `values[i] < isolevel`. Unused bits of the last word are cleared.
+ */
+void classify_row(std::span<const f32> values, f32 isolevel, std::span<u64> mask);
+
+/**
+ * Indexes the value ranges of the bricks of a volume, such that extraction skips bricks which cannot be intersected by an isosurface at any isolevel.
+ *
+ * @tparam T Voxel type. Instantiated for `u8`, `u16`, `i16`, `u32`, and `f32`.
+ *
+ * @param[in,out] source Volume to index. On return, the brick index of the volume is set.
+ * @param[in] thread_count Maximum number of threads.
+ */
+template <class T>
+void index_bricks(volume& source, u32 thread_count);
+
+/**
+ * Extracts isosurfaces at one or more isolevels from a scalar field.
+ *
+ * The grid is split into Z-slabs which are polygonized concurrently and then stitched together, such that the output is identical for any thread count. Each slab holds only four Z-slices of voxels at a time, so volumes which are not resident in memory are streamed from their source, reading ahead one Z-slice. Each Z-slice is read and converted once, then classified against every isolevel.
+ *
+ * If the volume has a brick index, only voxels near bricks which straddle an isolevel are converted and classified.
+ *
+ * Grid and vertex indices are slice- and slab-local, such that volumes and meshes may exceed 2^32 voxels and vertices. Z-slices are limited to 2^31 / 6 voxels.
+ *
+ * @tparam T Voxel type. Instantiated for `u8`, `u16`, `i16`, `u32`, and `f32`.
+ *
+ * @param[in] isolevels Isosurface threshold values.
+ * @param[in] source Scalar field volume.
+ * @param[in] thread_count Maximum number of threads.
+ * @param[in,out] meshes Meshes to which the isosurface at each isolevel is appended. Must have one mesh per isolevel.
+ *
+ * @exception std::runtime_error Z-slices are too large.
  *
  * @see Bourke, P. (1994). Polygonising a scalar field.
  */
+template <class T>
 void polygonize
 (
-	f32 isolevel,
-	const std::function<f32(u32, u32, u32)>& sample,
-	u32 width,
-	u32 height,
-	u32 depth,
-	std::vector<vertex>& vertices,
-	std::vector<triangle>& triangles
+	std::span<const f32> isolevels,
+	const volume& source,
+	u32 thread_count,
+	std::span<mesh> meshes
 );
 
 /**
- * Loads a 3D volume from a sequence of TIFF files.
+ * Extracts isosurfaces at one or more isolevels from a scalar field, writing each isosurface to a stream while it is extracted.
  *
- * @param[in] path Path to the volume directory.
- * @param[out] width Volume width, in voxels.
- * @param[out] height Volume height, in voxels.
- * @param[out] depth Volume depth, in voxels.
- * @param[out] bits_per_voxel Voxel size, in bits.
+ * The grid is split into Z-slabs of at most 16 Z-layers. A writer thread hands each completed slab to the streams in order, as soon as the slabs preceding it have been written, and frees it. Threads which get too far ahead of the writer wait, such that only a few slabs per thread are held in memory at once.
+ *
+ * @tparam T Voxel type. Instantiated for `u8`, `u16`, `i16`, `u32`, and `f32`.
  *
- * @return Voxel data.
+ * @param[in] isolevels Isosurface threshold values.
+ * @param[in] source Scalar field volume.
+ * @param[in] thread_count Maximum number of threads.
+ * @param[in,out] streams Streams to which the isosurface at each isolevel is written. Must have one stream per isolevel. The streams are not finished.
+ *
+ * @exception std::runtime_error Z-slices are too large, or a stream failed to write.
  */
-[[nodiscard]] std::unique_ptr<std::byte[]> load_volume
+template <class T>
+void polygonize
 (
-	const fs::path& path,
-	u32& width,
-	u32& height,
-	u32& depth,
-	u32& bits_per_voxel
+	std::span<const f32> isolevels,
+	const volume& source,
+	u32 thread_count,
+	std::span<mesh_stream> streams
 );
 
 /**
- * Writes a model to a file.
+ * Extracts isosurfaces at one or more isolevels from a scalar field with the Flying Edges algorithm, producing the same surfaces as polygonize() with a different vertex order.
+ *
+ * Each Z-slab of the grid is swept twice. The first pass classifies rows of voxels and counts the intersected edges owned by each row of grid points and the triangles of each row of cubes. The counts are prefix-summed into exact offsets, the isosurfaces are sized once, and the second pass generates the vertices and triangles of each row directly at their offsets, such that slabs share no mutable state and nothing is reallocated. Volumes which are not resident in memory are read twice.
+ *
+ * Vertices of each row of grid points are ordered by X-, then Y-, then Z-edge, and meshes with more than 2^32 vertices have one triangle chunk per Z-layer of cubes. Z-slices are limited to 2^31 / 6 voxels.
+ *
+ * @tparam T Voxel type. Instantiated for `u8`, `u16`, `i16`, `u32`, and `f32`.
+ *
+ * @param[in] isolevels Isosurface threshold values.
+ * @param[in] source Scalar field volume.
+ * @param[in] thread_count Maximum number of threads.
+ * @param[in,out] meshes Meshes to which the isosurface at each isolevel is appended. Must have one mesh per isolevel.
+ *
+ * @exception std::runtime_error Z-slices are too large.
+ *
+ * @see Schroeder, W., Maynard, R., & Geveci, B. (2015). Flying edges: A high-performance scalable isocontouring algorithm.
+ */
+template <class T>
+void polygonize_flying_edges
+(
+	std::span<const f32> isolevels,
+	const volume& source,
+	u32 thread_count,
+	std::span<mesh> meshes
+);
+
+/**
+ * Extracts isosurfaces at one or more isolevels from a scalar field with naive Surface Nets, a dual method which places one vertex in each cube intersected by an isosurface and connects the vertices of the four cubes around each intersected edge with a quad.
+ *
+ * Each vertex is placed at the mean of the intersections of the isosurface with the edges of its cube, interpolated as in polygonize(), and its normal is the normalized sum of the interpolated gradients. Quads are split along their shorter diagonal into two triangles. Smooth isosurfaces have about as many triangles as with marching cubes, but almost no slivers. Like polygonize_flying_edges(), each Z-slab of the grid is swept twice, counting then generating vertices and quads at exact offsets, and volumes which are not resident in memory are read twice. The result is independent of the thread count.
+ *
+ * Edges on the boundary of the grid have fewer than four cubes around them and produce no quads, such that isosurfaces which reach the boundary are left open. Z-slices are limited to 2^31 / 6 voxels.
+ *
+ * @tparam T Voxel type. Instantiated for `u8`, `u16`, `i16`, `u32`, and `f32`.
+ *
+ * @param[in] isolevels Isosurface threshold values.
+ * @param[in] source Scalar field volume.
+ * @param[in] thread_count Maximum number of threads.
+ * @param[in,out] meshes Meshes to which the isosurface at each isolevel is appended. Must have one mesh per isolevel.
+ *
+ * @exception std::runtime_error Z-slices are too large.
+ *
+ * @see Gibson, S. F. F. (1998). Constrained elastic surface nets: Generating smooth surfaces from binary segmented data.
+ */
+template <class T>
+void polygonize_surface_nets
+(
+	std::span<const f32> isolevels,
+	const volume& source,
+	u32 thread_count,
+	std::span<mesh> meshes
+);
+
+/**
+ * Simplifies a mesh by collapsing edges in order of increasing quadric error.
+ *
+ * The triangles of each triangle chunk are sorted along a Morton curve through their centroids and split into ranges, which are compact spatial blocks of the isosurface. Each range is simplified concurrently with Garland and Heckbert's quadric error metric, while vertices referenced by other ranges and vertices on open boundaries are locked in place. The boundaries between ranges are shifted between rounds, such that vertices locked in one round may be collapsed in the next. Vertices which are no longer referenced are removed. The result is independent of the thread count. Meshes with no more triangles than the target are left unchanged.
+ *
+ * @param[in,out] model Mesh to simplify.
+ * @param[in] target_count Number of triangles at which to stop simplifying.
+ * @param[in] max_error Maximum distance between a collapsed vertex and the planes of its original triangles, as the root of the sum of squared distances. Infinite to simplify until the target triangle count is reached.
+ * @param[in] thread_count Maximum number of threads.
+ *
+ * @see Garland, M., & Heckbert, P. S. (1997). Surface simplification using quadric error metrics.
+ */
+void decimate(mesh& model, u64 target_count, f32 max_error, u32 thread_count);
+
+/**
+ * Reorders the triangles and vertices of a mesh to improve vertex cache hit rates when rendering, and to make vertex indices more compressible.
+ *
+ * Triangle chunks are split into ranges of consecutive triangles, which are contiguous rows of the isosurface. The triangles of each range are reordered concurrently with Forsyth's linear-speed vertex cache optimisation, then vertices are renumbered in the order in which the reordered triangles first reference them. The result is independent of the thread count.
+ *
+ * @param[in,out] model Mesh to reorder.
+ * @param[in] thread_count Maximum number of threads.
+ *
+ * @exception std::runtime_error A range of a mesh with more than 2^32 vertices references vertices too far apart to index relative to a common base.
+ *
+ * @see Forsyth, T. (2006). Linear-Speed Vertex Cache Optimisation.
+ */
+void optimize_vertex_cache(mesh& model, u32 thread_count);
+
+/**
+ * Maps a file into memory for sequential, read-only access.
+ *
+ * @param[in] path Path to the file.
+ * @param[out] size Size of the file, in bytes.
+ *
+ * @return Pointer to the file contents, which unmaps the file once the last reference is released, or `nullptr` if the file is empty.
+ *
+ * @exception std::runtime_error Failed to map file.
+ */
+[[nodiscard]] std::shared_ptr<const std::byte[]> map_file(const fs::path& path, std::size_t& size);
+
+/**
+ * Read-only file supporting positional and vectored reads. Safe to read concurrently.
+ */
+class input_file
+{
+public:
+	/**
+	 * Opens a file for reading.
+	 *
+	 * @param[in] path Path to the file.
+	 *
+	 * @exception std::runtime_error Failed to open file.
+	 */
+	explicit input_file(const fs::path& path);
+	
+	/// Closes the file.
+	~input_file();
+	
+	input_file(const input_file&) = delete;
+	input_file& operator=(const input_file&) = delete;
+	
+	/// Returns the size of the file, in bytes.
+	[[nodiscard]] u64 size() const;
+	
+	/**
+	 * Reads bytes from the file.
+	 *
+	 * @param[in] offset Offset of the first byte to read.
+	 * @param[out] buffer Buffer to fill.
+	 *
+	 * @exception std::runtime_error Failed to fill the buffer.
+	 */
+	void read(u64 offset, std::span<std::byte> buffer) const;
+	
+	/**
+	 * Reads a contiguous range of bytes from the file, scattering them across multiple buffers with as few system calls as possible.
+	 *
+	 * @param[in] offset Offset of the first byte to read.
+	 * @param[out] buffers Buffers to fill, in order.
+	 *
+	 * @exception std::runtime_error Failed to fill the buffers.
+	 */
+	void read(u64 offset, std::span<const std::span<std::byte>> buffers) const;
+
+private:
+	#if defined(_WIN32)
+		void* handle;
+	#else
+		int handle;
+	#endif
+};
+
+/**
+ * Write-only file supporting positional and vectored writes. Safe to write concurrently to disjoint ranges.
+ */
+class output_file
+{
+public:
+	/// Alignment, in bytes, of the offsets, sizes, and buffer addresses of direct writes.
+	static constexpr std::size_t direct_alignment = 4096;
+	
+	/**
+	 * Creates or truncates a file for writing.
+	 *
+	 * @param[in] path Path to the file.
+	 * @param[in] direct Bypass the page cache with direct I/O (`O_DIRECT`, or `FILE_FLAG_NO_BUFFERING` on Windows) if the file system supports it.
+	 *
+	 * @exception std::runtime_error Failed to open file.
+	 */
+	output_file(const fs::path& path, bool direct = false);
+	
+	/// Closes the file.
+	~output_file();
+	
+	output_file(const output_file&) = delete;
+	output_file& operator=(const output_file&) = delete;
+	
+	/// Returns `true` if writes bypass the page cache, in which case they must be aligned to #direct_alignment.
+	[[nodiscard]] inline bool is_direct() const noexcept
+	{
+		return direct_io;
+	}
+	
+	/**
+	 * Sets the size of the file, extending it with zeros or truncating it.
+	 *
+	 * @param[in] size Size of the file, in bytes.
+	 *
+	 * @exception std::runtime_error Failed to resize the file.
+	 */
+	void resize(u64 size);
+	
+	/**
+	 * Writes bytes to the file.
+	 *
+	 * @param[in] offset Offset of the first byte to write.
+	 * @param[in] buffer Bytes to write.
+	 *
+	 * @exception std::runtime_error Failed to write the buffer.
+	 */
+	void write(u64 offset, std::span<const std::byte> buffer) const;
+	
+	/**
+	 * Writes a contiguous range of bytes to the file, gathering them from multiple buffers with as few system calls as possible.
+	 *
+	 * @param[in] offset Offset of the first byte to write.
+	 * @param[in] buffers Buffers to write, in order.
+	 *
+	 * @exception std::runtime_error Failed to write the buffers.
+	 */
+	void write(u64 offset, std::span<const std::span<const std::byte>> buffers) const;
+
+private:
+	#if defined(_WIN32)
+		void* handle;
+	#else
+		int handle;
+	#endif
+	bool direct_io{false};
+};
+
+/**
+ * Writes a file of known size in fixed-size segments, which are serialized and written concurrently at their offsets in the pre-sized file.
+ *
+ * @param[in] path Path to the file.
+ * @param[in] size Size of the file, in bytes.
+ * @param[in] thread_count Maximum number of threads.
+ * @param[in] direct Bypass the page cache with direct I/O if the file system supports it.
+ * @param[in] serialize Function which fills a buffer with the bytes of the file starting at a given offset. Called concurrently.
+ *
+ * @exception std::runtime_error Failed to write the file, or @p serialize threw.
+ */
+void write_file(const fs::path& path, u64 size, u32 thread_count, bool direct, const std::function<void(u64, std::span<std::byte>)>& serialize);
+
+/**
+ * Formats blocks of a text file concurrently, and writes the formatted blocks to the file in order with large sequential writes.
  *
  * @param[out] file Output file.
- * @param[in] vertices Vertex list.
- * @param[in] triangles Triangle list.
+ * @param[in] block_count Number of blocks.
+ * @param[in] thread_count Maximum number of threads.
+ * @param[in] format_block Function which formats a block, given its index and a buffer to replace with the formatted block. Called concurrently.
+ *
+ * @exception Rethrows the first exception thrown by @p format_block.
  */
-/// @{
-void write_obj(std::ostream& file, std::span<const vertex> vertices, std::span<const triangle> triangles);
-void write_ply(std::ostream& file, std::span<const vertex> vertices, std::span<const triangle> triangles);
-void write_stl(std::ostream& file, std::span<const vertex> vertices, std::span<const triangle> triangles);
-/// @}
+void write_blocks(std::ostream& file, std::size_t block_count, u32 thread_count, const std::function<void(std::size_t, std::string&)>& format_block);
+
+/// Maximum number of characters in a floating-point value formatted by format_float().
+inline constexpr std::size_t max_float_size = 24;
+
+/**
+ * Formats a floating-point value as text.
+ *
+ * @param[out] first Pointer to the first character of the output, with room for at least #max_float_size characters.
+ * @param[in] value Value to format.
+ * @param[in] precision Number of significant digits, or `0` to format the shortest representation which round-trips.
+ *
+ * @return Pointer one past the last character of the output.
+ */
+[[nodiscard]] char* format_float(char* first, f32 value, u32 precision);
+
+/**
+ * Reads whole files asynchronously, with io_uring where available or a pool of blocking reads otherwise.
+ *
+ * @param[in] paths Paths to the files.
+ * @param[in] thread_count Maximum number of threads.
+ * @param[in] queue_depth Maximum number of reads in flight.
+ * @param[in] consume Function called with the index and contents of each file once it has been read. Called concurrently, in no particular order.
+ *
+ * @exception std::runtime_error Failed to read a file, or @p consume threw. The message is prefixed with the path of the file.
+ */
+void read_files(std::span<const fs::path> paths, u32 thread_count, u32 queue_depth, const std::function<void(std::size_t, std::span<const std::byte>)>& consume);
+
+/**
+ * Decompresses data compressed with the TIFF variant of LZW.
+ *
+ * @param[in] source Compressed data.
+ * @param[out] destination Buffer to fill with decompressed data. Decompressed data beyond the end of the buffer is discarded.
+ *
+ * @exception std::runtime_error Compressed data is corrupt or too short to fill the buffer.
+ */
+void decompress_lzw(std::span<const std::byte> source, std::span<std::byte> destination);
+
+/**
+ * Decompresses data compressed with Deflate, in the zlib format.
+ *
+ * @param[in] source Compressed data.
+ * @param[out] destination Buffer to fill with decompressed data. Decompressed data beyond the end of the buffer is discarded.
+ *
+ * @exception std::runtime_error Compressed data is corrupt or too short to fill the buffer.
+ */
+void decompress_deflate(std::span<const std::byte> source, std::span<std::byte> destination);
+
+/**
+ * Decompresses data compressed with PackBits.
+ *
+ * @param[in] source Compressed data.
+ * @param[out] destination Buffer to fill with decompressed data. Decompressed data beyond the end of the buffer is discarded.
+ *
+ * @exception std::runtime_error Compressed data is too short to fill the buffer.
+ */
+void decompress_packbits(std::span<const std::byte> source, std::span<std::byte> destination);
+
+/**
+ * Opens a 3D volume stored as a sequence of TIFF files, without loading its voxels.
+ *
+ * @param[in] path Path to the volume directory.
+ * @param[in] map Memory-map the TIFF files, such that Z-slices of native-endian, uncompressed volumes are accessed in place rather than copied.
+ *
+ * @return Volume which reads its Z-slices from the TIFF files on demand.
+ */
+[[nodiscard]] volume open_volume(const fs::path& path, bool map = false);
+
+/**
+ * Loads all Z-slices of a volume into memory.
+ *
+ * @param[in,out] source Volume to load. On return, the volume is resident in memory.
+ * @param[in] thread_count Maximum number of threads.
+ * @param[in] queue_depth Maximum number of reads in flight.
+ */
+void load_volume(volume& source, u32 thread_count, u32 queue_depth);
+
+/**
+ * Downsamples a volume into a level of detail held in memory, reading its Z-slices concurrently as each block of Z-slices is filtered, such that the full-resolution volume is never loaded. Isosurfaces extracted from the level of detail have the same coordinates as those of the full-resolution volume, with each voxel placed at the center of its block, or at the first voxel of its block if strided.
+ *
+ * @param[in,out] source Volume to downsample. On return, the volume holds the level of detail, and has no brick index.
+ * @param[in] factor Downsampling factor along each axis. Blocks on the far faces of the volume are truncated.
+ * @param[in] filter Filter applied to each block of voxels.
+ * @param[in] thread_count Maximum number of threads.
+ *
+ * @exception std::runtime_error Unsupported voxel format.
+ */
+void downsample_volume(volume& source, u32 factor, lod_filter filter, u32 thread_count);
+
+/**
+ * Writes a mesh to an OBJ file. Blocks of the file are formatted concurrently and written in order.
+ *
+ * @param[out] file Output file.
+ * @param[in] model Mesh to write.
+ * @param[in] thread_count Maximum number of threads.
+ * @param[in] precision Number of significant digits of vertex positions and normals, or `0` to write the shortest representation which round-trips.
+ */
+void write_obj(std::ostream& file, const mesh& model, u32 thread_count, u32 precision = 0);
+
+/**
+ * Writes a mesh to a binary PLY file. Segments of the file are serialized concurrently and written at their offsets in the pre-sized file.
+ *
+ * @param[in] path Path to the output file.
+ * @param[in] model Mesh to write.
+ * @param[in] thread_count Maximum number of threads.
+ * @param[in] direct Bypass the page cache with direct I/O if the file system supports it.
+ *
+ * @exception std::runtime_error Failed to write the file.
+ */
+void write_ply(const fs::path& path, const mesh& model, u32 thread_count, bool direct = false);
+
+/**
+ * Writes a mesh to a binary STL file. Face records and their faceted normals are computed in batches, and segments of the file are serialized concurrently and written at their offsets in the pre-sized file.
+ *
+ * @param[in] path Path to the output file.
+ * @param[in] model Mesh to write.
+ * @param[in] thread_count Maximum number of threads.
+ * @param[in] direct Bypass the page cache with direct I/O if the file system supports it.
+ *
+ * @exception std::runtime_error The mesh has too many triangles for STL, or failed to write the file.
+ */
+void write_stl(const fs::path& path, const mesh& model, u32 thread_count, bool direct = false);
+
+/**
+ * Writes a mesh to an SQM file, a compact binary format for fast reloading. Vertex positions are quantized to 16 bits per axis within their bounding box, vertex normals are octahedral-encoded with 16 bits per coordinate, and vertex indices are delta and variable-length encoded in independent blocks. Index blocks are encoded concurrently, and segments of the file are serialized concurrently and written at their offsets in the pre-sized file.
+ *
+ * @param[in] path Path to the output file.
+ * @param[in] model Mesh to write.
+ * @param[in] thread_count Maximum number of threads.
+ * @param[in] direct Bypass the page cache with direct I/O if the file system supports it.
+ *
+ * @exception std::runtime_error Failed to write the file.
+ */
+void write_sqm(const fs::path& path, const mesh& model, u32 thread_count, bool direct = false);
+
+/**
+ * Reads a mesh from an SQM file. Vertex pages and index blocks are read and decoded concurrently.
+ *
+ * @param[in] path Path to the SQM file.
+ * @param[in] thread_count Maximum number of threads.
+ *
+ * @return Mesh read from the file.
+ *
+ * @exception std::runtime_error Failed to read the file, or the file is invalid or unsupported.
+ */
+[[nodiscard]] mesh read_sqm(const fs::path& path, u32 thread_count);
+
+/**
+ * Writes a mesh to an ASCII STL file. Blocks of the file are formatted concurrently and written in order.
+ *
+ * @param[out] file Output file.
+ * @param[in] model Mesh to write.
+ * @param[in] thread_count Maximum number of threads.
+ * @param[in] precision Number of significant digits of vertex positions and normals, or `0` to write the shortest representation which round-trips.
+ */
+void write_stl_ascii(std::ostream& file, const mesh& model, u32 thread_count, u32 precision = 0);
+
+/**
+ * Opens an OBJ file for incremental writing.
+ *
+ * @param[in] path Path to the output file.
+ * @param[in] thread_count Maximum number of threads used to format each part of the mesh.
+ * @param[in] precision Number of significant digits of vertex positions and normals, or `0` to write the shortest representation which round-trips.
+ *
+ * @return Stream which writes to the file.
+ *
+ * @exception std::runtime_error Failed to open the file.
+ */
+[[nodiscard]] mesh_stream stream_obj(const fs::path& path, u32 thread_count, u32 precision = 0);
+
+/**
+ * Opens a PLY file for incremental writing. Face data is spooled to a temporary file next to the output file until the stream is finished.
+ *
+ * @param[in] path Path to the output file.
+ *
+ * @return Stream which writes to the file.
+ *
+ * @exception std::runtime_error Failed to open the file.
+ */
+[[nodiscard]] mesh_stream stream_ply(const fs::path& path);
+
+/**
+ * Opens an STL file for incremental writing.
+ *
+ * @param[in] path Path to the output file.
+ * @param[in] ascii Write an ASCII STL file rather than a binary STL file.
+ * @param[in] thread_count Maximum number of threads used to format each part of an ASCII STL file.
+ * @param[in] precision Number of significant digits of ASCII vertex positions and normals, or `0` to write the shortest representation which round-trips.
+ *
+ * @return Stream which writes to the file.
+ *
+ * @exception std::runtime_error Failed to open the file.
+ */
+[[nodiscard]] mesh_stream stream_stl(const fs::path& path, bool ascii, u32 thread_count, u32 precision = 0);
+
+/// Resources used by a stage of the program, summed over each time the stage ran.
+struct stage_stats
+{
+	/// Name of the stage.
+	std::string name;
+	
+	/// Wall-clock time, in seconds.
+	f64 wall_seconds{0.0};
+	
+	/// User and system CPU time of all threads, in seconds.
+	f64 cpu_seconds{0.0};
+	
+	/// Number of bytes of the output files completed by the stage.
+	u64 bytes_written{0};
+	
+	/// Peak resident set size of the process at the end of the stage, in bytes.
+	u64 peak_memory{0};
+	
+	/// Instrumented work done by the stage.
+	work_totals work;
+};
+
+/// Output isosurface of a run of the program.
+struct isosurface_stats
+{
+	/// Isolevel, as given on the command line.
+	std::string isolevel;
+	
+	/// Path to the output file.
+	fs::path path;
+	
+	/// Number of triangles and vertices written. @{
+	u64 triangle_count{0};
+	u64 vertex_count{0};
+	/// @}
+};
+
+/**
+ * Resources used by a run of the program, measured one stage at a time.
+ */
+class run_stats
+{
+public:
+	/// Dimensions of the volume, in voxels.
+	u32vec3 dimensions{0, 0, 0};
+	
+	/// Number of bits per voxel.
+	u32 bits_per_voxel{0};
+	
+	/// Maximum number of threads.
+	u32 thread_count{0};
+	
+	/// Stages of the program, in the order they first ran.
+	std::vector<stage_stats> stages;
+	
+	/// Output isosurfaces.
+	std::vector<isosurface_stats> isosurfaces;
+	
+	/**
+	 * Starts measuring a stage. Stages must not overlap.
+	 *
+	 * @param[in] name Name of the stage. Stages with the same name are summed into one record.
+	 */
+	void begin_stage(std::string_view name);
+	
+	/**
+	 * Finishes measuring the current stage.
+	 *
+	 * @param[in] bytes_written Number of bytes of the output files completed by the stage.
+	 */
+	void end_stage(u64 bytes_written = 0);
+
+private:
+	std::string stage_name;
+	std::chrono::steady_clock::time_point stage_start;
+	f64 stage_cpu_start{0.0};
+	work_totals stage_work_start;
+};
+
+/**
+ * Prints a table of the resources used by each stage of a run.
+ *
+ * @param[out] file Output stream.
+ * @param[in] stats Resources used by the run.
+ */
+void print_stats(std::ostream& file, const run_stats& stats);
+
+/**
+ * Writes the resources used by a run, in total and by each stage, as a JSON object.
+ *
+ * @param[out] file Output stream.
+ * @param[in] stats Resources used by the run.
+ */
+void write_stats_json(std::ostream& file, const run_stats& stats);
 
 #endif // SIAFU_HPP
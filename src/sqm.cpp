@@ -0,0 +1,562 @@
+// SPDX-FileCopyrightText: 2023 C. J. Howard
+// SPDX-License-Identifier: MIT
+
+#include "siafu.hpp"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+namespace
+{
+	/// SQM file signature.
+	inline constexpr std::byte magic[4] = {std::byte{'S'}, std::byte{'Q'}, std::byte{'M'}, std::byte{'F'}};
+	
+	/// SQM format version.
+	inline constexpr u32 version = 1;
+	
+	/// Size of the SQM header, in bytes.
+	inline constexpr std::size_t header_size = 64;
+	
+	/// Size of an SQM vertex record, in bytes: a 16-bit quantized position and a pair of 16-bit octahedral normal coordinates.
+	inline constexpr std::size_t vertex_record_size = sizeof(u16) * 5;
+	
+	/// Number of triangles per index block. Index blocks are encoded and decoded independently.
+	inline constexpr std::size_t block_size = std::size_t{1} << 14;
+	
+	/// Maximum size of an encoded triangle, in bytes.
+	inline constexpr std::size_t max_encoded_triangle_size = 3 * 10;
+	
+	/// Largest quantized position coordinate.
+	inline constexpr f32 max_quantized_position = 65535.0f;
+	
+	/// Largest octahedral normal coordinate.
+	inline constexpr f32 max_octahedral_coordinate = 32767.0f;
+	
+	/// Octahedral normal coordinate which marks a zero normal. Never produced by encoding a non-zero normal.
+	inline constexpr i16 zero_normal = std::numeric_limits<i16>::min();
+	
+	/// Stores an integer in little-endian byte order.
+	template <class T>
+	inline void store(std::byte* data, T x) noexcept
+	{
+		if constexpr (std::endian::native != std::endian::little)
+		{
+			x = std::byteswap(x);
+		}
+		std::memcpy(data, &x, sizeof(x));
+	}
+	
+	/// Loads an integer stored in little-endian byte order.
+	template <class T>
+	[[nodiscard]] inline T load(const std::byte* data) noexcept
+	{
+		T x;
+		std::memcpy(&x, data, sizeof(x));
+		if constexpr (std::endian::native != std::endian::little)
+		{
+			x = std::byteswap(x);
+		}
+		return x;
+	}
+	
+	/// Bounding box of vertex positions, by which positions are quantized.
+	struct bounds
+	{
+		f32vec3 min;
+		f32vec3 max;
+		
+		/// Returns the scale which maps an offset from the minimum along an axis to a quantized coordinate.
+		[[nodiscard]] inline f32 quantization_scale(f32 min_coordinate, f32 max_coordinate) const noexcept
+		{
+			return max_coordinate > min_coordinate ? max_quantized_position / (max_coordinate - min_coordinate) : 0.0f;
+		}
+	};
+	
+	/// Finds the bounding box of vertex positions.
+	[[nodiscard]] bounds find_bounds(const paged_vector<vertex>& vertices, u32 thread_count)
+	{
+		const std::size_t page_count = (vertices.size() + paged_vector<vertex>::page_size - 1) / paged_vector<vertex>::page_size;
+		constexpr f32 infinity = std::numeric_limits<f32>::infinity();
+		std::vector<bounds> page_bounds(page_count, {{infinity, infinity, infinity}, {-infinity, -infinity, -infinity}});
+		parallel_for
+		(
+			page_count,
+			thread_count,
+			[&](std::size_t page)
+			{
+				auto& b = page_bounds[page];
+				const std::size_t first = page * paged_vector<vertex>::page_size;
+				vertices.for_each_span
+				(
+					first,
+					std::min(paged_vector<vertex>::page_size, vertices.size() - first),
+					[&](std::span<const vertex> span)
+					{
+						for (const auto& v: span)
+						{
+							b.min = {std::min(b.min.x, v.p.x), std::min(b.min.y, v.p.y), std::min(b.min.z, v.p.z)};
+							b.max = {std::max(b.max.x, v.p.x), std::max(b.max.y, v.p.y), std::max(b.max.z, v.p.z)};
+						}
+					}
+				);
+			}
+		);
+		
+		bounds result = {{0.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 0.0f}};
+		if (page_count)
+		{
+			result = page_bounds[0];
+			for (const auto& b: page_bounds)
+			{
+				result.min = {std::min(result.min.x, b.min.x), std::min(result.min.y, b.min.y), std::min(result.min.z, b.min.z)};
+				result.max = {std::max(result.max.x, b.max.x), std::max(result.max.y, b.max.y), std::max(result.max.z, b.max.z)};
+			}
+		}
+		return result;
+	}
+	
+	/// Quantizes a coordinate to 16 bits, given the minimum coordinate and quantization scale of its axis.
+	[[nodiscard]] inline u16 quantize(f32 x, f32 min_x, f32 scale) noexcept
+	{
+		return static_cast<u16>(std::clamp((x - min_x) * scale + 0.5f, 0.0f, max_quantized_position));
+	}
+	
+	/// Converts a coordinate on the octahedron to a 16-bit signed normalized integer.
+	[[nodiscard]] inline i16 to_snorm(f32 x) noexcept
+	{
+		return static_cast<i16>(std::lround(std::clamp(x, -1.0f, 1.0f) * max_octahedral_coordinate));
+	}
+	
+	/// Returns `1` if a value is non-negative, or `-1` otherwise.
+	[[nodiscard]] inline f32 sign_not_zero(f32 x) noexcept
+	{
+		return x >= 0.0f ? 1.0f : -1.0f;
+	}
+	
+	/**
+	 * Encodes a unit vector as a point on the octahedron, projected onto the XY-plane with the lower hemisphere folded over the diagonals.
+	 *
+	 * @see Cigolle, Z. H., Donow, S., Evangelakos, D., Mara, M., McGuire, M., & Meyer, Q. (2014). A Survey of Efficient Representations for Independent Unit Vectors. Journal of Computer Graphics Techniques, 3(2).
+	 */
+	inline void encode_octahedral(const f32vec3& n, i16& u, i16& v) noexcept
+	{
+		const f32 l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+		if (!(l1 > 0.0f))
+		{
+			u = zero_normal;
+			v = zero_normal;
+			return;
+		}
+		
+		f32 x = n.x / l1;
+		f32 y = n.y / l1;
+		if (n.z < 0.0f)
+		{
+			const f32 folded_x = (1.0f - std::abs(y)) * sign_not_zero(x);
+			y = (1.0f - std::abs(x)) * sign_not_zero(y);
+			x = folded_x;
+		}
+		u = to_snorm(x);
+		v = to_snorm(y);
+	}
+	
+	/// Decodes a unit vector from a point on the octahedron.
+	[[nodiscard]] inline f32vec3 decode_octahedral(i16 u, i16 v) noexcept
+	{
+		if (u == zero_normal)
+		{
+			return {0.0f, 0.0f, 0.0f};
+		}
+		
+		f32 x = static_cast<f32>(u) / max_octahedral_coordinate;
+		f32 y = static_cast<f32>(v) / max_octahedral_coordinate;
+		const f32 z = 1.0f - std::abs(x) - std::abs(y);
+		if (z < 0.0f)
+		{
+			const f32 unfolded_x = (1.0f - std::abs(y)) * sign_not_zero(x);
+			y = (1.0f - std::abs(x)) * sign_not_zero(y);
+			x = unfolded_x;
+		}
+		const f32 inv_l = 1.0f / std::sqrt(x * x + y * y + z * z);
+		return {x * inv_l, y * inv_l, z * inv_l};
+	}
+	
+	/// Serializes the vertex records of a span of vertices.
+	void serialize_vertices(std::span<const vertex> vertices, const bounds& b, std::byte* records) noexcept
+	{
+		const f32vec3 scale = {b.quantization_scale(b.min.x, b.max.x), b.quantization_scale(b.min.y, b.max.y), b.quantization_scale(b.min.z, b.max.z)};
+		for (const auto& v: vertices)
+		{
+			i16 u;
+			i16 w;
+			encode_octahedral(v.n, u, w);
+			store(records, quantize(v.p.x, b.min.x, scale.x));
+			store(records + 2, quantize(v.p.y, b.min.y, scale.y));
+			store(records + 4, quantize(v.p.z, b.min.z, scale.z));
+			store(records + 6, static_cast<u16>(u));
+			store(records + 8, static_cast<u16>(w));
+			records += vertex_record_size;
+		}
+	}
+	
+	/// Deserializes the vertex records of a span of vertices.
+	void deserialize_vertices(const std::byte* records, const bounds& b, std::span<vertex> vertices) noexcept
+	{
+		const f32vec3 step = {(b.max.x - b.min.x) / max_quantized_position, (b.max.y - b.min.y) / max_quantized_position, (b.max.z - b.min.z) / max_quantized_position};
+		for (auto& v: vertices)
+		{
+			v.p.x = b.min.x + static_cast<f32>(load<u16>(records)) * step.x;
+			v.p.y = b.min.y + static_cast<f32>(load<u16>(records + 2)) * step.y;
+			v.p.z = b.min.z + static_cast<f32>(load<u16>(records + 4)) * step.z;
+			v.n = decode_octahedral(static_cast<i16>(load<u16>(records + 6)), static_cast<i16>(load<u16>(records + 8)));
+			records += vertex_record_size;
+		}
+	}
+	
+	/**
+	 * Encodes the vertex indices of a block of triangles. Each index is stored as the zigzag-encoded difference from the previous index of the block, or from zero, as a LEB128 variable-length integer.
+	 *
+	 * @param[in] triangles Triangles of the mesh.
+	 * @param[in] chunks Triangle chunks of the mesh.
+	 * @param[in] chunk_ends Index one past the last triangle of each chunk.
+	 * @param[in] first Index of the first triangle of the block.
+	 * @param[in] count Number of triangles in the block.
+	 * @param[out] output Buffer of at least `count * max_encoded_triangle_size` bytes.
+	 *
+	 * @return Pointer one past the last encoded byte.
+	 */
+	std::byte* encode_block(const paged_vector<triangle>& triangles, std::span<const triangle_chunk> chunks, std::span<const std::size_t> chunk_ends, std::size_t first, std::size_t count, std::byte* output) noexcept
+	{
+		std::size_t chunk = static_cast<std::size_t>(std::ranges::upper_bound(chunk_ends, first) - chunk_ends.begin());
+		std::size_t i = first;
+		u64 previous = 0;
+		triangles.for_each_span
+		(
+			first,
+			count,
+			[&](std::span<const triangle> span)
+			{
+				for (const auto& t: span)
+				{
+					while (i >= chunk_ends[chunk])
+					{
+						++chunk;
+					}
+					const u64 vertex_base = chunks[chunk].vertex_base;
+					for (const u64 index: {vertex_base + t.a, vertex_base + t.b, vertex_base + t.c})
+					{
+						const u64 delta = index - previous;
+						u64 zigzag = (delta << 1) ^ (static_cast<u64>(-static_cast<i64>(delta >> 63)));
+						previous = index;
+						for (; zigzag >= 0x80; zigzag >>= 7)
+						{
+							*output++ = static_cast<std::byte>(zigzag | 0x80);
+						}
+						*output++ = static_cast<std::byte>(zigzag);
+					}
+					++i;
+				}
+			}
+		);
+		return output;
+	}
+	
+	/// Decodes the next LEB128 variable-length integer of an index block.
+	[[nodiscard]] u64 decode_varint(const std::byte*& input, const std::byte* end)
+	{
+		u64 x = 0;
+		for (u32 shift = 0; shift < 64; shift += 7)
+		{
+			if (input == end)
+			{
+				break;
+			}
+			const u8 byte = static_cast<u8>(*input++);
+			x |= u64{byte & 0x7fu} << shift;
+			if (!(byte & 0x80))
+			{
+				return x;
+			}
+		}
+		throw std::runtime_error("invalid index block");
+	}
+}
+
+void write_sqm(const fs::path& path, const mesh& model, u32 thread_count, bool direct)
+{
+	const auto& [vertices, triangles, chunks] = model;
+	
+	// Find the index one past the last triangle of each chunk
+	std::vector<std::size_t> chunk_ends(chunks.size());
+	std::size_t triangle_count = 0;
+	for (std::size_t i = 0; i < chunks.size(); ++i)
+	{
+		triangle_count += chunks[i].triangle_count;
+		chunk_ends[i] = triangle_count;
+	}
+	
+	// Encode index blocks concurrently
+	const std::size_t block_count = (triangles.size() + block_size - 1) / block_size;
+	std::vector<std::vector<std::byte>> blocks(block_count);
+	parallel_for
+	(
+		block_count,
+		thread_count,
+		[&](std::size_t block)
+		{
+			const std::size_t first = block * block_size;
+			const std::size_t count = std::min(block_size, triangles.size() - first);
+			auto& encoded = blocks[block];
+			encoded.resize(count * max_encoded_triangle_size);
+			encoded.resize(static_cast<std::size_t>(encode_block(triangles, chunks, chunk_ends, first, count, encoded.data()) - encoded.data()));
+			encoded.shrink_to_fit();
+		}
+	);
+	
+	// Lay out the file as a header, vertex records, a table of the end offset of each index block, and then the index blocks
+	const u64 vertices_offset = header_size;
+	const u64 block_table_offset = vertices_offset + u64{vertices.size()} * vertex_record_size;
+	const u64 blocks_offset = block_table_offset + u64{block_count} * sizeof(u64);
+	std::vector<std::byte> block_table(block_count * sizeof(u64));
+	u64 index_size = 0;
+	for (std::size_t block = 0; block < block_count; ++block)
+	{
+		index_size += blocks[block].size();
+		store(block_table.data() + block * sizeof(u64), index_size);
+	}
+	const u64 file_size = blocks_offset + index_size;
+	
+	const bounds b = find_bounds(vertices, thread_count);
+	std::byte header[header_size] = {};
+	std::memcpy(header, magic, sizeof(magic));
+	store(header + 4, version);
+	store(header + 8, u64{vertices.size()});
+	store(header + 16, u64{triangles.size()});
+	for (std::size_t i = 0; const f32 x: {b.min.x, b.min.y, b.min.z, b.max.x, b.max.y, b.max.z})
+	{
+		store(header + 24 + sizeof(f32) * i++, std::bit_cast<u32>(x));
+	}
+	store(header + 48, static_cast<u32>(block_size));
+	store(header + 56, index_size);
+	
+	// Copies the bytes of a section of the file which overlap a segment
+	auto copy_overlap = [](u64 data_offset, std::span<const std::byte> data, u64 offset, std::span<std::byte> segment)
+	{
+		const u64 first = std::max(data_offset, offset);
+		const u64 last = std::min(data_offset + data.size(), offset + segment.size());
+		if (first < last)
+		{
+			std::memcpy(segment.data() + (first - offset), data.data() + (first - data_offset), static_cast<std::size_t>(last - first));
+		}
+	};
+	
+	// Serialize and write segments of the file concurrently
+	write_file
+	(
+		path,
+		file_size,
+		thread_count,
+		direct,
+		[&](u64 offset, std::span<std::byte> segment)
+		{
+			const u64 segment_end = offset + segment.size();
+			copy_overlap(0, header, offset, segment);
+			
+			// Serialize vertex records one page at a time, copying only the bytes of pages which overlap the segment
+			if (offset < block_table_offset && segment_end > vertices_offset)
+			{
+				constexpr std::size_t page_size = paged_vector<vertex>::page_size;
+				const std::size_t first_page = static_cast<std::size_t>((std::max(offset, vertices_offset) - vertices_offset) / (page_size * vertex_record_size));
+				const std::size_t last_page = static_cast<std::size_t>((std::min(segment_end, block_table_offset) - vertices_offset + page_size * vertex_record_size - 1) / (page_size * vertex_record_size));
+				auto records = std::make_unique_for_overwrite<std::byte[]>(page_size * vertex_record_size);
+				for (std::size_t page = first_page; page < last_page; ++page)
+				{
+					const std::size_t first = page * page_size;
+					const std::size_t count = std::min(page_size, vertices.size() - first);
+					std::byte* output = records.get();
+					vertices.for_each_span
+					(
+						first,
+						count,
+						[&](std::span<const vertex> span)
+						{
+							serialize_vertices(span, b, output);
+							output += span.size() * vertex_record_size;
+						}
+					);
+					copy_overlap(vertices_offset + u64{first} * vertex_record_size, {records.get(), count * vertex_record_size}, offset, segment);
+				}
+			}
+			
+			copy_overlap(block_table_offset, block_table, offset, segment);
+			
+			// Copy index blocks which overlap the segment
+			u64 block_offset = blocks_offset;
+			for (const auto& block: blocks)
+			{
+				if (block_offset >= segment_end)
+				{
+					break;
+				}
+				copy_overlap(block_offset, block, offset, segment);
+				block_offset += block.size();
+			}
+		}
+	);
+}
+
+mesh read_sqm(const fs::path& path, u32 thread_count)
+{
+	input_file file(path);
+	const u64 file_size = file.size();
+	
+	// Read and validate header
+	std::byte header[header_size];
+	if (file_size < header_size)
+	{
+		throw std::runtime_error("invalid SQM header");
+	}
+	file.read(0, header);
+	if (std::memcmp(header, magic, sizeof(magic)) || load<u32>(header + 4) != version || load<u32>(header + 48) != block_size)
+	{
+		throw std::runtime_error("unsupported SQM file");
+	}
+	const u64 vertex_count = load<u64>(header + 8);
+	const u64 triangle_count = load<u64>(header + 16);
+	bounds b;
+	b.min = {std::bit_cast<f32>(load<u32>(header + 24)), std::bit_cast<f32>(load<u32>(header + 28)), std::bit_cast<f32>(load<u32>(header + 32))};
+	b.max = {std::bit_cast<f32>(load<u32>(header + 36)), std::bit_cast<f32>(load<u32>(header + 40)), std::bit_cast<f32>(load<u32>(header + 44))};
+	const u64 index_size = load<u64>(header + 56);
+	
+	const u64 block_count = (triangle_count + block_size - 1) / block_size;
+	const u64 vertices_offset = header_size;
+	if (vertex_count > (file_size - vertices_offset) / vertex_record_size || block_count > file_size / sizeof(u64) || index_size > file_size)
+	{
+		throw std::runtime_error("invalid SQM header");
+	}
+	const u64 block_table_offset = vertices_offset + vertex_count * vertex_record_size;
+	const u64 blocks_offset = block_table_offset + block_count * sizeof(u64);
+	if (blocks_offset + index_size != file_size)
+	{
+		throw std::runtime_error("invalid SQM header");
+	}
+	
+	// Each encoded index occupies at least one byte
+	if (triangle_count > index_size / 3)
+	{
+		throw std::runtime_error("invalid SQM header");
+	}
+	
+	mesh model;
+	auto& [vertices, triangles, chunks] = model;
+	
+	// Read and decode vertex records one page at a time
+	vertices.resize(static_cast<std::size_t>(vertex_count));
+	const std::size_t page_count = (vertices.size() + paged_vector<vertex>::page_size - 1) / paged_vector<vertex>::page_size;
+	parallel_for
+	(
+		page_count,
+		thread_count,
+		[&](std::size_t page)
+		{
+			const std::size_t first = page * paged_vector<vertex>::page_size;
+			const std::size_t count = std::min(paged_vector<vertex>::page_size, vertices.size() - first);
+			std::vector<std::byte> records(count * vertex_record_size);
+			file.read(vertices_offset + u64{first} * vertex_record_size, records);
+			deserialize_vertices(records.data(), b, {&vertices[first], count});
+		}
+	);
+	
+	// Read the end offset of each index block
+	std::vector<std::byte> block_table(static_cast<std::size_t>(block_count * sizeof(u64)));
+	file.read(block_table_offset, block_table);
+	std::vector<u64> block_ends(static_cast<std::size_t>(block_count));
+	for (std::size_t block = 0; block < block_ends.size(); ++block)
+	{
+		block_ends[block] = load<u64>(block_table.data() + block * sizeof(u64));
+		if (block_ends[block] < (block ? block_ends[block - 1] : 0) || block_ends[block] > index_size)
+		{
+			throw std::runtime_error("invalid SQM block table");
+		}
+	}
+	
+	// Decode index blocks concurrently. Vertices of meshes with no more than 2^32 vertices are indexed from zero. Otherwise, each block is based at the lowest vertex it references
+	const bool large = vertex_count > u64{1} << 32;
+	std::vector<u64> block_bases(block_ends.size(), 0);
+	triangles.resize(static_cast<std::size_t>(triangle_count));
+	parallel_for
+	(
+		block_ends.size(),
+		thread_count,
+		[&](std::size_t block)
+		{
+			const u64 block_first = block ? block_ends[block - 1] : 0;
+			std::vector<std::byte> encoded(static_cast<std::size_t>(block_ends[block] - block_first));
+			file.read(blocks_offset + block_first, encoded);
+			
+			const std::size_t first = block * block_size;
+			const std::size_t count = std::min(block_size, triangles.size() - first);
+			std::vector<u64> indices(count * 3);
+			const std::byte* input = encoded.data();
+			const std::byte* const end = input + encoded.size();
+			u64 previous = 0;
+			u64 min_index = std::numeric_limits<u64>::max();
+			u64 max_index = 0;
+			for (auto& index: indices)
+			{
+				const u64 zigzag = decode_varint(input, end);
+				index = previous + ((zigzag >> 1) ^ (0 - (zigzag & 1)));
+				if (index >= vertex_count)
+				{
+					throw std::runtime_error("invalid vertex index");
+				}
+				previous = index;
+				min_index = std::min(min_index, index);
+				max_index = std::max(max_index, index);
+			}
+			if (input != end)
+			{
+				throw std::runtime_error("invalid index block");
+			}
+			
+			if (large)
+			{
+				if (max_index - min_index > std::numeric_limits<u32>::max())
+				{
+					throw std::runtime_error("vertex indices too far apart to read");
+				}
+				block_bases[block] = min_index;
+			}
+			for (std::size_t i = 0; i < count; ++i)
+			{
+				triangles[first + i] =
+				{
+					static_cast<u32>(indices[i * 3] - block_bases[block]),
+					static_cast<u32>(indices[i * 3 + 1] - block_bases[block]),
+					static_cast<u32>(indices[i * 3 + 2] - block_bases[block])
+				};
+			}
+		}
+	);
+	
+	// Build triangle chunks, merging consecutive blocks with the same base
+	for (std::size_t block = 0; block < block_bases.size(); ++block)
+	{
+		const std::size_t count = std::min(block_size, triangles.size() - block * block_size);
+		if (!chunks.empty() && chunks.back().vertex_base == block_bases[block])
+		{
+			chunks.back().triangle_count += count;
+		}
+		else
+		{
+			chunks.emplace_back(count, block_bases[block]);
+		}
+	}
+	
+	return model;
+}
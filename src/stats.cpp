@@ -0,0 +1,397 @@
+// SPDX-FileCopyrightText: 2023 C. J. Howard
+// SPDX-License-Identifier: MIT
+
+#include "siafu.hpp"
+#include "config.hpp"
+#include <algorithm>
+#include <atomic>
+#include <format>
+#include <mutex>
+#include <numeric>
+#include <ostream>
+
+#if defined(_WIN32)
+	#define WIN32_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <windows.h>
+	#include <psapi.h>
+#else
+	#include <sys/resource.h>
+#endif
+
+namespace
+{
+	/// Running totals of instrumented work. @{
+	std::atomic<u64> total_bytes_read{0};
+	std::atomic<u64> total_cube_count{0};
+	std::atomic<u64> total_active_cube_count{0};
+	std::atomic<u64> total_edge_lookup_count{0};
+	std::atomic<u64> total_edge_hit_count{0};
+	/// @}
+	
+	/// Running totals of the time spent in parallel regions, guarded by `parallel_mutex`. @{
+	std::mutex parallel_mutex;
+	f64 total_parallel_seconds{0.0};
+	std::vector<f64> total_thread_busy_seconds;
+	/// @}
+	
+	/// Returns the ratio of two counts, formatted as a JSON number, or `null` if the denominator is zero.
+	[[nodiscard]] std::string format_ratio(f64 numerator, f64 denominator)
+	{
+		return denominator > 0.0 ? std::format("{}", numerator / denominator) : std::string("null");
+	}
+	
+	/// Returns the ratio of two counts, formatted as a percentage, or `-` if the denominator is zero.
+	[[nodiscard]] std::string format_percentage(f64 numerator, f64 denominator)
+	{
+		return denominator > 0.0 ? std::format("{:.1f}%", numerator / denominator * 100.0) : std::string("-");
+	}
+	
+	/// Returns a string as a quoted JSON string.
+	[[nodiscard]] std::string quote_json(std::string_view string)
+	{
+		std::string quoted = "\"";
+		for (const char c: string)
+		{
+			if (c == '"' || c == '\\')
+			{
+				quoted += '\\';
+				quoted += c;
+			}
+			else if (static_cast<unsigned char>(c) < 0x20)
+			{
+				quoted += std::format("\\u{:04x}", static_cast<unsigned>(c));
+			}
+			else
+			{
+				quoted += c;
+			}
+		}
+		quoted += '"';
+		return quoted;
+	}
+	
+	/// Returns a list of values formatted as a JSON array.
+	[[nodiscard]] std::string format_json_array(std::span<const f64> values)
+	{
+		std::string array = "[";
+		for (std::size_t i = 0; i < values.size(); ++i)
+		{
+			array += std::format("{}{}", i ? ", " : "", values[i]);
+		}
+		array += ']';
+		return array;
+	}
+	
+	/// Returns the fraction of the time spent in parallel regions that each worker slot was busy.
+	[[nodiscard]] std::vector<f64> get_thread_utilization(const work_totals& work)
+	{
+		std::vector<f64> utilization(work.thread_busy_seconds.size());
+		if (work.parallel_seconds > 0.0)
+		{
+			for (std::size_t i = 0; i < utilization.size(); ++i)
+			{
+				utilization[i] = work.thread_busy_seconds[i] / work.parallel_seconds;
+			}
+		}
+		return utilization;
+	}
+	
+	/// Writes the counters of a stage or run as JSON members, at the given indentation.
+	void write_json_members(std::ostream& file, std::string_view indent, f64 wall_seconds, f64 cpu_seconds, u64 bytes_written, u64 peak_memory, const work_totals& work)
+	{
+		file << std::format("{}\"wall_seconds\": {},\n", indent, wall_seconds);
+		file << std::format("{}\"cpu_seconds\": {},\n", indent, cpu_seconds);
+		file << std::format("{}\"bytes_read\": {},\n", indent, work.bytes_read);
+		file << std::format("{}\"bytes_written\": {},\n", indent, bytes_written);
+		file << std::format("{}\"peak_memory_bytes\": {},\n", indent, peak_memory);
+		file << std::format("{}\"cubes\": {},\n", indent, work.cube_count);
+		file << std::format("{}\"active_cubes\": {},\n", indent, work.active_cube_count);
+		file << std::format("{}\"active_cube_ratio\": {},\n", indent, format_ratio(static_cast<f64>(work.active_cube_count), static_cast<f64>(work.cube_count)));
+		file << std::format("{}\"vertex_cache_lookups\": {},\n", indent, work.edge_lookup_count);
+		file << std::format("{}\"vertex_cache_hits\": {},\n", indent, work.edge_hit_count);
+		file << std::format("{}\"vertex_cache_hit_rate\": {},\n", indent, format_ratio(static_cast<f64>(work.edge_hit_count), static_cast<f64>(work.edge_lookup_count)));
+		file << std::format("{}\"parallel_seconds\": {},\n", indent, work.parallel_seconds);
+		file << std::format("{}\"thread_busy_seconds\": {},\n", indent, format_json_array(work.thread_busy_seconds));
+		file << std::format("{}\"thread_utilization\": {}", indent, format_json_array(get_thread_utilization(work)));
+	}
+}
+
+void count_bytes_read(u64 count)
+{
+	total_bytes_read.fetch_add(count, std::memory_order_relaxed);
+}
+
+void count_cubes(u64 cube_count, u64 active_cube_count)
+{
+	total_cube_count.fetch_add(cube_count, std::memory_order_relaxed);
+	total_active_cube_count.fetch_add(active_cube_count, std::memory_order_relaxed);
+}
+
+void count_edge_vertices(u64 lookup_count, u64 generated_count)
+{
+	total_edge_lookup_count.fetch_add(lookup_count, std::memory_order_relaxed);
+	total_edge_hit_count.fetch_add(lookup_count - std::min(generated_count, lookup_count), std::memory_order_relaxed);
+}
+
+void count_parallel_region(f64 wall_seconds, std::span<const f64> busy_seconds)
+{
+	std::lock_guard lock(parallel_mutex);
+	total_parallel_seconds += wall_seconds;
+	if (total_thread_busy_seconds.size() < busy_seconds.size())
+	{
+		total_thread_busy_seconds.resize(busy_seconds.size());
+	}
+	for (std::size_t i = 0; i < busy_seconds.size(); ++i)
+	{
+		total_thread_busy_seconds[i] += busy_seconds[i];
+	}
+}
+
+work_totals get_work_totals()
+{
+	work_totals totals;
+	totals.bytes_read = total_bytes_read.load(std::memory_order_relaxed);
+	totals.cube_count = total_cube_count.load(std::memory_order_relaxed);
+	totals.active_cube_count = total_active_cube_count.load(std::memory_order_relaxed);
+	totals.edge_lookup_count = total_edge_lookup_count.load(std::memory_order_relaxed);
+	totals.edge_hit_count = total_edge_hit_count.load(std::memory_order_relaxed);
+	
+	std::lock_guard lock(parallel_mutex);
+	totals.parallel_seconds = total_parallel_seconds;
+	totals.thread_busy_seconds = total_thread_busy_seconds;
+	return totals;
+}
+
+work_totals& work_totals::operator+=(const work_totals& other)
+{
+	bytes_read += other.bytes_read;
+	cube_count += other.cube_count;
+	active_cube_count += other.active_cube_count;
+	edge_lookup_count += other.edge_lookup_count;
+	edge_hit_count += other.edge_hit_count;
+	parallel_seconds += other.parallel_seconds;
+	if (thread_busy_seconds.size() < other.thread_busy_seconds.size())
+	{
+		thread_busy_seconds.resize(other.thread_busy_seconds.size());
+	}
+	for (std::size_t i = 0; i < other.thread_busy_seconds.size(); ++i)
+	{
+		thread_busy_seconds[i] += other.thread_busy_seconds[i];
+	}
+	return *this;
+}
+
+work_totals operator-(const work_totals& end, const work_totals& begin)
+{
+	work_totals difference = end;
+	difference.bytes_read -= begin.bytes_read;
+	difference.cube_count -= begin.cube_count;
+	difference.active_cube_count -= begin.active_cube_count;
+	difference.edge_lookup_count -= begin.edge_lookup_count;
+	difference.edge_hit_count -= begin.edge_hit_count;
+	difference.parallel_seconds -= begin.parallel_seconds;
+	for (std::size_t i = 0; i < begin.thread_busy_seconds.size(); ++i)
+	{
+		difference.thread_busy_seconds[i] -= begin.thread_busy_seconds[i];
+	}
+	return difference;
+}
+
+f64 get_cpu_time()
+{
+	#if defined(_WIN32)
+		
+		FILETIME creation_time, exit_time, kernel_time, user_time;
+		if (!GetProcessTimes(GetCurrentProcess(), &creation_time, &exit_time, &kernel_time, &user_time))
+		{
+			return 0.0;
+		}
+		
+		// Sum kernel and user times, in 100-nanosecond intervals
+		const u64 kernel_ticks = (u64{kernel_time.dwHighDateTime} << 32) | kernel_time.dwLowDateTime;
+		const u64 user_ticks = (u64{user_time.dwHighDateTime} << 32) | user_time.dwLowDateTime;
+		return static_cast<f64>(kernel_ticks + user_ticks) * 1e-7;
+	
+	#else
+		
+		rusage usage;
+		if (::getrusage(RUSAGE_SELF, &usage))
+		{
+			return 0.0;
+		}
+		
+		return static_cast<f64>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) + static_cast<f64>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+	
+	#endif
+}
+
+u64 get_peak_memory()
+{
+	#if defined(_WIN32)
+		
+		PROCESS_MEMORY_COUNTERS counters;
+		if (!K32GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		{
+			return 0;
+		}
+		return counters.PeakWorkingSetSize;
+	
+	#else
+		
+		rusage usage;
+		if (::getrusage(RUSAGE_SELF, &usage))
+		{
+			return 0;
+		}
+		
+		// Peak resident set size is reported in bytes on macOS, and in kibibytes elsewhere
+		#if defined(__APPLE__)
+			return static_cast<u64>(usage.ru_maxrss);
+		#else
+			return static_cast<u64>(usage.ru_maxrss) * 1024;
+		#endif
+	
+	#endif
+}
+
+void run_stats::begin_stage(std::string_view name)
+{
+	stage_name = name;
+	stage_start = std::chrono::steady_clock::now();
+	stage_cpu_start = get_cpu_time();
+	stage_work_start = get_work_totals();
+}
+
+void run_stats::end_stage(u64 bytes_written)
+{
+	const f64 wall_seconds = std::chrono::duration<f64>(std::chrono::steady_clock::now() - stage_start).count();
+	const f64 cpu_seconds = get_cpu_time() - stage_cpu_start;
+	const work_totals work = get_work_totals() - stage_work_start;
+	
+	// Accumulate stages which run more than once, such as saving each isosurface, into a single record
+	auto it = std::ranges::find(stages, stage_name, &stage_stats::name);
+	if (it == stages.end())
+	{
+		stages.emplace_back().name = stage_name;
+		it = stages.end() - 1;
+	}
+	it->wall_seconds += wall_seconds;
+	it->cpu_seconds += cpu_seconds;
+	it->bytes_written += bytes_written;
+	it->peak_memory = get_peak_memory();
+	it->work += work;
+}
+
+void print_stats(std::ostream& file, const run_stats& stats)
+{
+	file << std::format("{:<10}{:>10}{:>10}{:>12}{:>12}{:>12}{:>8}{:>10}{:>10}\n", "stage", "wall (s)", "cpu (s)", "read (MB)", "write (MB)", "peak (MB)", "active", "hits", "threads");
+	
+	f64 wall_seconds = 0.0;
+	f64 cpu_seconds = 0.0;
+	u64 bytes_written = 0;
+	work_totals work;
+	for (const auto& stage: stats.stages)
+	{
+		const f64 busy_seconds = std::accumulate(stage.work.thread_busy_seconds.begin(), stage.work.thread_busy_seconds.end(), 0.0);
+		const f64 capacity_seconds = stage.work.parallel_seconds * static_cast<f64>(stage.work.thread_busy_seconds.size());
+		file << std::format
+		(
+			"{:<10}{:>10.3f}{:>10.3f}{:>12.1f}{:>12.1f}{:>12.1f}{:>8}{:>10}{:>10}\n",
+			stage.name,
+			stage.wall_seconds,
+			stage.cpu_seconds,
+			static_cast<f64>(stage.work.bytes_read) * 1e-6,
+			static_cast<f64>(stage.bytes_written) * 1e-6,
+			static_cast<f64>(stage.peak_memory) * 1e-6,
+			format_percentage(static_cast<f64>(stage.work.active_cube_count), static_cast<f64>(stage.work.cube_count)),
+			format_percentage(static_cast<f64>(stage.work.edge_hit_count), static_cast<f64>(stage.work.edge_lookup_count)),
+			format_percentage(busy_seconds, capacity_seconds)
+		);
+		
+		wall_seconds += stage.wall_seconds;
+		cpu_seconds += stage.cpu_seconds;
+		bytes_written += stage.bytes_written;
+		work += stage.work;
+	}
+	
+	const u64 peak_memory = stats.stages.empty() ? 0 : stats.stages.back().peak_memory;
+	file << std::format
+	(
+		"{:<10}{:>10.3f}{:>10.3f}{:>12.1f}{:>12.1f}{:>12.1f}\n",
+		"total",
+		wall_seconds,
+		cpu_seconds,
+		static_cast<f64>(work.bytes_read) * 1e-6,
+		static_cast<f64>(bytes_written) * 1e-6,
+		static_cast<f64>(peak_memory) * 1e-6
+	);
+	
+	// Print the utilization of each worker slot in the parallel regions of each stage
+	for (const auto& stage: stats.stages)
+	{
+		if (stage.work.thread_busy_seconds.size() > 1)
+		{
+			std::string line = std::format("{} thread utilization:", stage.name);
+			for (const f64 utilization: get_thread_utilization(stage.work))
+			{
+				line += std::format(" {:.0f}%", utilization * 100.0);
+			}
+			file << line << '\n';
+		}
+	}
+}
+
+void write_stats_json(std::ostream& file, const run_stats& stats)
+{
+	f64 wall_seconds = 0.0;
+	f64 cpu_seconds = 0.0;
+	u64 bytes_written = 0;
+	work_totals work;
+	for (const auto& stage: stats.stages)
+	{
+		wall_seconds += stage.wall_seconds;
+		cpu_seconds += stage.cpu_seconds;
+		bytes_written += stage.bytes_written;
+		work += stage.work;
+	}
+	const u64 peak_memory = stats.stages.empty() ? 0 : stats.stages.back().peak_memory;
+	
+	file << "{\n";
+	file << std::format("\t\"version\": {},\n", quote_json(siafu_version_string));
+	file << std::format("\t\"threads\": {},\n", stats.thread_count);
+	file << std::format("\t\"dimensions\": [{}, {}, {}],\n", stats.dimensions.x, stats.dimensions.y, stats.dimensions.z);
+	file << std::format("\t\"bits_per_voxel\": {},\n", stats.bits_per_voxel);
+	file << std::format("\t\"voxels\": {},\n", u64{stats.dimensions.x} * stats.dimensions.y * stats.dimensions.z);
+	
+	file << "\t\"isosurfaces\":\n\t[\n";
+	for (std::size_t i = 0; i < stats.isosurfaces.size(); ++i)
+	{
+		const auto& isosurface = stats.isosurfaces[i];
+		file << std::format
+		(
+			"\t\t{{\"isolevel\": {}, \"path\": {}, \"triangles\": {}, \"vertices\": {}}}{}\n",
+			quote_json(isosurface.isolevel),
+			quote_json(isosurface.path.string()),
+			isosurface.triangle_count,
+			isosurface.vertex_count,
+			i + 1 < stats.isosurfaces.size() ? "," : ""
+		);
+	}
+	file << "\t],\n";
+	
+	write_json_members(file, "\t", wall_seconds, cpu_seconds, bytes_written, peak_memory, work);
+	file << ",\n";
+	
+	file << "\t\"stages\":\n\t[\n";
+	for (std::size_t i = 0; i < stats.stages.size(); ++i)
+	{
+		const auto& stage = stats.stages[i];
+		file << "\t\t{\n";
+		file << std::format("\t\t\t\"name\": {},\n", quote_json(stage.name));
+		write_json_members(file, "\t\t\t", stage.wall_seconds, stage.cpu_seconds, stage.bytes_written, stage.peak_memory, stage.work);
+		file << std::format("\n\t\t}}{}\n", i + 1 < stats.stages.size() ? "," : "");
+	}
+	file << "\t]\n";
+	file << "}\n";
+}
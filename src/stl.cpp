@@ -2,58 +2,462 @@
 // SPDX-License-Identifier: MIT
 
 #include "siafu.hpp"
+#include <algorithm>
 #include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#if defined(__x86_64__) || defined(_M_X64)
+	#define SIAFU_X86_64
+	#include <emmintrin.h>
+#endif
 
 namespace stl
 {
-	struct face
+	/// Size of the header and triangle count of a binary STL file, in bytes.
+	inline constexpr std::size_t header_size = 84;
+	
+	/// Size of a binary STL face record, in bytes.
+	inline constexpr std::size_t face_size = 50;
+	
+	/// Number of faces whose normals are computed together.
+	inline constexpr std::size_t batch_size = 256;
+	
+	/// Number of faces formatted per block of an ASCII STL file.
+	inline constexpr std::size_t ascii_block_size = 4096;
+	
+	/// Maximum size of a formatted ASCII STL facet, in bytes.
+	inline constexpr std::size_t max_ascii_facet_size = 64 + 4 * 3 * (max_float_size + 1);
+	
+	/// Name of the solid in ASCII STL files.
+	inline constexpr std::string_view solid_name = "isosurface";
+	
+	/// Vertex positions of a batch of triangles and their faceted normals, in structure-of-arrays layout.
+	struct batch
 	{
-		f32vec3 n;
-		f32vec3 a;
-		f32vec3 b;
-		f32vec3 c;
-		f32vec3 padding;
+		f32 nx[batch_size];
+		f32 ny[batch_size];
+		f32 nz[batch_size];
+		f32 ax[batch_size];
+		f32 ay[batch_size];
+		f32 az[batch_size];
+		f32 bx[batch_size];
+		f32 by[batch_size];
+		f32 bz[batch_size];
+		f32 cx[batch_size];
+		f32 cy[batch_size];
+		f32 cz[batch_size];
+		std::size_t size{0};
 	};
+	
+	/// Computes the faceted normals of a batch of triangles, four at a time where SSE2 is available. Both paths round identically.
+	void compute_normals(batch& b) noexcept
+	{
+		std::size_t i = 0;
+		
+		#if defined(SIAFU_X86_64)
+			const __m128 min_sqr_l = _mm_set1_ps(1e-6f);
+			const __m128 one = _mm_set1_ps(1.0f);
+			for (; i + 4 <= b.size; i += 4)
+			{
+				const __m128 ax = _mm_loadu_ps(b.ax + i);
+				const __m128 ay = _mm_loadu_ps(b.ay + i);
+				const __m128 az = _mm_loadu_ps(b.az + i);
+				const __m128 ux = _mm_sub_ps(_mm_loadu_ps(b.bx + i), ax);
+				const __m128 uy = _mm_sub_ps(_mm_loadu_ps(b.by + i), ay);
+				const __m128 uz = _mm_sub_ps(_mm_loadu_ps(b.bz + i), az);
+				const __m128 vx = _mm_sub_ps(_mm_loadu_ps(b.cx + i), ax);
+				const __m128 vy = _mm_sub_ps(_mm_loadu_ps(b.cy + i), ay);
+				const __m128 vz = _mm_sub_ps(_mm_loadu_ps(b.cz + i), az);
+				
+				const __m128 nx = _mm_sub_ps(_mm_mul_ps(uy, vz), _mm_mul_ps(uz, vy));
+				const __m128 ny = _mm_sub_ps(_mm_mul_ps(uz, vx), _mm_mul_ps(ux, vz));
+				const __m128 nz = _mm_sub_ps(_mm_mul_ps(ux, vy), _mm_mul_ps(uy, vx));
+				const __m128 sqr_l = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)), _mm_mul_ps(nz, nz));
+				const __m128 inv_l = _mm_and_ps(_mm_cmpgt_ps(sqr_l, min_sqr_l), _mm_div_ps(one, _mm_sqrt_ps(sqr_l)));
+				
+				_mm_storeu_ps(b.nx + i, _mm_mul_ps(nx, inv_l));
+				_mm_storeu_ps(b.ny + i, _mm_mul_ps(ny, inv_l));
+				_mm_storeu_ps(b.nz + i, _mm_mul_ps(nz, inv_l));
+			}
+		#endif
+		
+		for (; i < b.size; ++i)
+		{
+			const f32 ux = b.bx[i] - b.ax[i];
+			const f32 uy = b.by[i] - b.ay[i];
+			const f32 uz = b.bz[i] - b.az[i];
+			const f32 vx = b.cx[i] - b.ax[i];
+			const f32 vy = b.cy[i] - b.ay[i];
+			const f32 vz = b.cz[i] - b.az[i];
+			
+			const f32 nx = uy * vz - uz * vy;
+			const f32 ny = uz * vx - ux * vz;
+			const f32 nz = ux * vy - uy * vx;
+			const f32 sqr_l = nx * nx + ny * ny + nz * nz;
+			const f32 inv_l = (sqr_l > 1e-6f) ? 1.0f / std::sqrt(sqr_l) : 0.0f;
+			
+			b.nx[i] = nx * inv_l;
+			b.ny[i] = ny * inv_l;
+			b.nz[i] = nz * inv_l;
+		}
+	}
+	
+	/// Returns the index one past the last triangle of each triangle chunk.
+	[[nodiscard]] std::vector<std::size_t> find_chunk_ends(std::span<const triangle_chunk> chunks)
+	{
+		std::vector<std::size_t> chunk_ends(chunks.size());
+		std::size_t triangle_count = 0;
+		for (std::size_t i = 0; i < chunks.size(); ++i)
+		{
+			triangle_count += chunks[i].triangle_count;
+			chunk_ends[i] = triangle_count;
+		}
+		return chunk_ends;
+	}
+	
+	/**
+	 * Gathers the vertex positions of consecutive batches of triangles and computes their faceted normals.
+	 *
+	 * @param[in] triangles Triangle list.
+	 * @param[in] chunks Triangle chunks.
+	 * @param[in] chunk_ends Index one past the last triangle of each triangle chunk.
+	 * @param[in] first Index of the first triangle.
+	 * @param[in] count Number of triangles.
+	 * @param[in] get_position Function which returns the position of a vertex, given its index.
+	 * @param[in] consume Function called with the index of the first triangle of each batch, and the batch.
+	 */
+	template <class Position, class Consume>
+	void for_each_batch(const paged_vector<triangle>& triangles, std::span<const triangle_chunk> chunks, std::span<const std::size_t> chunk_ends, std::size_t first, std::size_t count, Position&& get_position, Consume&& consume)
+	{
+		auto current = std::make_unique_for_overwrite<batch>();
+		std::size_t chunk = static_cast<std::size_t>(std::ranges::upper_bound(chunk_ends, first) - chunk_ends.begin());
+		for (std::size_t i = first; i < first + count; i += batch_size)
+		{
+			current->size = std::min(batch_size, first + count - i);
+			for (std::size_t j = 0; j < current->size; ++j)
+			{
+				while (i + j >= chunk_ends[chunk])
+				{
+					++chunk;
+				}
+				const auto& t = triangles[i + j];
+				const u64 vertex_base = chunks[chunk].vertex_base;
+				const f32vec3& a = get_position(vertex_base + t.a);
+				const f32vec3& b = get_position(vertex_base + t.b);
+				const f32vec3& c = get_position(vertex_base + t.c);
+				current->ax[j] = a.x; current->ay[j] = a.y; current->az[j] = a.z;
+				current->bx[j] = b.x; current->by[j] = b.y; current->bz[j] = b.z;
+				current->cx[j] = c.x; current->cy[j] = c.y; current->cz[j] = c.z;
+			}
+			
+			compute_normals(*current);
+			consume(i, *current);
+		}
+	}
+	
+	/// Serializes the binary STL face records of a batch.
+	void serialize_batch(const batch& b, std::byte* output) noexcept
+	{
+		for (std::size_t i = 0; i < b.size; ++i, output += face_size)
+		{
+			f32 values[12] = {b.nx[i], b.ny[i], b.nz[i], b.ax[i], b.ay[i], b.az[i], b.bx[i], b.by[i], b.bz[i], b.cx[i], b.cy[i], b.cz[i]};
+			if constexpr (std::endian::native != std::endian::little)
+			{
+				for (auto& value: values)
+				{
+					value = byteswapf(value);
+				}
+			}
+			std::memcpy(output, values, sizeof(values));
+			output[48] = std::byte{0};
+			output[49] = std::byte{0};
+		}
+	}
+	
+	/// Formats a line of an ASCII STL facet with a keyword and three floating-point values.
+	[[nodiscard]] inline char* format_vector(char* first, std::string_view keyword, f32 x, f32 y, f32 z, u32 precision)
+	{
+		first = std::copy(keyword.begin(), keyword.end(), first);
+		first = format_float(first, x, precision);
+		*first++ = ' ';
+		first = format_float(first, y, precision);
+		*first++ = ' ';
+		first = format_float(first, z, precision);
+		*first++ = '\n';
+		return first;
+	}
+	
+	/// Formats the ASCII STL facets of a batch.
+	[[nodiscard]] char* format_batch(char* first, const batch& b, u32 precision)
+	{
+		constexpr std::string_view outer_loop = "outer loop\n";
+		constexpr std::string_view end_facet = "endloop\nendfacet\n";
+		for (std::size_t i = 0; i < b.size; ++i)
+		{
+			first = format_vector(first, "facet normal ", b.nx[i], b.ny[i], b.nz[i], precision);
+			first = std::copy(outer_loop.begin(), outer_loop.end(), first);
+			first = format_vector(first, "vertex ", b.ax[i], b.ay[i], b.az[i], precision);
+			first = format_vector(first, "vertex ", b.bx[i], b.by[i], b.bz[i], precision);
+			first = format_vector(first, "vertex ", b.cx[i], b.cy[i], b.cz[i], precision);
+			first = std::copy(end_facet.begin(), end_facet.end(), first);
+		}
+		return first;
+	}
+	
+	/// Writes a binary STL header with a placeholder triangle count.
+	void write_header(std::ostream& file)
+	{
+		const char header[header_size] = {};
+		file.write(header, sizeof(header));
+	}
+	
+	/// Returns the triangle count of a binary STL file in little-endian byte order.
+	[[nodiscard]] u32 encode_triangle_count(u64 count)
+	{
+		if (count > std::numeric_limits<u32>::max())
+		{
+			throw std::runtime_error("too many triangles for STL");
+		}
+		
+		u32 triangle_count = static_cast<u32>(count);
+		if constexpr (std::endian::native != std::endian::little)
+		{
+			triangle_count = std::byteswap(triangle_count);
+		}
+		return triangle_count;
+	}
+	
+	/**
+	 * Writes binary STL face records for the triangles of each triangle chunk of a mesh, one batch at a time.
+	 *
+	 * @param[out] file Output file.
+	 * @param[in] triangles Triangle list.
+	 * @param[in] chunks Triangle chunks.
+	 * @param[in] get_position Function which returns the position of a vertex, given its index.
+	 */
+	template <class Function>
+	void write_faces(std::ostream& file, const paged_vector<triangle>& triangles, std::span<const triangle_chunk> chunks, Function&& get_position)
+	{
+		const auto chunk_ends = find_chunk_ends(chunks);
+		auto records = std::make_unique_for_overwrite<std::byte[]>(batch_size * face_size);
+		for_each_batch
+		(
+			triangles,
+			chunks,
+			chunk_ends,
+			0,
+			triangles.size(),
+			get_position,
+			[&](std::size_t, const batch& b)
+			{
+				serialize_batch(b, records.get());
+				file.write(reinterpret_cast<const char*>(records.get()), static_cast<std::streamsize>(b.size * face_size));
+			}
+		);
+	}
+	
+	/**
+	 * Writes ASCII STL facets for the triangles of each triangle chunk of a mesh. Blocks of facets are formatted concurrently and written in order.
+	 *
+	 * @param[out] file Output file.
+	 * @param[in] triangles Triangle list.
+	 * @param[in] chunks Triangle chunks.
+	 * @param[in] thread_count Maximum number of threads.
+	 * @param[in] precision Number of significant digits, or `0` for the shortest representation which round-trips.
+	 * @param[in] get_position Function which returns the position of a vertex, given its index. Called concurrently.
+	 */
+	template <class Function>
+	void write_ascii_faces(std::ostream& file, const paged_vector<triangle>& triangles, std::span<const triangle_chunk> chunks, u32 thread_count, u32 precision, Function&& get_position)
+	{
+		const auto chunk_ends = find_chunk_ends(chunks);
+		write_blocks
+		(
+			file,
+			(triangles.size() + ascii_block_size - 1) / ascii_block_size,
+			thread_count,
+			[&](std::size_t block, std::string& buffer)
+			{
+				const std::size_t first = block * ascii_block_size;
+				const std::size_t count = std::min(ascii_block_size, triangles.size() - first);
+				buffer.resize(count * max_ascii_facet_size);
+				
+				char* output = buffer.data();
+				for_each_batch
+				(
+					triangles,
+					chunks,
+					chunk_ends,
+					first,
+					count,
+					get_position,
+					[&](std::size_t, const batch& b)
+					{
+						output = format_batch(output, b, precision);
+					}
+				);
+				buffer.resize(static_cast<std::size_t>(output - buffer.data()));
+			}
+		);
+	}
+}
+
+void write_stl(const fs::path& path, const mesh& model, u32 thread_count, bool direct)
+{
+	const auto& [vertices, triangles, chunks] = model;
+	
+	// Header is zero apart from the triangle count
+	std::byte header[stl::header_size] = {};
+	const u32 triangle_count = stl::encode_triangle_count(triangles.size());
+	std::memcpy(header + 80, &triangle_count, sizeof(triangle_count));
+	
+	const auto chunk_ends = stl::find_chunk_ends(chunks);
+	const u64 file_size = stl::header_size + u64{triangles.size()} * stl::face_size;
+	
+	// Serialize and write segments of the file concurrently
+	write_file
+	(
+		path,
+		file_size,
+		thread_count,
+		direct,
+		[&](u64 offset, std::span<std::byte> segment)
+		{
+			const u64 segment_end = offset + segment.size();
+			
+			// Copy header
+			if (offset < stl::header_size)
+			{
+				std::memcpy(segment.data(), header + offset, static_cast<std::size_t>(std::min<u64>(segment.size(), stl::header_size - offset)));
+			}
+			
+			// Serialize face records which overlap the segment, copying only their overlapping bytes
+			if (segment_end <= stl::header_size)
+			{
+				return;
+			}
+			const std::size_t first = static_cast<std::size_t>((std::max<u64>(offset, stl::header_size) - stl::header_size) / stl::face_size);
+			const std::size_t last = static_cast<std::size_t>((segment_end - stl::header_size + stl::face_size - 1) / stl::face_size);
+			
+			auto records = std::make_unique_for_overwrite<std::byte[]>(stl::batch_size * stl::face_size);
+			stl::for_each_batch
+			(
+				triangles,
+				chunks,
+				chunk_ends,
+				first,
+				last - first,
+				[&](u64 i) -> const f32vec3&
+				{
+					return vertices[i].p;
+				},
+				[&](std::size_t first_face, const stl::batch& b)
+				{
+					stl::serialize_batch(b, records.get());
+					const u64 records_offset = stl::header_size + u64{first_face} * stl::face_size;
+					const u64 copy_first = std::max(records_offset, offset);
+					const u64 copy_last = std::min(records_offset + b.size * stl::face_size, segment_end);
+					std::memcpy(segment.data() + (copy_first - offset), records.get() + (copy_first - records_offset), static_cast<std::size_t>(copy_last - copy_first));
+				}
+			);
+		}
+	);
+}
+
+void write_stl_ascii(std::ostream& file, const mesh& model, u32 thread_count, u32 precision)
+{
+	const auto& [vertices, triangles, chunks] = model;
+	
+	file << "solid " << stl::solid_name << '\n';
+	stl::write_ascii_faces
+	(
+		file,
+		triangles,
+		chunks,
+		thread_count,
+		precision,
+		[&](u64 i) -> const f32vec3&
+		{
+			return vertices[i].p;
+		}
+	);
+	file << "endsolid " << stl::solid_name << '\n';
 }
 
-void write_stl(std::ostream& file, std::span<const vertex> vertices, std::span<const triangle> triangles)
+mesh_stream stream_stl(const fs::path& path, bool ascii, u32 thread_count, u32 precision)
 {
-	// Write header
-	const char header[80] = {};
-	file.write(header, sizeof(header));
+	// Triangles reference vertices of their own part and of the preceding part, so the vertices of the preceding part are retained
+	struct state
+	{
+		std::ofstream file;
+		paged_vector<vertex> preceding_vertices;
+		u64 preceding_vertex_offset{0};
+		u64 vertex_count{0};
+		u64 triangle_count{0};
+	};
 	
-	// Write triangle count
-	u32 triangle_count = static_cast<u32>(triangles.size());
-	if constexpr (std::endian::native != std::endian::little)
+	auto s = std::make_shared<state>();
+	s->file.open(path, std::ios::binary);
+	if (!s->file.is_open())
+	{
+		throw std::runtime_error("failed to open output file");
+	}
+	if (ascii)
+	{
+		s->file << "solid " << stl::solid_name << '\n';
+	}
+	else
 	{
-		triangle_count = std::byteswap(triangle_count);
+		stl::write_header(s->file);
 	}
-	file.write(reinterpret_cast<const char*>(&triangle_count), sizeof(u32));
 	
-	// Write triangles
-	stl::face f = {};
-	for (const auto& t: triangles)
+	mesh_stream stream;
+	stream.write = [s, ascii, thread_count, precision](mesh&& part)
 	{
-		f.a = vertices[t.a].p;
-		f.b = vertices[t.b].p;
-		f.c = vertices[t.c].p;
-		
-		// Calculate faceted normal
-		f.n.x = (f.b.y - f.a.y) * (f.c.z - f.a.z) - (f.b.z - f.a.z) * (f.c.y - f.a.y);
-		f.n.y = (f.b.z - f.a.z) * (f.c.x - f.a.x) - (f.b.x - f.a.x) * (f.c.z - f.a.z);
-		f.n.z = (f.b.x - f.a.x) * (f.c.y - f.a.y) - (f.b.y - f.a.y) * (f.c.x - f.a.x);
-		const f32 sqr_l = f.n.x * f.n.x + f.n.y * f.n.y + f.n.z * f.n.z;
-		const f32 inv_l = (sqr_l > 1e-6f) ? 1.0f / std::sqrt(sqr_l) : 0.0f;
-		f.n = {f.n.x * inv_l, f.n.y * inv_l, f.n.z * inv_l};
-		
-		if constexpr (std::endian::native != std::endian::little)
+		const u64 vertex_offset = s->vertex_count;
+		auto get_position = [&](u64 i) -> const f32vec3&
+		{
+			return i < vertex_offset ? s->preceding_vertices[i - s->preceding_vertex_offset].p : part.vertices[i - vertex_offset].p;
+		};
+		if (ascii)
+		{
+			stl::write_ascii_faces(s->file, part.triangles, part.chunks, thread_count, precision, get_position);
+		}
+		else
 		{
-			f.n.x = byteswapf(f.n.x); f.n.y = byteswapf(f.n.y); f.n.z = byteswapf(f.n.z);
-			f.a.x = byteswapf(f.a.x); f.a.y = byteswapf(f.a.y); f.a.z = byteswapf(f.a.z);
-			f.b.x = byteswapf(f.b.x); f.b.y = byteswapf(f.b.y); f.b.z = byteswapf(f.b.z);
-			f.c.x = byteswapf(f.c.x); f.c.y = byteswapf(f.c.y); f.c.z = byteswapf(f.c.z);
+			stl::write_faces(s->file, part.triangles, part.chunks, get_position);
 		}
 		
-		file.write(reinterpret_cast<const char*>(&f), 50);
-	}
+		s->preceding_vertices = std::move(part.vertices);
+		s->preceding_vertex_offset = vertex_offset;
+		s->vertex_count += s->preceding_vertices.size();
+		s->triangle_count += part.triangles.size();
+	};
+	stream.finish = [s, ascii]()
+	{
+		if (ascii)
+		{
+			s->file << "endsolid " << stl::solid_name << '\n';
+		}
+		else
+		{
+			// Back-patch triangle count
+			const u32 triangle_count = stl::encode_triangle_count(s->triangle_count);
+			s->file.seekp(80);
+			s->file.write(reinterpret_cast<const char*>(&triangle_count), sizeof(triangle_count));
+		}
+		s->file.close();
+		if (!s->file)
+		{
+			throw std::runtime_error("failed to write output file");
+		}
+	};
+	
+	return stream;
 }
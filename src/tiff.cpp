@@ -2,19 +2,27 @@
 // SPDX-License-Identifier: MIT
 
 #include "siafu.hpp"
-#include <execution>
-#include <fstream>
-#include <ranges>
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <mutex>
+#include <set>
 #include <stdexcept>
+#include <type_traits>
 
 namespace tiff
 {
-	/// TIFF header.
+	/// TIFF file header.
 	struct header
 	{
-		u16 byte_order;
-		u16 magic;
-		u32 ifd_offset;
+		/// `true` if the file is in native byte order, `false` otherwise.
+		bool native_endian{true};
+		
+		/// `true` if the file is a BigTIFF file, with 64-bit offsets, `false` otherwise.
+		bool big{false};
+		
+		/// Offset to the first IFD.
+		u64 ifd_offset{0};
 	};
 	
 	/// TIFF image file directory (IFD) entry.
@@ -22,17 +30,21 @@ namespace tiff
 	{
 		u16 tag;
 		u16 type;
-		u32 count;
-		u32 offset;
+		u64 count;
+		
+		/// Offset to the entry values, or the values themselves if they fit, in file byte order.
+		std::array<std::byte, 8> value;
 	};
 	
 	/// TIFF header constants. @{
 	inline constexpr u16 little_endian = 0x4949;
 	inline constexpr u16 big_endian = 0x4d4d;
 	inline constexpr u16 magic = 42;
+	inline constexpr u16 big_magic = 43;
 	/// @}
 	
 	/// TIFF IFD entry constants. @{
+	inline constexpr u16 new_subfile_type = 0x00fe;
 	inline constexpr u16 image_width = 0x0100;
 	inline constexpr u16 image_height = 0x0101;
 	inline constexpr u16 bits_per_sample = 0x0102;
@@ -45,9 +57,178 @@ namespace tiff
 	inline constexpr u16 y_resolution = 0x011b;
 	inline constexpr u16 planar_config = 0x011c;
 	inline constexpr u16 resolution_unit = 0x0128;
+	inline constexpr u16 predictor = 0x013d;
+	inline constexpr u16 tile_width = 0x0142;
+	inline constexpr u16 tile_length = 0x0143;
+	inline constexpr u16 tile_offsets = 0x0144;
+	inline constexpr u16 tile_byte_counts = 0x0145;
+	inline constexpr u16 sample_format = 0x0153;
+	/// @}
+	
+	/// TIFF compression scheme constants. @{
 	inline constexpr u16 uncompressed = 1;
+	inline constexpr u16 lzw = 5;
+	inline constexpr u16 adobe_deflate = 8;
+	inline constexpr u16 packbits = 32773;
+	inline constexpr u16 deflate = 32946;
 	/// @}
 	
+	/// TIFF predictor constants. @{
+	inline constexpr u16 no_prediction = 1;
+	inline constexpr u16 horizontal_differencing = 2;
+	inline constexpr u16 floating_point_prediction = 3;
+	/// @}
+	
+	/// TIFF field type constants. @{
+	inline constexpr u16 type_byte = 1;
+	inline constexpr u16 type_short = 3;
+	inline constexpr u16 type_long = 4;
+	inline constexpr u16 type_ifd = 13;
+	inline constexpr u16 type_long8 = 16;
+	inline constexpr u16 type_ifd8 = 18;
+	/// @}
+	
+	/// Maximum gap between two strips for them to be read with a single vectored read, in bytes.
+	inline constexpr u64 max_strip_gap = 65536;
+	
+	/// TIFF image.
+	struct image
+	{
+		/// `true` if the image data is in native byte order, `false` otherwise.
+		bool native_endian{true};
+		
+		/// `true` if the image is a reduced-resolution version of another image, `false` otherwise.
+		bool reduced_resolution{false};
+		
+		/// Image dimensions, in pixels. @{
+		u32 width{0};
+		u32 height{0};
+		/// @}
+		
+		/// Pixel format. @{
+		u32 bits_per_sample{0};
+		u32 samples_per_pixel{1};
+		u32 sample_format{static_cast<u32>(voxel_format::unsigned_integer)};
+		/// @}
+		
+		/// Compression scheme.
+		u32 compression{uncompressed};
+		
+		/// Prediction scheme applied before compression.
+		u32 predictor{no_prediction};
+		
+		/// Number of rows in each strip, except possibly the last.
+		u32 rows_per_strip{~u32{0}};
+		
+		/// Tile dimensions, in pixels, or zero if the image is stored in strips. @{
+		u32 tile_width{0};
+		u32 tile_length{0};
+		/// @}
+		
+		/// File offset and size of each strip or tile, in bytes. @{
+		std::vector<u64> block_offsets;
+		std::vector<u64> block_byte_counts;
+		/// @}
+		
+		/// Returns the size of a row of pixels, in bytes.
+		[[nodiscard]] std::size_t row_size() const noexcept
+		{
+			return std::size_t{width} * samples_per_pixel * (bits_per_sample >> 3);
+		}
+		
+		/// Returns `true` if the image is stored in tiles, `false` if it is stored in strips.
+		[[nodiscard]] bool tiled() const noexcept
+		{
+			return tile_width != 0;
+		}
+		
+		/// Returns the number of rows in a strip.
+		[[nodiscard]] u32 strip_rows(std::size_t i) const noexcept
+		{
+			const u32 rows = std::min(rows_per_strip, height);
+			return static_cast<u32>(std::min<u64>(rows, height - u64{rows} * i));
+		}
+		
+		/// Returns the number of tiles in each row of tiles.
+		[[nodiscard]] u32 tiles_across() const noexcept
+		{
+			return static_cast<u32>((u64{width} + tile_width - 1) / tile_width);
+		}
+		
+		/// Returns the number of strips or tiles required to cover the image.
+		[[nodiscard]] std::size_t block_count() const noexcept
+		{
+			if (tiled())
+			{
+				return std::size_t{tiles_across()} * ((u64{height} + tile_length - 1) / tile_length);
+			}
+			
+			const u32 rows = std::max(std::min(rows_per_strip, height), 1u);
+			return (std::size_t{height} + rows - 1) / rows;
+		}
+	};
+	
+	/// TIFF file contents held in memory, with the same read interface as `input_file`.
+	struct memory_file
+	{
+		/// File contents.
+		std::span<const std::byte> data;
+		
+		/// Returns the size of the file, in bytes.
+		[[nodiscard]] u64 size() const noexcept
+		{
+			return data.size();
+		}
+		
+		/// Reads bytes from the file.
+		void read(u64 offset, std::span<std::byte> buffer) const
+		{
+			if (offset > data.size() || buffer.size() > data.size() - offset)
+			{
+				throw std::runtime_error("failed to read file");
+			}
+			std::memcpy(buffer.data(), data.data() + offset, buffer.size());
+		}
+		
+		/// Reads a contiguous range of bytes from the file, scattering them across multiple buffers.
+		void read(u64 offset, std::span<const std::span<std::byte>> buffers) const
+		{
+			for (const auto& buffer: buffers)
+			{
+				read(offset, buffer);
+				offset += buffer.size();
+			}
+		}
+	};
+	
+	/// TIFF file mapped into memory while a Z-slice accessed in place is in use.
+	struct mapping
+	{
+		/// Mapped file contents, which are unmapped once released.
+		std::shared_ptr<const std::byte[]> data;
+		
+		/// Reader of the mapped file contents.
+		memory_file file;
+		
+		/// Number of accesses of the mapped file contents which have not been released.
+		u32 reference_count{0};
+		
+		/// Mutex which guards the mapping.
+		std::mutex mutex;
+		
+		/// Releases an access of the mapped file contents, unmapping the file once no access remains.
+		void release()
+		{
+			std::shared_ptr<const std::byte[]> released;
+			std::lock_guard lock(mutex);
+			if (!--reference_count)
+			{
+				released = std::move(data);
+				file.data = {};
+			}
+		}
+	};
+	
 	/// Returns a sequence of TIFF files in a directory.
 	[[nodiscard]] std::vector<fs::path> find_files(const fs::path& path)
 	{
@@ -70,161 +251,798 @@ namespace tiff
 		
 		return files;
 	}
-}
-
-std::unique_ptr<std::byte[]> load_volume(const fs::path& path, u32& width, u32& height, u32& depth, u32& bits_per_voxel)
-{
-	const auto files = tiff::find_files(path);
-	if (files.empty())
+	
+	/// Loads an integer stored in file byte order.
+	template <class T>
+	[[nodiscard]] T load(const std::byte* data, bool native_endian) noexcept
 	{
-		throw std::runtime_error("file not found");
+		T x;
+		std::memcpy(&x, data, sizeof(x));
+		return native_endian ? x : std::byteswap(x);
 	}
 	
-	// Open first TIFF file in the sequence
-	std::ifstream file(files.front(), std::ios::binary);
-
-	if (!file.is_open())
+	/// Reads the header of a TIFF or BigTIFF file.
+	template <class File>
+	[[nodiscard]] header read_header(const File& file)
 	{
-		throw std::runtime_error("failed to open file");
+		std::array<std::byte, 16> data;
+		file.read(0, std::span{data}.first(8));
+		
+		// Check byte order
+		u16 byte_order;
+		std::memcpy(&byte_order, data.data(), sizeof(byte_order));
+		if (byte_order != little_endian && byte_order != big_endian)
+		{
+			throw std::runtime_error("unsupported byte order");
+		}
+		
+		header h;
+		h.native_endian = (std::endian::native == std::endian::little) == (byte_order == little_endian);
+		
+		// Check magic number, then read the offset to the first IFD
+		const u16 version = load<u16>(data.data() + 2, h.native_endian);
+		if (version == magic)
+		{
+			h.ifd_offset = load<u32>(data.data() + 4, h.native_endian);
+		}
+		else if (version == big_magic)
+		{
+			file.read(8, std::span{data}.subspan(8));
+			if (load<u16>(data.data() + 4, h.native_endian) != sizeof(u64) || load<u16>(data.data() + 6, h.native_endian) != 0)
+			{
+				throw std::runtime_error("unsupported offset size");
+			}
+			
+			h.big = true;
+			h.ifd_offset = load<u64>(data.data() + 8, h.native_endian);
+		}
+		else
+		{
+			throw std::runtime_error("invalid magic number");
+		}
+		
+		return h;
 	}
 	
-	// Read the TIFF header
-	tiff::header header;
-	file.read(reinterpret_cast<char*>(&header), sizeof(header));
+	/// Reads the entries of an IFD, and the offset to the next IFD.
+	template <class File>
+	[[nodiscard]] std::vector<ifd_entry> read_ifd(const File& file, const header& h, u64 ifd_offset, u64& next_ifd_offset)
+	{
+		const std::size_t count_size = h.big ? sizeof(u64) : sizeof(u16);
+		const std::size_t entry_size = h.big ? 20 : 12;
+		const std::size_t offset_size = h.big ? sizeof(u64) : sizeof(u32);
+		
+		// Read IFD entry count
+		std::array<std::byte, 8> count_data;
+		file.read(ifd_offset, std::span{count_data}.first(count_size));
+		const u64 entry_count = h.big ? load<u64>(count_data.data(), h.native_endian) : load<u16>(count_data.data(), h.native_endian);
+		if (entry_count > file.size() / entry_size)
+		{
+			throw std::runtime_error("invalid IFD");
+		}
+		
+		// Read IFD entries, followed by the offset to the next IFD
+		std::vector<std::byte> data(entry_count * entry_size + offset_size);
+		file.read(ifd_offset + count_size, data);
+		
+		std::vector<ifd_entry> entries(entry_count);
+		for (std::size_t i = 0; i < entries.size(); ++i)
+		{
+			const std::byte* entry_data = data.data() + i * entry_size;
+			auto& entry = entries[i];
+			entry.tag = load<u16>(entry_data, h.native_endian);
+			entry.type = load<u16>(entry_data + 2, h.native_endian);
+			entry.count = h.big ? load<u64>(entry_data + 4, h.native_endian) : load<u32>(entry_data + 4, h.native_endian);
+			entry.value.fill(std::byte{0});
+			std::memcpy(entry.value.data(), entry_data + entry_size - offset_size, offset_size);
+		}
+		
+		const std::byte* next_data = data.data() + entry_count * entry_size;
+		next_ifd_offset = h.big ? load<u64>(next_data, h.native_endian) : load<u32>(next_data, h.native_endian);
+		
+		return entries;
+	}
 	
-	// Check byte order
-	if (header.byte_order != tiff::little_endian && header.byte_order != tiff::big_endian)
+	/// Reads the values of a BYTE, SHORT, LONG, or LONG8 IFD entry.
+	template <class File>
+	[[nodiscard]] std::vector<u64> read_values(const File& file, const ifd_entry& entry, const header& h)
 	{
-		throw std::runtime_error("unsupported byte order");
+		std::size_t value_size;
+		switch (entry.type)
+		{
+			case type_byte:
+				value_size = 1;
+				break;
+			case type_short:
+				value_size = 2;
+				break;
+			case type_long:
+			case type_ifd:
+				value_size = 4;
+				break;
+			case type_long8:
+			case type_ifd8:
+				value_size = 8;
+				break;
+			default:
+				throw std::runtime_error("unsupported field type");
+		}
+		
+		if (entry.count > file.size() / value_size)
+		{
+			throw std::runtime_error("invalid field count");
+		}
+		
+		// Values are stored in place of the offset if they fit
+		std::vector<std::byte> data(value_size * entry.count);
+		if (data.size() <= (h.big ? sizeof(u64) : sizeof(u32)))
+		{
+			std::memcpy(data.data(), entry.value.data(), data.size());
+		}
+		else
+		{
+			file.read(h.big ? load<u64>(entry.value.data(), h.native_endian) : load<u32>(entry.value.data(), h.native_endian), data);
+		}
+		
+		std::vector<u64> values(entry.count);
+		for (std::size_t i = 0; i < values.size(); ++i)
+		{
+			const std::byte* value = data.data() + i * value_size;
+			switch (value_size)
+			{
+				case 1:
+					values[i] = std::to_integer<u64>(*value);
+					break;
+				case 2:
+					values[i] = load<u16>(value, h.native_endian);
+					break;
+				case 4:
+					values[i] = load<u32>(value, h.native_endian);
+					break;
+				default:
+					values[i] = load<u64>(value, h.native_endian);
+					break;
+			}
+		}
+		
+		return values;
 	}
 	
-	bool native_endian = true;
-	if ((std::endian::native == std::endian::little) == (header.byte_order == tiff::big_endian))
+	/// Reads the value of a single-valued IFD entry.
+	template <class File>
+	[[nodiscard]] u32 read_value(const File& file, const ifd_entry& entry, const header& h)
 	{
-		native_endian = false;
-		header.magic = std::byteswap(header.magic);
-		header.ifd_offset = std::byteswap(header.ifd_offset);
+		const auto values = read_values(file, entry, h);
+		if (values.empty())
+		{
+			throw std::runtime_error("missing field value");
+		}
+		return static_cast<u32>(values.front());
 	}
-
-	// Check magic number
-	if (header.magic != tiff::magic)
+	
+	/// Reads the image described by an IFD, and the offset to the next IFD.
+	template <class File>
+	[[nodiscard]] image read_image(const File& file, const header& h, u64 ifd_offset, u64& next_ifd_offset)
 	{
-		throw std::runtime_error("invalid magic number");
+		image img;
+		img.native_endian = h.native_endian;
+		
+		// Process entries
+		for (const auto& entry: read_ifd(file, h, ifd_offset, next_ifd_offset))
+		{
+			switch (entry.tag)
+			{
+				case new_subfile_type:
+					img.reduced_resolution = read_value(file, entry, h) & 1;
+					break;
+				case image_width:
+					img.width = read_value(file, entry, h);
+					break;
+				case image_height:
+					img.height = read_value(file, entry, h);
+					break;
+				case bits_per_sample:
+					img.bits_per_sample = read_value(file, entry, h);
+					break;
+				case samples_per_pixel:
+					img.samples_per_pixel = read_value(file, entry, h);
+					break;
+				case sample_format:
+					img.sample_format = read_value(file, entry, h);
+					break;
+				case compression:
+					img.compression = read_value(file, entry, h);
+					break;
+				case predictor:
+					img.predictor = read_value(file, entry, h);
+					break;
+				case rows_per_strip:
+					img.rows_per_strip = read_value(file, entry, h);
+					break;
+				case tile_width:
+					img.tile_width = read_value(file, entry, h);
+					break;
+				case tile_length:
+					img.tile_length = read_value(file, entry, h);
+					break;
+				case strip_offsets:
+				case tile_offsets:
+					img.block_offsets = read_values(file, entry, h);
+					break;
+				case strip_byte_counts:
+				case tile_byte_counts:
+					img.block_byte_counts = read_values(file, entry, h);
+					break;
+				default:
+					break;
+			}
+		}
+		
+		if (!img.width || !img.height)
+		{
+			throw std::runtime_error("image has invalid dimensions");
+		}
+		if (img.compression != uncompressed && img.compression != lzw && img.compression != adobe_deflate && img.compression != deflate && img.compression != packbits)
+		{
+			throw std::runtime_error("unsupported compression scheme");
+		}
+		if (img.predictor != no_prediction && (img.compression == uncompressed || (img.predictor != horizontal_differencing && img.predictor != floating_point_prediction)))
+		{
+			throw std::runtime_error("unsupported predictor");
+		}
+		if (img.samples_per_pixel != 1)
+		{
+			throw std::runtime_error("multi-channel images not supported");
+		}
+		if (!img.rows_per_strip)
+		{
+			throw std::runtime_error("invalid rows per strip");
+		}
+		if (!img.tile_width != !img.tile_length)
+		{
+			throw std::runtime_error("invalid tile dimensions");
+		}
+		if (!img.bits_per_sample || img.bits_per_sample % 8)
+		{
+			throw std::runtime_error("unsupported bits per sample");
+		}
+		if (img.block_offsets.size() < img.block_count() || ((!img.block_byte_counts.empty() || img.compression != uncompressed) && img.block_byte_counts.size() < img.block_count()))
+		{
+			throw std::runtime_error(img.tiled() ? "missing tiles" : "missing strips");
+		}
+		
+		return img;
 	}
 	
-	// Set the file position to the IFD offset
-	file.seekg(header.ifd_offset, std::ios::beg);
-
-	// Read IFD entry count
-	u16 ifd_entry_count;
-	file.read(reinterpret_cast<char*>(&ifd_entry_count), sizeof(u16));
-	if (!native_endian)
+	/// Reads the first image of a TIFF file.
+	template <class File>
+	[[nodiscard]] image read_image(const File& file)
 	{
-		ifd_entry_count = std::byteswap(ifd_entry_count);
+		const auto h = read_header(file);
+		u64 next_ifd_offset;
+		return read_image(file, h, h.ifd_offset, next_ifd_offset);
 	}
 	
-	// Read IFD entries
-	std::vector<tiff::ifd_entry> entries(ifd_entry_count);
-	file.read(reinterpret_cast<char*>(entries.data()), entries.size() * sizeof(tiff::ifd_entry));
-	if (!native_endian)
+	/// Reads every full-resolution image of a TIFF file, in order.
+	template <class File>
+	[[nodiscard]] std::vector<image> read_images(const File& file)
 	{
-		for (auto& entry: entries)
+		const auto h = read_header(file);
+		
+		std::vector<image> images;
+		std::set<u64> visited;
+		for (u64 ifd_offset = h.ifd_offset; ifd_offset; )
 		{
-			entry.tag = std::byteswap(entry.tag);
-			entry.type = std::byteswap(entry.type);
-			entry.count = std::byteswap(entry.count);
-			entry.offset = std::byteswap(entry.offset);
+			if (!visited.insert(ifd_offset).second)
+			{
+				throw std::runtime_error("cyclic IFD chain");
+			}
+			
+			auto img = read_image(file, h, ifd_offset, ifd_offset);
+			if (!img.reduced_resolution)
+			{
+				images.emplace_back(std::move(img));
+			}
 		}
+		
+		return images;
 	}
 	
-	width = 0;
-	height = 0;
-	depth = static_cast<u32>(files.size());
-	bits_per_voxel = 0; 
-	u32 compression = tiff::uncompressed;
-	u32 strips_offset = sizeof(header);
+	/// Checks if the strips of an image are stored contiguously and in order.
+	[[nodiscard]] bool strips_contiguous(const image& img) noexcept
+	{
+		u64 offset = img.block_offsets.front();
+		for (std::size_t i = 0; i < img.block_count(); ++i)
+		{
+			if (img.block_offsets[i] != offset)
+			{
+				return false;
+			}
+			offset += img.row_size() * img.strip_rows(i);
+		}
+		return true;
+	}
 	
-	// Process entries
-	for (const auto& entry: entries)
+	/// Reads ranges of a file into buffers, coalescing ranges separated by small gaps into vectored reads.
+	template <class File>
+	void read_ranges(const File& file, std::vector<std::pair<u64, std::span<std::byte>>>& ranges)
 	{
-		switch (entry.tag)
+		std::ranges::sort(ranges, {}, [](const auto& range) { return range.first; });
+		
+		// Read runs of ranges, discarding the gaps between them
+		std::vector<std::byte> gap_buffer;
+		std::vector<std::span<std::byte>> buffers;
+		for (std::size_t i = 0; i < ranges.size();)
 		{
-			case tiff::image_width:
-				width = entry.offset;
-				break;
-			case tiff::image_height:
-				height = entry.offset;
+			const u64 run_offset = ranges[i].first;
+			u64 run_end = run_offset + ranges[i].second.size();
+			buffers.assign(1, ranges[i].second);
+			
+			for (++i; i < ranges.size() && ranges[i].first >= run_end && ranges[i].first - run_end <= max_strip_gap; ++i)
+			{
+				if (const u64 gap = ranges[i].first - run_end)
+				{
+					gap_buffer.resize(max_strip_gap);
+					buffers.emplace_back(gap_buffer.data(), static_cast<std::size_t>(gap));
+				}
+				buffers.emplace_back(ranges[i].second);
+				run_end = ranges[i].first + ranges[i].second.size();
+			}
+			
+			file.read(run_offset, buffers);
+		}
+	}
+	
+	/// Reads the compressed strips or tiles of an image, in place if the file is already in memory.
+	template <class File>
+	[[nodiscard]] std::vector<std::span<const std::byte>> read_compressed_blocks(const File& file, const image& img, std::vector<std::byte>& compressed_data)
+	{
+		const std::size_t block_count = img.block_count();
+		for (std::size_t i = 0; i < block_count; ++i)
+		{
+			if (img.block_offsets[i] > file.size() || img.block_byte_counts[i] > file.size() - img.block_offsets[i])
+			{
+				throw std::runtime_error(img.tiled() ? "truncated tile" : "truncated strip");
+			}
+		}
+		
+		std::vector<std::span<const std::byte>> blocks(block_count);
+		if constexpr (std::is_same_v<File, memory_file>)
+		{
+			for (std::size_t i = 0; i < block_count; ++i)
+			{
+				blocks[i] = file.data.subspan(img.block_offsets[i], img.block_byte_counts[i]);
+			}
+		}
+		else
+		{
+			u64 compressed_size = 0;
+			for (std::size_t i = 0; i < block_count; ++i)
+			{
+				compressed_size += img.block_byte_counts[i];
+			}
+			compressed_data.resize(compressed_size);
+			
+			std::vector<std::pair<u64, std::span<std::byte>>> ranges(block_count);
+			for (std::size_t i = 0, offset = 0; i < block_count; offset += img.block_byte_counts[i], ++i)
+			{
+				ranges[i] = {img.block_offsets[i], {compressed_data.data() + offset, img.block_byte_counts[i]}};
+				blocks[i] = ranges[i].second;
+			}
+			read_ranges(file, ranges);
+		}
+		
+		return blocks;
+	}
+	
+	/// Decompresses a strip or tile.
+	void decompress_block(u32 scheme, std::span<const std::byte> source, std::span<std::byte> destination)
+	{
+		switch (scheme)
+		{
+			case lzw:
+				decompress_lzw(source, destination);
 				break;
-			case tiff::bits_per_sample:
-				bits_per_voxel = entry.offset;
+			case adobe_deflate:
+			case deflate:
+				decompress_deflate(source, destination);
 				break;
-			case tiff::compression:
-				compression = entry.offset;
+			case packbits:
+				decompress_packbits(source, destination);
 				break;
-			case tiff::strip_offsets:
-				if (entry.count == 1)
+			default:
+				throw std::runtime_error("unsupported compression scheme");
+		}
+	}
+	
+	/// Reverses horizontal differencing of the samples in each row of an image.
+	template <class T>
+	void undo_horizontal_differencing(std::byte* data, u32 width, u32 height) noexcept
+	{
+		for (u32 y = 0; y < height; ++y)
+		{
+			std::byte* row = data + std::size_t{width} * sizeof(T) * y;
+			
+			T sum;
+			std::memcpy(&sum, row, sizeof(T));
+			for (u32 x = 1; x < width; ++x)
+			{
+				T difference;
+				std::memcpy(&difference, row + x * sizeof(T), sizeof(T));
+				sum = static_cast<T>(sum + difference);
+				std::memcpy(row + x * sizeof(T), &sum, sizeof(T));
+			}
+		}
+	}
+	
+	/// Reverses floating-point prediction of the samples in each row of an image, which differences the bytes of each row after grouping them by significance, most significant first.
+	void undo_floating_point_prediction(std::byte* data, u32 width, u32 height, std::size_t sample_size)
+	{
+		const std::size_t row_size = std::size_t{width} * sample_size;
+		std::vector<std::byte> row_buffer(row_size);
+		
+		for (u32 y = 0; y < height; ++y)
+		{
+			std::byte* row = data + row_size * y;
+			
+			u8 sum = 0;
+			for (std::size_t i = 0; i < row_size; ++i)
+			{
+				sum = static_cast<u8>(sum + std::to_integer<u8>(row[i]));
+				row_buffer[i] = std::byte{sum};
+			}
+			
+			// Interleave bytes into native-endian samples
+			for (std::size_t x = 0; x < width; ++x)
+			{
+				for (std::size_t i = 0; i < sample_size; ++i)
 				{
-					strips_offset = entry.offset;
+					const std::size_t byte_index = std::endian::native == std::endian::little ? sample_size - 1 - i : i;
+					row[x * sample_size + byte_index] = row_buffer[i * width + x];
 				}
-				else
+			}
+		}
+	}
+	
+	/// Swaps the byte order of each sample in a buffer.
+	void swap_bytes(std::byte* data, std::size_t size, std::size_t sample_size) noexcept
+	{
+		for (std::size_t i = 0; i + sample_size <= size; i += sample_size)
+		{
+			std::reverse(data + i, data + i + sample_size);
+		}
+	}
+	
+	/// Converts the decompressed samples of a strip or tile to native byte order, reversing prediction.
+	void decode_samples(const image& img, std::byte* data, u32 width, u32 height)
+	{
+		const std::size_t sample_size = img.bits_per_sample >> 3;
+		
+		if (img.predictor == floating_point_prediction)
+		{
+			undo_floating_point_prediction(data, width, height, sample_size);
+			return;
+		}
+		if (!img.native_endian)
+		{
+			swap_bytes(data, std::size_t{width} * height * sample_size, sample_size);
+		}
+		if (img.predictor == horizontal_differencing)
+		{
+			switch (sample_size)
+			{
+				case 1:
+					undo_horizontal_differencing<u8>(data, width, height);
+					break;
+				case 2:
+					undo_horizontal_differencing<u16>(data, width, height);
+					break;
+				case 4:
+					undo_horizontal_differencing<u32>(data, width, height);
+					break;
+				case 8:
+					undo_horizontal_differencing<u64>(data, width, height);
+					break;
+				default:
+					throw std::runtime_error("unsupported predictor");
+			}
+		}
+	}
+	
+	/// Reads the strips of an image into a buffer, decompressing them and converting their samples to native byte order.
+	template <class File>
+	void read_strips(const File& file, const image& img, std::byte* buffer)
+	{
+		const std::size_t row_size = img.row_size();
+		const std::size_t strip_count = img.block_count();
+		const std::size_t full_strip_rows = std::min(img.rows_per_strip, img.height);
+		
+		// Returns the destination of a strip
+		auto strip_data = [&](std::size_t i) -> std::span<std::byte>
+		{
+			return {buffer + row_size * full_strip_rows * i, row_size * img.strip_rows(i)};
+		};
+		
+		if (img.compression == uncompressed)
+		{
+			// Read strips directly into the buffer
+			std::vector<std::pair<u64, std::span<std::byte>>> strips(strip_count);
+			for (std::size_t i = 0; i < strip_count; ++i)
+			{
+				strips[i] = {img.block_offsets[i], strip_data(i)};
+				if (!img.block_byte_counts.empty() && img.block_byte_counts[i] < strips[i].second.size())
 				{
-					file.seekg(entry.offset, std::ios::beg);
-					file.read(reinterpret_cast<char*>(&strips_offset), sizeof(u32));
+					throw std::runtime_error("truncated strip");
 				}
-				break;
-			default:
-				break;
+			}
+			read_ranges(file, strips);
+		}
+		else
+		{
+			std::vector<std::byte> compressed_data;
+			const auto compressed_strips = read_compressed_blocks(file, img, compressed_data);
+			for (std::size_t i = 0; i < strip_count; ++i)
+			{
+				decompress_block(img.compression, compressed_strips[i], strip_data(i));
+			}
+		}
+		
+		// Strips span whole rows, so their samples can be decoded all at once
+		decode_samples(img, buffer, img.width, img.height);
+	}
+	
+	/// Reads the tiles of an image into a buffer, decompressing them, converting their samples to native byte order, and cropping them to the image.
+	template <class File>
+	void read_tiles(const File& file, const image& img, std::byte* buffer)
+	{
+		const std::size_t row_size = img.row_size();
+		const std::size_t sample_size = img.bits_per_sample >> 3;
+		const std::size_t tile_row_size = std::size_t{img.tile_width} * sample_size;
+		const std::size_t tile_size = tile_row_size * img.tile_length;
+		const std::size_t tile_count = img.block_count();
+		const u32 tiles_across = img.tiles_across();
+		
+		// Returns the position of a tile within the image, and the size of the region it covers
+		auto tile_region = [&](std::size_t i)
+		{
+			const u32 x = static_cast<u32>(i % tiles_across) * img.tile_width;
+			const u32 y = static_cast<u32>(i / tiles_across) * img.tile_length;
+			return std::array<u32, 4>{x, y, std::min(img.tile_width, img.width - x), std::min(img.tile_length, img.height - y)};
+		};
+		
+		if (img.compression == uncompressed)
+		{
+			// Read the visible part of each row of each tile directly into the buffer
+			std::vector<std::pair<u64, std::span<std::byte>>> rows;
+			for (std::size_t i = 0; i < tile_count; ++i)
+			{
+				if (!img.block_byte_counts.empty() && img.block_byte_counts[i] < tile_size)
+				{
+					throw std::runtime_error("truncated tile");
+				}
+				
+				const auto [x, y, width, height] = tile_region(i);
+				for (u32 row = 0; row < height; ++row)
+				{
+					rows.emplace_back(img.block_offsets[i] + tile_row_size * row, std::span{buffer + row_size * (y + row) + sample_size * x, sample_size * width});
+				}
+			}
+			read_ranges(file, rows);
+			
+			decode_samples(img, buffer, img.width, img.height);
+		}
+		else
+		{
+			std::vector<std::byte> compressed_data;
+			const auto compressed_tiles = read_compressed_blocks(file, img, compressed_data);
+			
+			// Tiles are predicted independently, so their samples are decoded before cropping
+			std::vector<std::byte> tile(tile_size);
+			for (std::size_t i = 0; i < tile_count; ++i)
+			{
+				decompress_block(img.compression, compressed_tiles[i], tile);
+				decode_samples(img, tile.data(), img.tile_width, img.tile_length);
+				
+				const auto [x, y, width, height] = tile_region(i);
+				for (u32 row = 0; row < height; ++row)
+				{
+					std::memcpy(buffer + row_size * (y + row) + sample_size * x, tile.data() + tile_row_size * row, sample_size * width);
+				}
+			}
 		}
 	}
 	
-	if (!width || !height)
+	/// Reads the pixels of an image into a buffer, in native byte order.
+	template <class File>
+	void read_pixels(const File& file, const image& img, std::byte* buffer)
 	{
-		throw std::runtime_error("image has invalid dimensions");
+		if (img.tiled())
+		{
+			read_tiles(file, img, buffer);
+		}
+		else
+		{
+			read_strips(file, img, buffer);
+		}
 	}
-	if (compression != tiff::uncompressed)
+	
+	/// Returns a pointer to the pixels of an image in a mapped file, if they are stored contiguously in native byte order, or reads them into a buffer otherwise.
+	[[nodiscard]] const std::byte* map_pixels(const memory_file& file, const image& img, std::byte* buffer)
 	{
-		throw std::runtime_error("compressed images not supported");
+		const std::size_t sample_size = img.bits_per_sample >> 3;
+		if (img.native_endian && img.compression == uncompressed && !img.tiled() && strips_contiguous(img) && img.block_offsets.front() % sample_size == 0 && img.block_offsets.front() <= file.size() && img.row_size() * img.height <= file.size() - img.block_offsets.front())
+		{
+			return file.data.data() + img.block_offsets.front();
+		}
+		
+		read_pixels(file, img, buffer);
+		return buffer;
 	}
 	
-	const std::size_t bytes_per_voxel = bits_per_voxel >> 3;
-	const std::size_t slice_size_bytes = width * height * bytes_per_voxel;
+	/// Checks that the image of a Z-slice matches the format of the first Z-slice.
+	void check_slice(const image& img, const image& first_image)
+	{
+		if (img.width != first_image.width || img.height != first_image.height || img.bits_per_sample != first_image.bits_per_sample || img.sample_format != first_image.sample_format)
+		{
+			throw std::runtime_error("inconsistent Z-slice format");
+		}
+	}
 	
-	// Allocate voxels
-	const std::size_t volume_size_bytes = slice_size_bytes * depth;
-	auto voxels = std::make_unique<std::byte[]>(volume_size_bytes);
+	/// Reads the image of a Z-slice into a buffer, in native byte order.
+	template <class File>
+	void read_slice(const File& file, const image& first_image, std::byte* buffer)
+	{
+		const auto img = read_image(file);
+		check_slice(img, first_image);
+		read_pixels(file, img, buffer);
+	}
 	
-	// Load first Z-slice
-	file.seekg(strips_offset, std::ios::beg);
-	file.read(reinterpret_cast<char*>(voxels.get()), slice_size_bytes);
-	file.close();
+	/// Returns a volume with the dimensions and format of its first Z-slice.
+	[[nodiscard]] volume make_volume(const image& first_image, std::size_t depth)
+	{
+		volume source;
+		source.width = first_image.width;
+		source.height = first_image.height;
+		source.depth = static_cast<u32>(depth);
+		source.bits_per_voxel = first_image.bits_per_sample;
+		source.format = static_cast<voxel_format>(first_image.sample_format);
+		return source;
+	}
 	
-	// Load remaining Z-slices in parallel
-	const std::ranges::iota_view file_indices(std::size_t{1}, files.size());
-	std::for_each
-	(
-		std::execution::par_unseq,
-		file_indices.begin(),
-		file_indices.end(),
-		[&](std::size_t i)
+	/// Opens a volume stored as a sequence of TIFF files, one per Z-slice.
+	[[nodiscard]] volume open_sequence(std::vector<fs::path> files, const image& first_image, bool map)
+	{
+		volume source = make_volume(first_image, files.size());
+		const std::size_t slice_size_bytes = source.slice_size();
+		
+		if (map)
 		{
-			std::ifstream file(files[i], std::ios::binary);
-			if (!file.is_open())
+			auto mappings = std::make_shared<std::vector<mapping>>(files.size());
+			
+			// Map each TIFF file while it is accessed. Native-endian Z-slices with contiguous, aligned strips are accessed in place until they are released, while other Z-slices are read into the buffer and unmapped at once
+			source.read_slice = [files = std::move(files), mappings, first_image](u32 z, std::byte* buffer) -> const std::byte*
 			{
-				throw std::runtime_error("failed to open file");
-			}
+				auto& slice_mapping = (*mappings)[z];
+				{
+					std::lock_guard lock(slice_mapping.mutex);
+					if (!slice_mapping.data)
+					{
+						std::size_t file_size;
+						slice_mapping.data = map_file(files[z], file_size);
+						slice_mapping.file.data = {slice_mapping.data.get(), file_size};
+					}
+					++slice_mapping.reference_count;
+				}
+				
+				const std::byte* slice;
+				try
+				{
+					const auto img = read_image(slice_mapping.file);
+					check_slice(img, first_image);
+					slice = map_pixels(slice_mapping.file, img, buffer);
+				}
+				catch (...)
+				{
+					slice_mapping.release();
+					throw;
+				}
+				
+				if (slice == buffer)
+				{
+					slice_mapping.release();
+				}
+				return slice;
+			};
+			source.release_slice = [mappings](u32 z)
+			{
+				(*mappings)[z].release();
+			};
 			
-			file.seekg(strips_offset, std::ios::beg);
-			file.read(reinterpret_cast<char*>(voxels.get()) + slice_size_bytes * i, slice_size_bytes);
+			return source;
 		}
-	);
+		
+		auto shared_files = std::make_shared<const std::vector<fs::path>>(std::move(files));
+		
+		// Read Z-slices from their TIFF files on demand
+		source.read_slice = [files = shared_files, first_image](u32 z, std::byte* buffer) -> const std::byte*
+		{
+			read_slice(input_file((*files)[z]), first_image, buffer);
+			return buffer;
+		};
+		
+		// Read whole TIFF files asynchronously when loading all Z-slices
+		source.read_slices = [files = shared_files, first_image, slice_size_bytes](std::byte* voxels, u32 thread_count, u32 queue_depth)
+		{
+			read_files
+			(
+				*files,
+				thread_count,
+				queue_depth,
+				[&](std::size_t z, std::span<const std::byte> contents)
+				{
+					read_slice(memory_file{contents}, first_image, voxels + slice_size_bytes * z);
+				}
+			);
+		};
+		
+		return source;
+	}
+	
+	/// Opens a volume stored as a multi-page TIFF file, one page per Z-slice.
+	[[nodiscard]] volume open_stack(const fs::path& path, std::vector<image> pages, bool map)
+	{
+		for (const auto& page: pages)
+		{
+			check_slice(page, pages.front());
+		}
+		
+		volume source = make_volume(pages.front(), pages.size());
+		auto shared_pages = std::make_shared<const std::vector<image>>(std::move(pages));
+		
+		if (map)
+		{
+			std::size_t file_size;
+			auto data = map_file(path, file_size);
+			
+			// Access native-endian pages with contiguous, aligned strips in place
+			source.read_slice = [data, file = memory_file{{data.get(), file_size}}, pages = shared_pages](u32 z, std::byte* buffer) -> const std::byte*
+			{
+				return map_pixels(file, (*pages)[z], buffer);
+			};
+			
+			return source;
+		}
+		
+		// Read pages from the TIFF file on demand
+		source.read_slice = [file = std::make_shared<const input_file>(path), pages = shared_pages](u32 z, std::byte* buffer) -> const std::byte*
+		{
+			read_pixels(*file, (*pages)[z], buffer);
+			return buffer;
+		};
+		
+		return source;
+	}
+}
+
+volume open_volume(const fs::path& path, bool map)
+{
+	auto files = tiff::find_files(path);
+	if (files.empty())
+	{
+		throw std::runtime_error("file not found");
+	}
 	
-	if (!native_endian && bytes_per_voxel > 1)
+	// A single TIFF file, or a TIFF file named by the path, with multiple pages holds the whole volume
+	if (files.size() == 1 || fs::is_regular_file(path))
 	{
-		for (std::size_t i = 0; i < volume_size_bytes; i += bytes_per_voxel)
+		const fs::path stack_path = fs::is_regular_file(path) ? path : files.front();
+		if (auto pages = tiff::read_images(input_file(stack_path)); pages.size() > 1)
 		{
-			std::reverse(voxels.get() + i, voxels.get() + i + bytes_per_voxel);
+			return tiff::open_stack(stack_path, std::move(pages), map);
 		}
 	}
 	
-	return voxels;
+	// Otherwise, read the first image in the sequence to determine the volume format
+	const auto first_image = tiff::read_image(input_file(files.front()));
+	return tiff::open_sequence(std::move(files), first_image, map);
 }
@@ -0,0 +1,396 @@
+// SPDX-FileCopyrightText: 2023 C. J. Howard
+// SPDX-License-Identifier: MIT
+
+#include "siafu.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+namespace
+{
+	/// Number of entries in the simulated vertex cache.
+	inline constexpr std::size_t cache_size = 32;
+	
+	/// Maximum number of triangles reordered as one range. Ranges are contiguous runs of rows of the isosurface, and are reordered concurrently.
+	inline constexpr std::size_t range_size = std::size_t{1} << 16;
+	
+	/// Maximum number of remaining triangles distinguished by vertex scores.
+	inline constexpr std::size_t max_valence = 32;
+	
+	/// Marks a vertex which is not in the cache, or has not been assigned a position.
+	inline constexpr u32 invalid_index = std::numeric_limits<u32>::max();
+	
+	/// Vertex scores by position in the cache and by number of remaining triangles, as in Forsyth's "Linear-Speed Vertex Cache Optimisation".
+	struct score_table
+	{
+		f32 cache[cache_size];
+		f32 valence[max_valence + 1];
+		
+		score_table() noexcept
+		{
+			for (std::size_t i = 0; i < cache_size; ++i)
+			{
+				// Vertices of the most recent triangle score equally, such that the next triangle does not favour any of its edges
+				cache[i] = i < 3 ? 0.75f : std::pow(1.0f - static_cast<f32>(i - 3) / static_cast<f32>(cache_size - 3), 1.5f);
+			}
+			
+			// Boost vertices with few remaining triangles, such that they are finished rather than left as isolated triangles
+			valence[0] = 0.0f;
+			for (std::size_t i = 1; i <= max_valence; ++i)
+			{
+				valence[i] = 2.0f / std::sqrt(static_cast<f32>(i));
+			}
+		}
+		
+		/// Returns the score of a vertex, given its position in the cache and its number of remaining triangles.
+		[[nodiscard]] inline f32 score(u32 cache_position, u32 remaining) const noexcept
+		{
+			if (!remaining)
+			{
+				return -1.0f;
+			}
+			return (cache_position == invalid_index ? 0.0f : cache[cache_position]) + valence[std::min<std::size_t>(remaining, max_valence)];
+		}
+	};
+	
+	/// Range of triangles in a triangle chunk.
+	struct triangle_range
+	{
+		std::size_t first;
+		std::size_t count;
+		u64 vertex_base;
+	};
+	
+	/**
+	 * Reorders a range of triangles to improve vertex cache hit rates.
+	 *
+	 * @param[in,out] triangles Triangles to reorder, whose vertex indices are relative to a common base.
+	 * @param[in] scores Vertex score table.
+	 */
+	void reorder_triangles(std::span<triangle> triangles, const score_table& scores)
+	{
+		const std::size_t triangle_count = triangles.size();
+		
+		// Map vertex indices to a dense local range
+		std::vector<u32> vertex_ids(triangle_count * 3);
+		for (std::size_t i = 0; i < triangle_count; ++i)
+		{
+			vertex_ids[i * 3] = triangles[i].a;
+			vertex_ids[i * 3 + 1] = triangles[i].b;
+			vertex_ids[i * 3 + 2] = triangles[i].c;
+		}
+		std::vector<u32> local_corners(vertex_ids);
+		std::ranges::sort(vertex_ids);
+		vertex_ids.erase(std::unique(vertex_ids.begin(), vertex_ids.end()), vertex_ids.end());
+		for (auto& corner: local_corners)
+		{
+			corner = static_cast<u32>(std::ranges::lower_bound(vertex_ids, corner) - vertex_ids.begin());
+		}
+		const std::size_t vertex_count = vertex_ids.size();
+		
+		// Build lists of the triangles adjacent to each vertex. The first `remaining[v]` triangles of each list are not yet emitted
+		std::vector<u32> remaining(vertex_count, 0);
+		for (const u32 v: local_corners)
+		{
+			++remaining[v];
+		}
+		std::vector<u32> adjacency_offsets(vertex_count + 1, 0);
+		for (std::size_t v = 0; v < vertex_count; ++v)
+		{
+			adjacency_offsets[v + 1] = adjacency_offsets[v] + remaining[v];
+		}
+		std::vector<u32> adjacency(local_corners.size());
+		{
+			std::vector<u32> fill(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+			for (std::size_t i = 0; i < local_corners.size(); ++i)
+			{
+				adjacency[fill[local_corners[i]]++] = static_cast<u32>(i / 3);
+			}
+		}
+		
+		// Score vertices and triangles
+		std::vector<u32> cache_positions(vertex_count, invalid_index);
+		std::vector<f32> vertex_scores(vertex_count);
+		for (std::size_t v = 0; v < vertex_count; ++v)
+		{
+			vertex_scores[v] = scores.score(invalid_index, remaining[v]);
+		}
+		std::vector<f32> triangle_scores(triangle_count);
+		for (std::size_t i = 0; i < triangle_count; ++i)
+		{
+			triangle_scores[i] = vertex_scores[local_corners[i * 3]] + vertex_scores[local_corners[i * 3 + 1]] + vertex_scores[local_corners[i * 3 + 2]];
+		}
+		std::vector<bool> emitted(triangle_count, false);
+		
+		// Start with the highest-scoring triangle
+		std::size_t best = static_cast<std::size_t>(std::ranges::max_element(triangle_scores) - triangle_scores.begin());
+		
+		u32 cache[cache_size + 3];
+		std::size_t cache_count = 0;
+		std::vector<u32> order;
+		order.reserve(triangle_count);
+		std::size_t next_unemitted = 0;
+		while (order.size() < triangle_count)
+		{
+			// Emit the best triangle, and remove it from the adjacency lists of its vertices
+			order.emplace_back(static_cast<u32>(best));
+			emitted[best] = true;
+			const u32* corners = &local_corners[best * 3];
+			for (std::size_t k = 0; k < 3; ++k)
+			{
+				const u32 v = corners[k];
+				u32* adjacent = &adjacency[adjacency_offsets[v]];
+				const u32 count = remaining[v]--;
+				*std::find(adjacent, adjacent + count, static_cast<u32>(best)) = adjacent[count - 1];
+			}
+			
+			// Move the vertices of the triangle to the front of the cache, pushing other vertices back
+			u32 new_cache[cache_size + 3];
+			std::size_t new_cache_count = 0;
+			for (std::size_t k = 0; k < 3; ++k)
+			{
+				if (std::find(new_cache, new_cache + new_cache_count, corners[k]) == new_cache + new_cache_count)
+				{
+					new_cache[new_cache_count++] = corners[k];
+				}
+			}
+			for (std::size_t i = 0; i < cache_count; ++i)
+			{
+				const u32 v = cache[i];
+				if (v != corners[0] && v != corners[1] && v != corners[2])
+				{
+					new_cache[new_cache_count++] = v;
+				}
+			}
+			
+			// Rescore vertices whose cache position changed, including those evicted from the cache, and their remaining triangles
+			for (std::size_t i = 0; i < new_cache_count; ++i)
+			{
+				const u32 v = new_cache[i];
+				cache_positions[v] = i < cache_size ? static_cast<u32>(i) : invalid_index;
+				const f32 score = scores.score(cache_positions[v], remaining[v]);
+				const f32 delta = score - vertex_scores[v];
+				vertex_scores[v] = score;
+				
+				const u32* adjacent = &adjacency[adjacency_offsets[v]];
+				for (u32 j = 0; j < remaining[v]; ++j)
+				{
+					triangle_scores[adjacent[j]] += delta;
+				}
+			}
+			
+			// Find the best remaining triangle adjacent to the cache
+			best = triangle_count;
+			f32 best_score = -1.0f;
+			for (std::size_t i = 0; i < new_cache_count; ++i)
+			{
+				const u32 v = new_cache[i];
+				const u32* adjacent = &adjacency[adjacency_offsets[v]];
+				for (u32 j = 0; j < remaining[v]; ++j)
+				{
+					if (triangle_scores[adjacent[j]] > best_score)
+					{
+						best_score = triangle_scores[adjacent[j]];
+						best = adjacent[j];
+					}
+				}
+			}
+			cache_count = std::min(new_cache_count, cache_size);
+			std::copy_n(new_cache, cache_count, cache);
+			
+			// Fall back to the next triangle in scan order if no triangle adjacent to the cache remains
+			if (best == triangle_count)
+			{
+				while (next_unemitted < triangle_count && emitted[next_unemitted])
+				{
+					++next_unemitted;
+				}
+				best = next_unemitted;
+			}
+		}
+		
+		// Permute triangles
+		std::vector<triangle> reordered(triangle_count);
+		for (std::size_t i = 0; i < triangle_count; ++i)
+		{
+			reordered[i] = triangles[order[i]];
+		}
+		std::ranges::copy(reordered, triangles.begin());
+	}
+}
+
+void optimize_vertex_cache(mesh& model, u32 thread_count)
+{
+	auto& [vertices, triangles, chunks] = model;
+	if (triangles.empty())
+	{
+		return;
+	}
+	
+	// Split triangle chunks into ranges
+	std::vector<triangle_range> ranges;
+	std::size_t first_triangle = 0;
+	for (const auto& [triangle_count, vertex_base]: chunks)
+	{
+		for (std::size_t i = 0; i < triangle_count; i += range_size)
+		{
+			ranges.emplace_back(first_triangle + i, std::min(range_size, triangle_count - i), vertex_base);
+		}
+		first_triangle += triangle_count;
+	}
+	const u32 range_count = static_cast<u32>(ranges.size());
+	
+	// Reorder the triangles of each range, and find the first range which references each vertex
+	static const score_table scores;
+	std::vector<u32> owners(vertices.size(), invalid_index);
+	parallel_for
+	(
+		range_count,
+		thread_count,
+		[&](std::size_t r)
+		{
+			const auto& range = ranges[r];
+			std::vector<triangle> range_triangles(range.count);
+			for (std::size_t i = 0; i < range.count; ++i)
+			{
+				range_triangles[i] = triangles[range.first + i];
+			}
+			
+			reorder_triangles(range_triangles, scores);
+			
+			for (std::size_t i = 0; i < range.count; ++i)
+			{
+				const auto& t = range_triangles[i];
+				triangles[range.first + i] = t;
+				for (const u32 index: {t.a, t.b, t.c})
+				{
+					std::atomic_ref<u32> owner(owners[static_cast<std::size_t>(range.vertex_base + index)]);
+					for (u32 expected = owner.load(std::memory_order_relaxed); r < expected && !owner.compare_exchange_weak(expected, static_cast<u32>(r), std::memory_order_relaxed);)
+					{
+					}
+				}
+			}
+		}
+	);
+	
+	// Number the vertices owned by each range in the order in which its triangles first reference them. Unreferenced vertices follow all others, in their original order
+	std::vector<u32> positions(vertices.size(), invalid_index);
+	std::vector<u64> range_offsets(std::size_t{range_count} + 1, 0);
+	parallel_for
+	(
+		range_count,
+		thread_count,
+		[&](std::size_t r)
+		{
+			const auto& range = ranges[r];
+			u32 position = 0;
+			for (std::size_t i = 0; i < range.count; ++i)
+			{
+				const auto& t = triangles[range.first + i];
+				for (const u32 index: {t.a, t.b, t.c})
+				{
+					const std::size_t v = static_cast<std::size_t>(range.vertex_base + index);
+					if (owners[v] == r && positions[v] == invalid_index)
+					{
+						positions[v] = position++;
+					}
+				}
+			}
+			range_offsets[r + 1] = position;
+		}
+	);
+	u32 unreferenced_count = 0;
+	for (std::size_t v = 0; v < vertices.size(); ++v)
+	{
+		if (owners[v] == invalid_index)
+		{
+			owners[v] = range_count;
+			positions[v] = unreferenced_count++;
+		}
+	}
+	for (std::size_t r = 0; r < range_count; ++r)
+	{
+		range_offsets[r + 1] += range_offsets[r];
+	}
+	auto new_index = [&](std::size_t v) -> u64
+	{
+		return range_offsets[owners[v]] + positions[v];
+	};
+	
+	// Vertices of meshes with no more than 2^32 vertices are indexed from zero. Otherwise, each range is based at the lowest vertex it references
+	const bool large = vertices.size() > u64{1} << 32;
+	std::vector<u64> range_bases(range_count, 0);
+	parallel_for
+	(
+		range_count,
+		thread_count,
+		[&](std::size_t r)
+		{
+			const auto& range = ranges[r];
+			u64 min_index = std::numeric_limits<u64>::max();
+			u64 max_index = 0;
+			for (std::size_t i = 0; i < range.count; ++i)
+			{
+				const auto& t = triangles[range.first + i];
+				for (const u32 index: {t.a, t.b, t.c})
+				{
+					const u64 v = new_index(static_cast<std::size_t>(range.vertex_base + index));
+					min_index = std::min(min_index, v);
+					max_index = std::max(max_index, v);
+				}
+			}
+			if (large)
+			{
+				if (max_index - min_index > std::numeric_limits<u32>::max())
+				{
+					throw std::runtime_error("vertex indices too far apart to optimize");
+				}
+				range_bases[r] = min_index;
+			}
+			
+			for (std::size_t i = 0; i < range.count; ++i)
+			{
+				auto& t = triangles[range.first + i];
+				t.a = static_cast<u32>(new_index(static_cast<std::size_t>(range.vertex_base + t.a)) - range_bases[r]);
+				t.b = static_cast<u32>(new_index(static_cast<std::size_t>(range.vertex_base + t.b)) - range_bases[r]);
+				t.c = static_cast<u32>(new_index(static_cast<std::size_t>(range.vertex_base + t.c)) - range_bases[r]);
+			}
+		}
+	);
+	
+	// Rebuild triangle chunks, merging consecutive ranges with the same base
+	chunks.clear();
+	for (std::size_t r = 0; r < range_count; ++r)
+	{
+		if (!chunks.empty() && chunks.back().vertex_base == range_bases[r])
+		{
+			chunks.back().triangle_count += ranges[r].count;
+		}
+		else
+		{
+			chunks.emplace_back(ranges[r].count, range_bases[r]);
+		}
+	}
+	
+	// Permute vertices, one page at a time
+	paged_vector<vertex> reordered;
+	reordered.resize(vertices.size());
+	const std::size_t page_count = (vertices.size() + paged_vector<vertex>::page_size - 1) / paged_vector<vertex>::page_size;
+	parallel_for
+	(
+		page_count,
+		thread_count,
+		[&](std::size_t page)
+		{
+			const std::size_t first = page * paged_vector<vertex>::page_size;
+			const std::size_t last = std::min(first + paged_vector<vertex>::page_size, vertices.size());
+			for (std::size_t v = first; v < last; ++v)
+			{
+				reordered[static_cast<std::size_t>(new_index(v))] = vertices[v];
+			}
+		}
+	);
+	vertices = std::move(reordered);
+}
@@ -0,0 +1,53 @@
+// SPDX-FileCopyrightText: 2023 C. J. Howard
+// SPDX-License-Identifier: MIT
+
+#include "siafu.hpp"
+#include <cstring>
+
+void load_volume(volume& source, u32 thread_count, u32 queue_depth)
+{
+	if (source.voxels)
+	{
+		return;
+	}
+	
+	// Allocate voxels
+	const std::size_t slice_size_bytes = source.slice_size();
+	auto voxels = std::make_unique_for_overwrite<std::byte[]>(slice_size_bytes * source.depth);
+	
+	if (source.read_slices)
+	{
+		// Load all Z-slices at once
+		source.read_slices(voxels.get(), thread_count, queue_depth);
+	}
+	else
+	{
+		// Load Z-slices in parallel
+		parallel_for
+		(
+			source.depth,
+			thread_count,
+			[&](std::size_t i)
+			{
+				std::byte* slice = voxels.get() + slice_size_bytes * i;
+				if (const std::byte* data = source.read_slice(static_cast<u32>(i), slice); data != slice)
+				{
+					std::memcpy(slice, data, slice_size_bytes);
+					if (source.release_slice)
+					{
+						source.release_slice(static_cast<u32>(i));
+					}
+				}
+			}
+		);
+	}
+	
+	// Read Z-slices from memory
+	source.voxels = std::move(voxels);
+	source.read_slice = [voxels = source.voxels, slice_size_bytes](u32 z, std::byte*) -> const std::byte*
+	{
+		return voxels.get() + slice_size_bytes * z;
+	};
+	source.release_slice = nullptr;
+	source.read_slices = nullptr;
+}